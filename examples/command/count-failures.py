@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+
+# This example script runs as a coprocess: it is started once and reads one
+# JSON array per line on stdin, the whole match followed by the captures.
+# It counts failed logins per remote host and prints a line every 5th time.
+# When running llad normally, this will end up in the "daemon" facility of
+# syslog.
+
+import json
+import sys
+
+failures = {}
+
+for line in sys.stdin:
+    try:
+        match, user, host = json.loads(line)
+    except ValueError:
+        continue
+    failures[host] = failures.get(host, 0) + 1
+    if failures[host] % 5 == 0:
+        print("%d failed logins from %s, last for user %s"
+              % (failures[host], host, user), flush=True)
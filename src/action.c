@@ -1,39 +1,195 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include "action.h"
 
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <pcre.h>
-#include <semaphore.h>
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
 
 #include "common.h"
 #include "daemon.h"
+#include "eventloop.h"
+#include "prefilter.h"
+#include "lazydfa.h"
+#include "rulecache.h"
+#include "spawner.h"
 #include "util.h"
 
+/* size of the buffer for a line of command output */
+#define OUTPUT_BUFSIZE 4096
+
+/* default maximum number of commands running at the same time */
+#define DEFAULT_MAX_RUNNING 32
+
+/* default maximum number of queued commands */
+#define DEFAULT_QUEUE_SIZE 256
+
+/* initial and maximum size of the JIT stack of an ActionMatcher */
+#define JIT_STACK_START (32 * 1024)
+#define JIT_STACK_MAX (512 * 1024)
+
+/* maximum number of threads compiling patterns */
+#define MAX_COMPILERS 64
+
+/* a pattern taking longer to compile is reported (us) */
+#define SLOW_COMPILE 50000
+
+/* delay before restarting a coprocess, doubled after each quick exit (ms) */
+#define COPROC_BACKOFF_MIN 1000
+
+/* maximum delay before restarting a coprocess, one that ran for at least
+ * this long is restarted with the minimum delay again (ms) */
+#define COPROC_BACKOFF_MAX 60000
+
+/* state of a coprocess Action */
+struct coproc;
+typedef struct coproc Coproc;
+
 struct action
 {
-    const CfgAct *cfgAct;	/* config section */
+    char *name;			/* name of the action */
+    char *pattern;		/* pattern from the config section */
+    char *command;		/* command to execute */
     Action *next;		/* pointer to next Action in list */
-    pcre *re;			/* Compiled regular expression from pattern */
-    pcre_extra *extra;		/* Study data for regular expression */
-    unsigned int ovecsize;	/* size of vector used for matching */
-    int ovec[];			/* variable-sized vector */
+    Coproc *coproc;		/* coprocess state, NULL if not a coprocess */
+    pcre2_code *re;		/* Compiled regular expression from pattern,
+				 * read-only while matching */
+    Prefilter *filter;		/* literals of the whole chain, only in the
+				 * first Action, NULL if not built yet */
+    char *literal;		/* literal required for a match, NULL if none */
+    size_t literalLen;		/* length of the literal */
+    int literalId;		/* id of the literal in the chain's filter,
+				 * -1 if none */
+    LazyDfa *dfa;		/* combined patterns of the whole chain, only
+				 * in the first Action, NULL if not used */
+    int dfaId;			/* id of the pattern in the chain's dfa, -1 if
+				 * not supported */
+    int concurrency;		/* max running commands, 0 for no limit */
+    int running;		/* number of running commands */
+    int execs;			/* ActionExecs referring to this Action */
+    int registered;		/* flag, set up for executing commands */
+    int retired;		/* flag, no longer in a chain, freed with its
+				 * last ActionExec */
+    CfgActFraming framing;	/* framing of records for a coprocess */
+    uint32_t numGroups;		/* capturing groups plus the whole match */
+};
+
+struct actionMatcher
+{
+    pcre2_match_data *data;	/* positions of the last match */
+    pcre2_match_context *context;   /* context using jitStack */
+    pcre2_jit_stack *jitStack;	/* stack for JIT compiled patterns */
+    unsigned char *found;	/* literals found in the current line */
+    unsigned char *dfaMatched;	/* patterns possibly matching the current
+				 * line */
+    size_t foundSize;		/* allocated size of found */
+    size_t dfaMatchedSize;	/* allocated size of dfaMatched */
+};
+
+/* a match waiting for its command to be executed */
+struct pendingMatch;
+typedef struct pendingMatch PendingMatch;
+
+struct pendingMatch
+{
+    PendingMatch *next;		/* next recorded match */
+    Action *action;		/* the matching Action */
+    const char *line;		/* the matched line */
+    int numArgs;		/* number of matched groups */
+    PCRE2_SIZE ovec[];		/* positions of the matched groups */
 };
 
-/* arguments to pass to a thread controlling an action */
-struct actionExecArgs
+struct actionMatches
+{
+    PendingMatch *first;	/* first recorded match */
+    PendingMatch *last;		/* last recorded match */
+    unsigned long lines;	/* lines checked since the last execution */
+    unsigned long rejected;	/* lines rejected by the prefilter */
+    unsigned long skipped;	/* pattern matches skipped */
+};
+
+/* policies for a full queue */
+typedef enum overflowPolicy
+{
+    OP_NEWEST,		/* drop the new command */
+    OP_OLDEST,		/* drop the oldest queued command */
+    OP_COALESCE		/* drop new commands identical to a queued one,
+			 * otherwise the new command */
+} OverflowPolicy;
+
+/* states of an executed command */
+typedef enum execState
+{
+    ES_RUNNING,		/* reading output until the pipe is closed */
+    ES_PIPEWAIT,	/* pipe closed, waiting for exit */
+    ES_TERMWAIT,	/* sent SIGTERM, waiting for exit */
+    ES_KILLWAIT		/* sent SIGKILL, waiting for exit */
+} ExecState;
+
+/* an executed command, controlled from the EventLoop */
+struct actionExec;
+typedef struct actionExec ActionExec;
+
+struct actionExec
 {
     const char *actname;	/* name of the action */
     const char *cmdname;	/* command to execute */
     char **cmd;			/* command line for execv, NULL-terminated */
+    Action *action;		/* the Action this command belongs to */
+    ActionExec *next;		/* next command in queue or running list */
+    Timer *timer;		/* timeout for the current state */
+    ExecState state;		/* current state */
+    pid_t pid;			/* process id of the command */
+    unsigned spawnId;		/* request id if launched by spawner helper */
+    int infd;			/* writing end of input pipe of a coprocess,
+				 * -1 if closed */
+    int outfd;			/* reading end of output pipe, -1 if closed */
+    int pidfd;			/* pidfd of the process, -1 if not available */
+    int status;			/* exit status, valid if exited, -1 if
+				 * unknown */
+    int exited;			/* flag, process exited and was reaped */
+    size_t buflen;		/* number of bytes in buf */
+#ifdef DEBUG
+    struct timespec matched;	/* time of the match, for measuring latency */
+#endif
+    char buf[OUTPUT_BUFSIZE];	/* incomplete line of output */
+};
+
+/* a record waiting to be written to a coprocess */
+struct record;
+typedef struct record Record;
+
+struct record
+{
+    Record *next;		/* next waiting record */
+    size_t len;			/* length of data */
+    char data[];		/* the framed record */
+};
+
+struct coproc
+{
+    Action *nextCoproc;		/* next coprocess Action */
+    ActionExec *exec;		/* the running command, NULL if not running */
+    Record *first;		/* first record waiting to be written */
+    Record *last;		/* last record waiting to be written */
+    Timer *restartTimer;	/* timer for restarting the command */
+    long long startedAt;	/* time the command was started (ms) */
+    long long backoff;		/* delay before the next restart (ms) */
+    size_t written;		/* bytes of first record already written */
+    unsigned long dropped;	/* number of records dropped */
+    int numRecords;		/* number of records waiting */
+    int overflowing;		/* flag, dropping records */
 };
 
 static char *cmdpath = NULL;	/* configurable path for commands */
@@ -41,6 +197,13 @@ static int waitOutput = 120;	/* max time waiting for command output (sec) */
 static int pipeWait = 2;	/* max waiting time after pipe closed (sec) */
 static int termWait = 10;	/* max waiting time after SIGTERM */
 static int exitWait = 20;	/* max waiting time on daemon shutdown */
+static int maxRunning = DEFAULT_MAX_RUNNING;	/* max running commands */
+static int queueSize = DEFAULT_QUEUE_SIZE;	/* max queued commands */
+static char *overflow = NULL;	/* policy for full queue from popt */
+static int useDfa = 0;		/* flag, match patterns with a LazyDfa */
+static uint32_t maxGroups = 1;	/* most numGroups of any Action */
+static ActionMatcher *mainMatcher = NULL;   /* matcher of the main thread */
+static ActionMatches *mainMatches = NULL;   /* matches of the main thread */
 
 const struct poptOption action_opts[] = {
     {"cmd", 'p', POPT_ARG_STRING, &cmdpath, 0,
@@ -59,24 +222,130 @@ const struct poptOption action_opts[] = {
     {"wexit", '\0', POPT_ARG_INT, &exitWait, 0,
 	"Give actions <sec> seconds to complete after termination of llad was "
 	"requested before asking them to terminate, defaults to 20.", "sec"},
+    {"max-running", '\0', POPT_ARG_INT, &maxRunning, 0,
+	"Run at most <n> commands at the same time, further commands are "
+	"queued, defaults to 32.", "n"},
+    {"queue-size", '\0', POPT_ARG_INT, &queueSize, 0,
+	"Queue at most <n> commands waiting to be run, defaults to 256.", "n"},
+    {"queue-overflow", '\0', POPT_ARG_STRING, &overflow, 0,
+	"What to do when the queue is full: drop the `newest' command, drop "
+	"the `oldest' queued command or `coalesce' -- drop commands identical "
+	"to an already queued one, and otherwise the newest. "
+	"Defaults to newest.", "policy"},
+    {"dfa", '\0', POPT_ARG_NONE, &useDfa, 0,
+	"Match all patterns for a logfile in a single pass using a combined, "
+	"lazily built DFA. PCRE is then only used for extracting the groups "
+	"of matching actions and for patterns the DFA doesn't support.",
+	NULL},
     POPT_TABLEEND
 };
 
 static int classInitialized = 0; /* flag for static initialization */
+static OverflowPolicy policy = OP_NEWEST;   /* policy for full queue */
+
+static ActionExec *firstExec = NULL;	/* first running command */
+static ActionExec *firstQueued = NULL;	/* first queued command */
+static ActionExec *lastQueued = NULL;	/* last queued command */
+static int numRunning = 0;		/* number of running commands */
+static int numQueued = 0;		/* number of queued commands */
+static int overflowing = 0;		/* flag, dropping queued commands */
+static unsigned long totalStarted = 0;	/* number of commands started */
+static unsigned long totalDropped = 0;	/* number of commands dropped */
+static unsigned long totalCoalesced = 0;    /* number of commands coalesced */
+static Action *firstCoproc = NULL;	/* first coprocess Action */
+static int numCoprocs = 0;		/* number of running coprocesses */
+static unsigned long totalRecords = 0;	/* records written to coprocesses */
+static unsigned long totalLines = 0;	/* lines checked for matches */
+static unsigned long totalRejected = 0;	/* lines rejected by the prefilter */
+static unsigned long totalSkipped = 0;	/* pattern matches skipped */
+static int sigchldHandled = 0;		/* flag, SIGCHLD used for reaping */
+static int shuttingDown = 0;		/* flag, waiting for pending actions */
+static int waitResult = 1;		/* result of waiting for pending */
+static Timer *exitTimer = NULL;		/* timeout for pending actions */
+
+/* destroy the prefilter of a chain, it is built again when needed */
+static void
+dropFilter(Action *self)
+{
+    prefilter_free(self->filter);
+    lazyDfa_free(self->dfa);
+    self->filter = NULL;
+    self->dfa = NULL;
+}
+
+/* set up an Action for executing commands when it first joins a chain,
+ * it may have been created in another thread */
+static void
+registerAction(Action *self)
+{
+    struct sigaction handler;
+
+    if (self->registered) return;
+    self->registered = 1;
+
+    /* match data of matchers grows to the largest Action */
+    if (self->numGroups > maxGroups) maxGroups = self->numGroups;
+
+    /* do static initialization if not done before */
+    if (!classInitialized)
+    {
+	classInitialized = 1;
+	if (maxRunning < 1)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Invalid maximum of running commands %d, using default.",
+		    maxRunning);
+	    maxRunning = DEFAULT_MAX_RUNNING;
+	}
+	if (queueSize < 0)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Invalid queue size %d, using default.", queueSize);
+	    queueSize = DEFAULT_QUEUE_SIZE;
+	}
+	if (!overflow || !strcmp(overflow, "newest")) policy = OP_NEWEST;
+	else if (!strcmp(overflow, "oldest")) policy = OP_OLDEST;
+	else if (!strcmp(overflow, "coalesce")) policy = OP_COALESCE;
+	else
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Unknown queue overflow policy `%s', using newest.",
+		    overflow);
+	    policy = OP_NEWEST;
+	}
+    }
+
+    if (self->coproc)
+    {
+	if (!firstCoproc)
+	{
+	    /* a coprocess closing its input must not kill the daemon, writing
+	     * just fails with EPIPE then */
+	    memset(&handler, 0, sizeof(handler));
+	    handler.sa_handler = SIG_IGN;
+	    sigemptyset(&(handler.sa_mask));
+	    sigaction(SIGPIPE, &handler, NULL);
+	}
 
-static int numThreads = 0;		/* current number of running threads */
-static pthread_mutex_t numThreadsLock	/* mutex for numThreads */
-	= PTHREAD_MUTEX_INITIALIZER;
-static sem_t threadsLock;		/* locked indicates running threads */
-static sem_t forceExit;			/* unlocked indicates daemon shutdown */
+	/* the command is started with the first match */
+	self->coproc->nextCoproc = firstCoproc;
+	firstCoproc = self;
+    }
+}
 
 Action *
 action_append(Action *self, Action *act)
 {
     Action *curr;
 
+    for (curr = act; curr; curr = curr->next) registerAction(curr);
+
     if (self)
     {
+	/* the chain changes, so do its literals */
+	dropFilter(self);
+	dropFilter(act);
+
 	curr = self;
 	while (curr->next) curr = curr->next;
 	curr->next = act;
@@ -86,433 +355,1687 @@ action_append(Action *self, Action *act)
 }
 
 Action *
-action_appendNew(Action *self, const CfgAct *cfgAct)
+Action_new(const CfgAct *cfgAct)
 {
-    Action *next;
-    pcre *re;
-    pcre_extra *extra;
-    unsigned int ovecsize;
-    const char *error;
-    int erroffset;
-
-    /* compile pattern to PCRE regular expression */
-    re = pcre_compile(cfgAct_pattern(cfgAct), 0, &error, &erroffset, NULL);
+    Action *self;
+    pcre2_code *re;
+    PCRE2_UCHAR error[256];
+    PCRE2_SIZE erroffset;
+    int errcode;
+    uint32_t numGroups;
+
+    /* compile pattern to PCRE regular expression, unless it was compiled
+     * at the last start already */
+    if (!(re = RuleCache_take(cfgAct_pattern(cfgAct))))
+    {
+	re = pcre2_compile((PCRE2_SPTR)cfgAct_pattern(cfgAct),
+		PCRE2_ZERO_TERMINATED, 0, &errcode, &erroffset, NULL);
+    }
     if (!re)
     {
+	pcre2_get_error_message(errcode, error, sizeof(error));
 	Daemon_printf_level(LEVEL_WARNING,
-		"Action `%s' error in pattern: %s",
-		cfgAct_name(cfgAct), error);
+		"Action `%s' error in pattern at offset %lu: %s",
+		cfgAct_name(cfgAct), (unsigned long)erroffset, (char *)error);
 	return NULL;
     }
 
-    /* study regular expression, if possible use JIT compilation */
-    extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &error);
-
-    /* calculate needed vector size for matching:
-     * pcre_exec() needs 2 elements for the whole match, 2 elements for each
-     * capturing group (to pass begin and end positions in the subject string)
-     * plus one additional element per pair for internal use, so use the
-     * formula (num_capturing_groups + 1) * 3
-     */
-    ovecsize = 0;
-    pcre_fullinfo(re, extra, PCRE_INFO_CAPTURECOUNT, &ovecsize);
-    ++ovecsize;
-    ovecsize *= 3;
-
-    /* create and initialize new Action object */
-    next = lladAlloc(sizeof(Action) + ovecsize * sizeof(int));
-    next->next = NULL;
-    next->cfgAct = cfgAct;
-    next->re = re;
-    next->extra = extra;
-    next->ovecsize = ovecsize;
+    /* if possible use JIT compilation, otherwise PCRE2 falls back to the
+     * interpreter */
+    pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+
+    /* match data needs a pair of positions for the whole match and each
+     * capturing group */
+    numGroups = 0;
+    pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &numGroups);
+    ++numGroups;
+
+    /* create and initialize new Action object, it keeps copies of the
+     * config values, so the config can be reloaded while it exists */
+    self = lladAlloc(sizeof(Action));
+    self->name = lladCloneString(cfgAct_name(cfgAct));
+    self->pattern = lladCloneString(cfgAct_pattern(cfgAct));
+    self->command = lladCloneString(cfgAct_command(cfgAct));
+    self->next = NULL;
+    self->re = re;
+    self->coproc = NULL;
+    self->filter = NULL;
+    self->literalId = -1;
+    self->dfa = NULL;
+    self->dfaId = -1;
+    self->concurrency = cfgAct_concurrency(cfgAct);
+    self->running = 0;
+    self->execs = 0;
+    self->registered = 0;
+    self->retired = 0;
+    self->framing = cfgAct_framing(cfgAct);
+    self->numGroups = numGroups;
+
+    /* find a literal string that must occur in every matching line, so
+     * lines without it don't need to be matched */
+    self->literal = Prefilter_requiredLiteral(self->pattern,
+	    &(self->literalLen));
+    if (self->literal)
+    {
+	Daemon_printf_level(LEVEL_DEBUG,
+		"[action.c] Action `%s' requires literal `%.*s'",
+		self->name, (int)self->literalLen, self->literal);
+    }
 
-    /* do static initialization if not done before */
-    if (!classInitialized)
+    if (cfgAct_mode(cfgAct) == CAM_COPROCESS)
     {
-	classInitialized = 1;
-	sem_init(&threadsLock, 0, 1); /* unlocked -> no threads running */
-	sem_init(&forceExit, 0, 0);   /* locked -> not shutting down */
+	self->coproc = lladAlloc(sizeof(Coproc));
+	memset(self->coproc, 0, sizeof(Coproc));
+	self->coproc->backoff = COPROC_BACKOFF_MIN;
+    }
+
+    return self;
+}
+
+/* patterns compiled by Action_newAll(), shared by its threads */
+typedef struct compileJob
+{
+    const CfgAct *const *cfgActs;   /* the config file entries */
+    Action **actions;		    /* receives the Actions */
+    long *times;		    /* receives the compile times (us) */
+    size_t num;			    /* number of entries */
+    size_t next;		    /* next entry to compile, under lock */
+    pthread_mutex_t lock;	    /* protects next */
+} CompileJob;
+
+/* compile entries of a CompileJob until none are left, the main function
+ * of the compiler threads */
+static void *
+compilerMain(void *data)
+{
+    CompileJob *job = data;
+    struct timespec start;
+    size_t i;
+
+    for (;;)
+    {
+	pthread_mutex_lock(&(job->lock));
+	i = job->next++;
+	pthread_mutex_unlock(&(job->lock));
+	if (i >= job->num) break;
+	if (!job->cfgActs[i]) continue;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->actions[i] = Action_new(job->cfgActs[i]);
+	job->times[i] = lladElapsedUs(&start);
+    }
+    return NULL;
+}
+
+void
+Action_newAll(const CfgAct *const *cfgActs, Action **actions, size_t num)
+{
+    CompileJob job;
+    pthread_t threads[MAX_COMPILERS];
+    struct timespec start;
+    sigset_t all, old;
+    long slowest = 0;
+    int cpus;
+    int numThreads = 0;
+    size_t i, numCompiled = 0;
+
+    job.cfgActs = cfgActs;
+    job.actions = actions;
+    job.times = lladAlloc((num + 1) * sizeof(long));
+    job.num = num;
+    job.next = 0;
+    pthread_mutex_init(&(job.lock), NULL);
+    for (i = 0; i < num; ++i)
+    {
+	actions[i] = NULL;
+	job.times[i] = 0;
+	if (cfgActs[i]) ++numCompiled;
+    }
+
+    /* the calling thread compiles as well, so one thread less is needed
+     * than there are CPUs */
+    cpus = lladWorkers(numCompiled, MAX_COMPILERS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* signals are handled by the EventLoop in the main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; numThreads < cpus - 1; ++numThreads)
+    {
+	if ((errno = pthread_create(&(threads[numThreads]), NULL,
+			&compilerMain, &job)))
+	{
+	    /* the threads started so far do all the work */
+	    Daemon_perror("pthread_create()");
+	    break;
+	}
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    compilerMain(&job);
+    for (i = 0; i < (size_t)numThreads; ++i) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&(job.lock));
+
+    /* log in config file order, independent of the threads */
+    for (i = 0; i < num; ++i)
+    {
+	if (!actions[i]) continue;
+	if (job.times[i] > slowest) slowest = job.times[i];
+	if (job.times[i] >= SLOW_COMPILE)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Action `%s' took %ld ms to compile its pattern.",
+		    actions[i]->name, job.times[i] / 1000);
+	}
+	else
+	{
+	    Daemon_printf_level(LEVEL_DEBUG,
+		    "[action.c] Action `%s' compiled in %ld us.",
+		    actions[i]->name, job.times[i]);
+	}
+    }
+    if (numCompiled)
+    {
+	Daemon_printf("Compiled %lu patterns in %ld ms using %d threads, "
+		"slowest took %ld ms.", (unsigned long)numCompiled,
+		lladElapsedUs(&start) / 1000, numThreads + 1, slowest / 1000);
+    }
+    free(job.times);
+}
+
+void
+Action_writeCache(Action *const *actions, size_t num)
+{
+    const char **patterns = lladAlloc((num + 1) * sizeof(char *));
+    const pcre2_code **codes = lladAlloc((num + 1) * sizeof(pcre2_code *));
+    size_t i;
+
+    for (i = 0; i < num; ++i)
+    {
+	patterns[i] = actions[i] ? actions[i]->pattern : NULL;
+	codes[i] = actions[i] ? actions[i]->re : NULL;
     }
+    RuleCache_write(patterns, codes, num);
+    free(codes);
+    free(patterns);
+}
+
+Action *
+action_appendNew(Action *self, const CfgAct *cfgAct)
+{
+    Action *next = Action_new(cfgAct);
 
+    if (!next) return NULL;
     return action_append(self, next);
 }
 
-/* create arguments to pass to controlling thread */
-struct actionExecArgs *
-createExecArgs(const Action *self, const char *line, int numArgs)
+int
+action_isConfigured(const Action *self, const CfgAct *cfgAct)
+{
+    return !strcmp(self->name, cfgAct_name(cfgAct))
+	&& !strcmp(self->pattern, cfgAct_pattern(cfgAct))
+	&& !strcmp(self->command, cfgAct_command(cfgAct))
+	&& self->concurrency == cfgAct_concurrency(cfgAct)
+	&& (self->coproc ? CAM_COPROCESS : CAM_EXEC) == cfgAct_mode(cfgAct)
+	&& self->framing == cfgAct_framing(cfgAct);
+}
+
+int
+action_contains(const Action *self, const CfgAct *cfgAct)
+{
+    for (; self; self = self->next)
+    {
+	if (action_isConfigured(self, cfgAct)) return 1;
+    }
+    return 0;
+}
+
+Action *
+action_take(Action **chain, const CfgAct *cfgAct)
+{
+    Action **curr;
+    Action *act;
+
+    for (curr = chain; *curr; curr = &((*curr)->next))
+    {
+	if (!action_isConfigured(*curr, cfgAct)) continue;
+
+	/* the literals of both chains change */
+	act = *curr;
+	dropFilter(*chain);
+	*curr = act->next;
+	act->next = NULL;
+	dropFilter(act);
+	return act;
+    }
+    return NULL;
+}
+
+/* create structure for executing the command of a matched Action */
+static ActionExec *
+createExec(Action *self, const char *line, const PCRE2_SIZE *ovec,
+	int numArgs)
 {
     char *cmdName;
     char *arg;
     const char *path;
     int i;
     size_t captureLength;
-    struct actionExecArgs *args;
+    ActionExec *exec;
 
     /* determine path of commands, option overrides compile time config */
     path = cmdpath;
     if (!path) path = LLADCOMMANDS;
 
     /* allocate and initialize structure */
-    args = lladAlloc(sizeof(struct actionExecArgs));
-    args->actname = cfgAct_name(self->cfgAct);
-    args->cmdname = cfgAct_command(self->cfgAct);
-    args->cmd = lladAlloc((size_t)(numArgs + 2) * sizeof(char *));
+    exec = lladAlloc(sizeof(ActionExec));
+    exec->actname = self->name;
+    exec->cmdname = self->command;
+    exec->cmd = lladAlloc((size_t)(numArgs + 2) * sizeof(char *));
+    exec->action = self;
+    ++self->execs;
+    exec->next = NULL;
+    exec->timer = NULL;
+    exec->state = ES_RUNNING;
+    exec->pid = -1;
+    exec->spawnId = 0;
+    exec->infd = -1;
+    exec->outfd = -1;
+    exec->pidfd = -1;
+    exec->status = 0;
+    exec->exited = 0;
+    exec->buflen = 0;
+#ifdef DEBUG
+    clock_gettime(CLOCK_MONOTONIC, &(exec->matched));
+#endif
 
     /* determine full path for executed command */
-    cmdName = lladAlloc(strlen(path) + strlen(args->cmdname) + 2);
+    cmdName = lladAlloc(strlen(path) + strlen(exec->cmdname) + 2);
     strcpy(cmdName, path);
     strcat(cmdName, "/");
-    strcat(cmdName, args->cmdname);
-    args->cmd[0] = cmdName;
+    strcat(cmdName, exec->cmdname);
+    exec->cmd[0] = cmdName;
 
     /* pass matches as arguments to executed command */
     for (i = 0; i < numArgs; ++i)
     {
-	/* safe conversion if we trust libpcre */
-	captureLength = (size_t)(self->ovec[2*i+1] - self->ovec[2*i]);
+	/* groups that didn't match are passed empty */
+	captureLength = ovec[2*i] == PCRE2_UNSET ? 0 : ovec[2*i+1] - ovec[2*i];
 	arg = lladAlloc(captureLength + 1);
 	arg[captureLength] = '\0';
-	strncpy(arg, line + self->ovec[2*i], captureLength);
-	args->cmd[i+1] = arg;
+	if (captureLength) memcpy(arg, line + ovec[2*i], captureLength);
+	exec->cmd[i+1] = arg;
     }
-    args->cmd[numArgs+1] = NULL;
+    exec->cmd[numArgs+1] = NULL;
 
-    return args;
+    return exec;
 }
 
-void
-freeExecArgs(struct actionExecArgs *args)
+/* destroy an Action no longer needed by a chain or a command */
+static void destroy(Action *self);
+
+static void
+freeExec(ActionExec *exec)
 {
-    char **argptr = args->cmd;
+    Action *action = exec->action;
+    char **argptr = exec->cmd;
     while (*argptr)
     {
 	free (*argptr);
 	++argptr;
     }
-    free(args->cmd);
-    free(args);
+    free(exec->cmd);
+    free(exec);
+
+    /* an Action removed by reloading the config goes with its last
+     * command */
+    if (!--action->execs && action->retired) destroy(action);
 }
 
-/* wait a given time for child process to exit */
-static int
-actionWaitEndLoop(pid_t pid, int *status, int maxwait)
+/* set timeout for the current state of an executed command */
+static void actionExec_setTimer(ActionExec *self, int sec);
+
+/* start queued commands while possible */
+static void runQueued(void);
+
+/* schedule restarting a coprocess that exited or couldn't be started */
+static void coproc_exited(Action *self);
+
+/* close input pipe of a coprocess */
+static void
+actionExec_closeInput(ActionExec *self)
 {
-    int rc;
-    int counter = maxwait;
+    if (self->infd < 0) return;
+
+    EventLoop_removeFd(self->infd);
+    close(self->infd);
+    self->infd = -1;
+}
+
+/* remove a command from the list of running commands and destroy it */
+static void
+actionExec_remove(ActionExec *self)
+{
+    ActionExec **curr = &firstExec;
+    Action *action = self->action;
+    int coproc = action->coproc != NULL;
+
+    while (*curr && *curr != self) curr = &((*curr)->next);
+    if (*curr) *curr = self->next;
 
-    while (counter--)
+    if (self->timer) EventLoop_cancelTimer(self->timer);
+    actionExec_closeInput(self);
+
+    if (coproc)
     {
-	rc = waitpid(pid, status, WNOHANG);
-	if (rc < 0)
-	{
-	    /* error waiting */
-	    Daemon_perror("waidpid()");
-	    return -1;
-	}
-	if (rc == (int)pid && (WIFEXITED(*status) || WIFSIGNALED(*status)))
-	{
-	    /* child exited */
-	    return (int)pid;
-	}
-	sleep(1);
+	/* coprocesses are restarted instead */
+	--numCoprocs;
+	coproc_exited(action);
+    }
+    else
+    {
+	--numRunning;
+	--action->running;
     }
 
-    /* child still running */
-    return 0;
+    /* this may destroy the Action */
+    freeExec(self);
+
+    /* free slot can be used by a queued command */
+    if (!coproc) runQueued();
+
+    /* when waiting for pending actions, stop after the last one */
+    if (shuttingDown && !firstExec && !firstQueued) EventLoop_stop();
 }
 
-/* wait for child process to exit, send signals as necessary */
+/* log exit status of a command and destroy it */
 static void
-actionWaitEnd(struct actionExecArgs *args, pid_t pid)
+actionExec_finish(ActionExec *self)
 {
-    int rc;
-    int status;
     int retcode;
 
-    /* wait for some time */
-    rc = actionWaitEndLoop(pid, &status, pipeWait);
-    if (rc < 0) return;
-    if (!rc)
+    /* determine how child exited and log */
+    if (self->status < 0)
     {
-	/* not yet exited, send SIGTERM and wait again */
+	/* waitpid() failed or the spawner helper couldn't report it */
 	Daemon_printf_level(LEVEL_NOTICE,
-		"[%s] %s still running, sending SIGTERM to %d...",
-		args->actname, args->cmdname, pid);
-	kill(pid, SIGTERM);
-	rc = actionWaitEndLoop(pid, &status, termWait);
-	if (rc < 0) return;
+		"[%s] %s (%d) finished with unknown exit status.",
+		self->actname, self->cmdname, self->pid);
     }
-    if (!rc)
+    else if (WIFEXITED(self->status))
     {
-	/* not yet exited, send SIGKILL and wait until child died */
-	Daemon_printf_level(LEVEL_WARNING,
-		"[%s] %s still running, sending SIGKILL to %d...",
-		args->actname, args->cmdname, pid);
-	kill(pid, SIGKILL);
-	if (waitpid(pid, &status, 0) < 0) return;
-    }
-
-    /* determine how child exited and log */
-    if (WIFEXITED(status))
-    {
-	retcode = WEXITSTATUS(status);
+	retcode = WEXITSTATUS(self->status);
 	if (retcode)
 	{
 	    Daemon_printf_level(LEVEL_NOTICE,
 		    "[%s] %s (%d) failed with exit code %d.",
-		    args->actname, args->cmdname, pid, retcode);
+		    self->actname, self->cmdname, self->pid, retcode);
 	}
 	else
 	{
 	    Daemon_printf("[%s] %s (%d) completed successfully.",
-		    args->actname, args->cmdname, pid);
+		    self->actname, self->cmdname, self->pid);
 	}
     }
-    else if (WIFSIGNALED(status))
+    else if (WIFSIGNALED(self->status))
     {
-	retcode = WTERMSIG(status);
+	retcode = WTERMSIG(self->status);
 	Daemon_printf_level(LEVEL_NOTICE,
 		"[%s] %s (%d) was terminated by signal %s.",
-		args->actname, args->cmdname, pid, strsignal(retcode));
+		self->actname, self->cmdname, self->pid, strsignal(retcode));
     }
+
+    actionExec_remove(self);
 }
 
-/* read line from pipe to child with timeout */
-static int
-readLine(FILE* file, char *buf, int bufsize, int timeout)
-{
-    int counter = timeout;
-    sigset_t set, oldset;
-    struct timeval tv;
-    fd_set rfds;
-    int fd;
-    int rc;
-    int rcout = 0;
+/* close output pipe of a command and wait for it to exit */
+static void actionExec_closePipe(ActionExec *self);
 
-    fd = fileno(file);
-    if (fd < 0) return -1;
+/* check whether the process of a command exited, finish the command if its
+ * output pipe is closed as well */
+static void
+actionExec_reap(ActionExec *self)
+{
+    pid_t rc;
 
-    /* don't allow interruptions by signals */
-    sigfillset(&set);
-    pthread_sigmask(SIG_SETMASK, &set, &oldset);
+    if (self->exited) return;
 
-    while (counter--)
+    rc = waitpid(self->pid, &(self->status), WNOHANG);
+    if (rc < 0)
     {
-	/* 1 second for each select() attempt */
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	FD_ZERO(&rfds);
-	FD_SET(fd, &rfds);
-
-	/* check whether daemon shutdown was requested */
-	if (!sem_trywait(&forceExit))
-	{
-	    /* pass on to next thread */
-	    sem_post(&forceExit);
-	    rcout = -2;
-	    break;
-	}
+	/* error waiting, nothing left to wait for, and how it exited is
+	 * unknown */
+	Daemon_perror("waitpid()");
+	self->status = -1;
+    }
+    else if (rc != self->pid)
+    {
+	/* still running */
+	return;
+    }
 
-	rc = select(fd+1, &rfds, NULL, NULL, &tv);
-	if (rc < 0)
-	{
-	    /* abort if select() fails */
-	    rcout = -1;
-	    break;
-	}
-	if (rc)
-	{
-	    /* data available -> read line and return */
-	    if (fgets(buf, bufsize, file)) rcout = 1;
-	    else rcout = -1;
-	    break;
-	}
+    self->exited = 1;
+    if (self->pidfd >= 0)
+    {
+	EventLoop_removeFd(self->pidfd);
+	close(self->pidfd);
+	self->pidfd = -1;
     }
 
-    /* restore signals */
-    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-    return rcout;
+    if (self->outfd < 0) actionExec_finish(self);
+
+    /* a coprocess doesn't get an output timeout, so don't wait for another
+     * process keeping its output pipe open */
+    else if (self->action->coproc) actionExec_closePipe(self);
 }
 
-/* main routine for controlling thread, open pipe and execute command */
-static void *
-actionExec(void *argsPtr)
+/* close output pipe of a command and wait for it to exit */
+static void
+actionExec_closePipe(ActionExec *self)
 {
-    int fds[2];
-    int devnull;
-    int len;
-    int rc;
-    pid_t pid;
-    char buf[4096];
-    FILE *output;
-    sigset_t sigset;
-    struct actionExecArgs *args = argsPtr;
-
-#ifdef DEBUG
-    Daemon_printf_level(LEVEL_DEBUG,
-	    "[action.c] Thread for action `%s' started.",
-	    args->actname);
-#endif
-
-    if (pipe(fds) < 0)
+    /* a last line without newline is logged as it is */
+    if (self->buflen)
     {
-	Daemon_perror("pipe()");
-	goto actionExec_done;
+	Daemon_printf("[%s] [%s:%d] %.*s", self->actname, self->cmdname,
+		self->pid, (int)self->buflen, self->buf);
+	self->buflen = 0;
     }
 
-    pid = fork();
-    if (pid < 0)
+    EventLoop_removeFd(self->outfd);
+    close(self->outfd);
+    self->outfd = -1;
+
+    /* a coprocess can't get more records when it is finishing */
+    actionExec_closeInput(self);
+
+    if (self->exited)
     {
-	Daemon_perror("fork()");
-	close(fds[0]);
-	close(fds[1]);
-	goto actionExec_done;
+	actionExec_finish(self);
     }
-
-    if (pid)
+    else
     {
-	close(fds[1]);
+	self->state = ES_PIPEWAIT;
+	actionExec_setTimer(self, pipeWait);
+    }
+}
 
-	/* open stream for pipe to read one line at a time */
-	output = fdopen(fds[0], "r");
+/* send a signal to a command */
+static void
+actionExec_signal(ActionExec *self, int signum)
+{
+    if (self->spawnId) Spawner_kill(self->spawnId, signum);
+    else kill(self->pid, signum);
+}
 
-	if (output)
-	{
-	    /* first disable buffering, because otherwise some lines might
-	     * never be read, thus missing from the log */
-	    setvbuf(output, NULL, _IONBF, 0);
+/* timer handler for a command, send signals as necessary */
+static void
+actionExec_timeout(void *data)
+{
+    ActionExec *self = data;
 
-	    /* read from pipe and log command output */
-	    while ((rc = readLine(output, buf, 4096, waitOutput)) > 0)
+    self->timer = NULL;
+    switch (self->state)
+    {
+	case ES_RUNNING:
+	    if (self->action->coproc)
 	    {
-		/* strip newline first */
-		len = (int)strlen(buf);
-		if (buf[len-1] == '\n') buf[len-1] = '\0';
-		if (buf[len-2] == '\r') buf[len-2] = '\0';
-		Daemon_printf("[%s] [%s:%d] %s",
-			args->actname, args->cmdname, pid, buf);
+		/* a coprocess is expected to consume its input */
+		Daemon_printf_level(LEVEL_NOTICE,
+			"[%s] %s (%d) accepted no input for %d seconds, "
+			"closing pipes.",
+			self->actname, self->cmdname, self->pid, waitOutput);
 	    }
-	    if (!rc)
+	    else
 	    {
-		/* readLine() == 0 means timeout occured */
 		Daemon_printf_level(LEVEL_NOTICE,
 			"[%s] %s (%d) created no output for %d seconds, "
 			"closing pipe.",
-			args->actname, args->cmdname, pid, waitOutput);
+			self->actname, self->cmdname, self->pid, waitOutput);
 	    }
-	    fclose(output);
-	}
-	else
-	{
-	    close(fds[0]);
-	}
-
-	/* wait for child process to exit */
-	actionWaitEnd(args, pid);
-    }
-    else
-    {
-	/* in child process, arrange stdio file descriptors */
-	close(fds[0]);
-	devnull = open("/dev/null", O_RDONLY);
-	dup2(devnull, STDIN_FILENO);
-	dup2(fds[1], STDOUT_FILENO);
-	dup2(fds[1], STDERR_FILENO);
-
-	/* block SIGINT, because this propagates when running interactively,
-	 * so children wouldn't get a chance to terminate normally when the
-	 * user hits Ctrl-C */
-	sigemptyset(&sigset);
-	sigaddset(&sigset, SIGINT);
-	sigprocmask(SIG_BLOCK, &sigset, NULL);
-
-	/* execute the command */
-	execv(args->cmd[0], args->cmd);
-
-	/* if execv returns, execution failed -> log (through pipe) and exit */
-	fprintf(stderr, "Cannot execute `%s': %s\n",
-		args->cmd[0], strerror(errno));
-	exit(EXIT_FAILURE);
-    }
+	    actionExec_closePipe(self);
+	    break;
 
-actionExec_done:
-    /* common cleanup code */
+	case ES_PIPEWAIT:
+	    /* not yet exited, send SIGTERM and wait again */
+	    Daemon_printf_level(LEVEL_NOTICE,
+		    "[%s] %s still running, sending SIGTERM to %d...",
+		    self->actname, self->cmdname, self->pid);
+	    actionExec_signal(self, SIGTERM);
+	    self->state = ES_TERMWAIT;
+	    actionExec_setTimer(self, termWait);
+	    break;
 
-    /* free arguments structure */
-    freeExecArgs(args);
+	case ES_TERMWAIT:
+	    /* not yet exited, send SIGKILL and wait until child died */
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "[%s] %s still running, sending SIGKILL to %d...",
+		    self->actname, self->cmdname, self->pid);
+	    actionExec_signal(self, SIGKILL);
+	    self->state = ES_KILLWAIT;
+	    break;
 
-    /* count down number of running threads, unlock threadsLock
-     * when reaching 0
-     */
-    pthread_mutex_lock(&numThreadsLock);
-    if (--numThreads == 0) sem_post(&threadsLock);
-    pthread_mutex_unlock(&numThreadsLock);
+	case ES_KILLWAIT:
+	    break;
+    }
+}
 
-    /* exit thread */
-    return NULL;
+static void
+actionExec_setTimer(ActionExec *self, int sec)
+{
+    if (self->timer) EventLoop_cancelTimer(self->timer);
+    self->timer = EventLoop_addTimer(sec * 1000LL,
+	    &actionExec_timeout, self);
 }
 
-void
-action_matchAndExecChain(Action *self, const char *logname, const char *line)
+/* read output of a command and log it line by line */
+static void
+actionExec_output(void *data, uint32_t events)
 {
-    int rc;
-    pthread_attr_t attr;
-    pthread_t thread;
-    struct actionExecArgs *args;
+    ActionExec *self = data;
+    ssize_t chunk;
+    char *lineStart, *nl, *end;
+    size_t len;
 
-    while (self)
+    (void)events; /* unused */
+
+    chunk = read(self->outfd, self->buf + self->buflen,
+	    OUTPUT_BUFSIZE - self->buflen);
+    if (chunk < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (chunk <= 0)
     {
-	/* try to match the line */
-	rc = pcre_exec(self->re, self->extra, line, (int)strlen(line), 0, 0,
-		self->ovec, (int)self->ovecsize);
-	if (rc > 0)
-	{
-	    Daemon_printf("[%s]: Action `%s' matched, executing `%s'.",
-		    logname, cfgAct_name(self->cfgAct),
-		    cfgAct_command(self->cfgAct));
+	/* end of output or error */
+	actionExec_closePipe(self);
+	return;
+    }
 
-	    /* line matches, the number of matched groups is in the return
-	     * code of pcre_exec() */
-	    args = createExecArgs(self, line, rc);
+    lineStart = self->buf;
+    end = self->buf + self->buflen + chunk;
+    nl = self->buf + self->buflen;
+    while ((nl = memchr(nl, '\n', (size_t)(end - nl))))
+    {
+	/* strip newline first */
+	len = (size_t)(nl - lineStart);
+	if (len && lineStart[len-1] == '\r') --len;
+	Daemon_printf("[%s] [%s:%d] %.*s", self->actname, self->cmdname,
+		self->pid, (int)len, lineStart);
+	lineStart = ++nl;
+    }
 
-	    pthread_mutex_lock(&numThreadsLock);
-	    if (numThreads == 0)
-	    {
-		/* if this is the first thread, lock threadsLock indicating
-		 * "running threads" */
-		sem_trywait(&threadsLock);
-	    }
+    self->buflen = (size_t)(end - lineStart);
+    if (self->buflen == OUTPUT_BUFSIZE)
+    {
+	/* line doesn't fit in the buffer, log it in pieces */
+	Daemon_printf("[%s] [%s:%d] %.*s", self->actname, self->cmdname,
+		self->pid, (int)self->buflen, self->buf);
+	self->buflen = 0;
+    }
+    else if (self->buflen && lineStart > self->buf)
+    {
+	/* keep incomplete line at the beginning of the buffer */
+	memmove(self->buf, lineStart, self->buflen);
+    }
 
-	    /* increase number of threads */
-	    ++numThreads;
+    /* got output, so restart waiting for more, a coprocess only writes
+     * output when it has something to say */
+    if (!self->action->coproc) actionExec_setTimer(self, waitOutput);
+}
 
-	    /* try creating the thread in detached state */
-	    if (pthread_attr_init(&attr) != 0
-		    || pthread_attr_setdetachstate(&attr,
-			PTHREAD_CREATE_DETACHED) != 0
-		    || pthread_create(&thread, &attr, &actionExec, args) != 0)
-	    {
-		Daemon_printf_level(LEVEL_WARNING,
-			"[%s]: Unable to create thread for action `%s', "
-			"giving up.", logname, cfgAct_name(self->cfgAct));
+/* handle exit of a command notified through its pidfd */
+static void
+actionExec_exited(void *data, uint32_t events)
+{
+    (void)events; /* unused */
+
+    actionExec_reap(data);
+}
+
+/* handle SIGCHLD for commands without a pidfd */
+static void
+childSignal(void *data, int signum)
+{
+    ActionExec *curr, *next;
+
+    (void)data; /* unused */
+    (void)signum; /* unused */
+
+    for (curr = firstExec; curr; curr = next)
+    {
+	next = curr->next;
+	if (curr->pidfd < 0 && !curr->spawnId && curr->pid > 0)
+	{
+	    actionExec_reap(curr);
+	}
+    }
+}
+
+/* get a pidfd for a child process, -1 if not supported by the kernel */
+static int
+openPidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid; /* unused */
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* add a command to the list of running commands */
+static void
+actionExec_add(ActionExec *self)
+{
+    self->next = firstExec;
+    firstExec = self;
+    ++totalStarted;
+
+    /* coprocesses don't count against the limits */
+    if (self->action->coproc)
+    {
+	++numCoprocs;
+	return;
+    }
+    ++numRunning;
+    ++self->action->running;
+}
+
+/* command was launched, read its output and watch for its exit */
+static void
+actionExec_running(ActionExec *self)
+{
+#ifdef DEBUG
+    struct timespec ts;
+#endif
+
+    /* read output without blocking in the EventLoop */
+    fcntl(self->outfd, F_SETFL, O_NONBLOCK);
+    EventLoop_addFd(self->outfd, EPOLLIN, &actionExec_output, self);
+    if (!self->action->coproc) actionExec_setTimer(self, waitOutput);
+
+#ifdef DEBUG
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    Daemon_printf_level(LEVEL_DEBUG,
+	    "[action.c] Started %s (%d) for action `%s', %ld us after the "
+	    "match.", self->cmdname, self->pid, self->actname,
+	    (long)(ts.tv_sec - self->matched.tv_sec) * 1000000L
+	    + (ts.tv_nsec - self->matched.tv_nsec) / 1000L);
+#endif
+
+    /* the spawner helper reports the exit itself */
+    if (self->spawnId) return;
+
+    /* get notified about exit of the child through a pidfd if possible,
+     * otherwise through SIGCHLD */
+    self->pidfd = openPidfd(self->pid);
+    if (self->pidfd >= 0)
+    {
+	fcntl(self->pidfd, F_SETFD, FD_CLOEXEC);
+	EventLoop_addFd(self->pidfd, EPOLLIN, &actionExec_exited, self);
+    }
+    else if (!sigchldHandled)
+    {
+	sigchldHandled = 1;
+	EventLoop_addSignal(SIGCHLD, &childSignal, NULL);
+
+	/* the child could have exited before SIGCHLD was handled */
+	actionExec_reap(self);
+    }
+}
+
+/* handle result of launching a command through the spawner helper */
+static void
+actionExec_started(void *data, pid_t pid, int outfd, int err)
+{
+    ActionExec *self = data;
+
+    if (err)
+    {
+	Daemon_printf_level(LEVEL_WARNING, "[%s] Cannot execute `%s': %s",
+		self->actname, self->cmd[0], strerror(err));
+	actionExec_remove(self);
+	return;
+    }
+
+    self->pid = pid;
+    self->outfd = outfd;
+    actionExec_running(self);
+}
+
+/* handle exit of a command reported by the spawner helper */
+static void
+actionExec_exitStatus(void *data, int status)
+{
+    ActionExec *self = data;
+
+    self->status = status;
+    self->exited = 1;
+    if (self->outfd < 0) actionExec_finish(self);
+}
+
+/* launch the command of an Action */
+static int
+actionExec_start(ActionExec *self)
+{
+    int rc;
+
+    /* prefer the spawner helper if available, it reports back later */
+    if (Spawner_helperRunning())
+    {
+	self->spawnId = Spawner_request(self->cmd, &actionExec_started,
+		&actionExec_exitStatus, self);
+	if (self->spawnId)
+	{
+	    actionExec_add(self);
+	    return 1;
+	}
+    }
+
+    rc = Spawner_launch(self->cmd, &(self->pid), NULL, &(self->outfd));
+    if (rc)
+    {
+	Daemon_printf_level(LEVEL_WARNING, "[%s] Cannot execute `%s': %s",
+		self->actname, self->cmd[0], strerror(rc));
+	return 0;
+    }
+
+    actionExec_add(self);
+    actionExec_running(self);
+    return 1;
+}
+
+/* check whether a command can be started without exceeding limits */
+static int
+canStart(const ActionExec *exec)
+{
+    return numRunning < maxRunning && (!exec->action->concurrency
+	    || exec->action->running < exec->action->concurrency);
+}
+
+/* check whether two commands have the same command line */
+static int
+sameCommand(const ActionExec *a, const ActionExec *b)
+{
+    char **aarg, **barg;
+
+    if (a->action != b->action) return 0;
+    for (aarg = a->cmd, barg = b->cmd; *aarg && *barg; ++aarg, ++barg)
+    {
+	if (strcmp(*aarg, *barg)) return 0;
+    }
+    return !*aarg && !*barg;
+}
+
+/* drop a command that could not be queued */
+static void
+dropExec(ActionExec *exec)
+{
+    if (!overflowing)
+    {
+	/* log only once per overflow, this happens in bursts */
+	Daemon_printf_level(LEVEL_WARNING,
+		"Action queue full with %d commands, dropping commands.",
+		numQueued);
+	overflowing = 1;
+    }
+    ++totalDropped;
+    freeExec(exec);
+}
+
+/* append a command to the queue, applying the overflow policy */
+static void
+enqueue(ActionExec *exec)
+{
+    ActionExec *curr;
+
+    if (policy == OP_COALESCE)
+    {
+	/* an identical queued command does the same job */
+	for (curr = firstQueued; curr; curr = curr->next)
+	{
+	    if (sameCommand(curr, exec))
+	    {
+		++totalCoalesced;
+		freeExec(exec);
+		return;
+	    }
+	}
+    }
+
+    if (numQueued >= queueSize)
+    {
+	if (policy != OP_OLDEST || !firstQueued)
+	{
+	    dropExec(exec);
+	    return;
+	}
+
+	/* make room by dropping the oldest queued command */
+	curr = firstQueued;
+	firstQueued = curr->next;
+	if (!firstQueued) lastQueued = NULL;
+	dropExec(curr);
+	--numQueued;
+    }
+
+#ifdef DEBUG
+    Daemon_printf_level(LEVEL_DEBUG,
+	    "[action.c] Queueing %s for action `%s'.",
+	    exec->cmdname, exec->actname);
+#endif
+
+    exec->next = NULL;
+    if (lastQueued) lastQueued->next = exec;
+    else firstQueued = exec;
+    lastQueued = exec;
+    ++numQueued;
+}
+
+static void
+runQueued(void)
+{
+    ActionExec **curr = &firstQueued;
+    ActionExec *exec;
+
+    lastQueued = NULL;
+    while (*curr && numRunning < maxRunning)
+    {
+	exec = *curr;
+	if (!canStart(exec))
+	{
+	    /* concurrency of this action exhausted, keep it queued */
+	    lastQueued = exec;
+	    curr = &(exec->next);
+	    continue;
+	}
+
+	/* remove from queue and start */
+	*curr = exec->next;
+	--numQueued;
+	if (!actionExec_start(exec))
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Unable to execute queued command for action `%s', "
+		    "giving up.", exec->actname);
+	    freeExec(exec);
+	}
+    }
+
+    /* find new end of the queue */
+    while (*curr)
+    {
+	lastQueued = *curr;
+	curr = &((*curr)->next);
+    }
+
+    if (overflowing && numQueued < queueSize)
+    {
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Action queue accepting commands again, %lu dropped so far.",
+		totalDropped);
+	overflowing = 0;
+    }
+}
+
+/* length of a string encoded as JSON string, writing it to out if given */
+static size_t
+jsonString(char *out, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i, outlen = 0;
+    unsigned char c;
+
+    if (out) out[outlen] = '"';
+    ++outlen;
+    for (i = 0; i < len; ++i)
+    {
+	c = (unsigned char)str[i];
+	if (c == '"' || c == '\\')
+	{
+	    if (out)
+	    {
+		out[outlen] = '\\';
+		out[outlen+1] = (char)c;
+	    }
+	    outlen += 2;
+	}
+	else if (c < 0x20)
+	{
+	    /* control characters as unicode escapes */
+	    if (out)
+	    {
+		memcpy(out + outlen, "\\u00", 4);
+		out[outlen+4] = hex[c >> 4];
+		out[outlen+5] = hex[c & 0xf];
+	    }
+	    outlen += 6;
+	}
+	else
+	{
+	    if (out) out[outlen] = (char)c;
+	    ++outlen;
+	}
+    }
+    if (out) out[outlen] = '"';
+    return ++outlen;
+}
 
-		/* clean up when thread can't be created */
-		freeExecArgs(args);
-		--numThreads;
-		if (numThreads == 0)
+/* get a field of a record from the last match, groups that didn't match are
+ * empty */
+static const char *
+recordField(const char *line, const PCRE2_SIZE *ovec, int numArgs, int i,
+	size_t *len)
+{
+    if (i >= numArgs || ovec[2*i] == PCRE2_UNSET)
+    {
+	*len = 0;
+	return "";
+    }
+
+    *len = ovec[2*i+1] - ovec[2*i];
+    return line + ovec[2*i];
+}
+
+/* create a framed record from the matched line, containing the whole match
+ * and all capturing groups */
+static Record *
+createRecord(Action *self, const char *line, const PCRE2_SIZE *ovec,
+	int numArgs)
+{
+    Record *rec;
+    const char *arg;
+    size_t argLength, len;
+    int i, numFields;
+    int json = self->framing == CAF_JSON;
+
+    /* same number of fields in every record, so a record is always complete
+     * after reading this number of NUL-terminated fields */
+    numFields = (int)self->numGroups;
+
+    /* calculate length first */
+    len = json ? 2 : 0;
+    for (i = 0; i < numFields; ++i)
+    {
+	arg = recordField(line, ovec, numArgs, i, &argLength);
+	if (json)
+	{
+	    len += jsonString(NULL, arg, argLength);
+	    if (i) ++len;
+	}
+	else
+	{
+	    len += argLength + 1;
+	}
+    }
+
+    rec = lladAlloc(sizeof(Record) + len);
+    rec->next = NULL;
+    rec->len = 0;
+
+    /* then fill the record: NUL-terminated fields or a JSON array of
+     * strings terminated by a newline */
+    if (json) rec->data[rec->len++] = '[';
+    for (i = 0; i < numFields; ++i)
+    {
+	arg = recordField(line, ovec, numArgs, i, &argLength);
+	if (json)
+	{
+	    if (i) rec->data[rec->len++] = ',';
+	    rec->len += jsonString(rec->data + rec->len, arg, argLength);
+	}
+	else
+	{
+	    memcpy(rec->data + rec->len, arg, argLength);
+	    rec->len += argLength;
+	    rec->data[rec->len++] = '\0';
+	}
+    }
+    if (json)
+    {
+	rec->data[rec->len++] = ']';
+	rec->data[rec->len++] = '\n';
+    }
+
+    return rec;
+}
+
+/* remove the first waiting record of a coprocess and destroy it */
+static void
+coproc_shift(Coproc *self)
+{
+    Record *rec = self->first;
+
+    self->first = rec->next;
+    if (!self->first) self->last = NULL;
+    --self->numRecords;
+    self->written = 0;
+    free(rec);
+}
+
+/* drop all waiting records of a coprocess */
+static void
+coproc_drop(Action *self)
+{
+    Coproc *cp = self->coproc;
+
+    if (!cp->numRecords) return;
+
+    Daemon_printf_level(LEVEL_NOTICE,
+	    "[%s] Dropping %d records waiting for coprocess %s.",
+	    self->name, cp->numRecords, self->command);
+    totalDropped += (unsigned long)cp->numRecords;
+    cp->dropped += (unsigned long)cp->numRecords;
+    while (cp->first) coproc_shift(cp);
+}
+
+/* write waiting records to a coprocess until none are left or its input
+ * pipe is full */
+static void
+coproc_write(Action *self)
+{
+    Coproc *cp = self->coproc;
+    ActionExec *exec = cp->exec;
+    Record *rec;
+    ssize_t rc;
+    int progress = 0;
+
+    if (!exec || exec->infd < 0) return;
+
+    while ((rec = cp->first))
+    {
+	rc = write(exec->infd, rec->data + cp->written,
+		rec->len - cp->written);
+	if (rc < 0)
+	{
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN)
+	    {
+		/* pipe is full, continue when it is writable again. If it
+		 * stays full, the coprocess is considered stuck. */
+		if (!exec->timer)
+		{
+		    EventLoop_modFd(exec->infd, EPOLLOUT);
+		    actionExec_setTimer(exec, waitOutput);
+		}
+		else if (progress)
 		{
-		    /* no threads running -> release threadsLock */
-		    sem_post(&threadsLock);
+		    actionExec_setTimer(exec, waitOutput);
 		}
+		return;
+	    }
+
+	    /* typically EPIPE, the coprocess doesn't read any more */
+	    Daemon_printf_level(LEVEL_NOTICE,
+		    "[%s] Cannot write to %s (%d): %s, closing pipes.",
+		    exec->actname, exec->cmdname, exec->pid, strerror(errno));
+	    actionExec_closePipe(exec);
+	    return;
+	}
+
+	progress = 1;
+	cp->written += (size_t)rc;
+	if (cp->written == rec->len)
+	{
+	    coproc_shift(cp);
+	    ++totalRecords;
+	}
+    }
+
+    /* everything written, stop waiting for the pipe */
+    if (exec->timer)
+    {
+	EventLoop_modFd(exec->infd, 0);
+	EventLoop_cancelTimer(exec->timer);
+	exec->timer = NULL;
+    }
+
+    if (cp->overflowing)
+    {
+	Daemon_printf_level(LEVEL_NOTICE,
+		"[%s] Coprocess %s accepting records again, "
+		"%lu dropped so far.", exec->actname, exec->cmdname,
+		cp->dropped);
+	cp->overflowing = 0;
+    }
+
+    /* when waiting for pending actions or removed from the config, the
+     * coprocess gets EOF after its last record */
+    if (shuttingDown || self->retired) actionExec_closeInput(exec);
+}
+
+/* handle events on the input pipe of a coprocess */
+static void
+coproc_writable(void *data, uint32_t events)
+{
+    ActionExec *exec = data;
+
+    if ((events & EPOLLERR) && !exec->action->coproc->first)
+    {
+	/* nothing to write, but the coprocess closed its input */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"[%s] %s (%d) closed its input, closing pipes.",
+		exec->actname, exec->cmdname, exec->pid);
+	actionExec_closePipe(exec);
+	return;
+    }
+
+    coproc_write(exec->action);
+}
+
+/* launch the command of a coprocess Action */
+static void
+coproc_start(Action *self)
+{
+    Coproc *cp = self->coproc;
+    ActionExec *exec;
+    int rc;
+
+    /* the command gets no arguments, matches are written to its input.
+     * It is launched directly, because the spawner helper only passes the
+     * output pipe, and coprocesses are started rarely anyways. */
+    exec = createExec(self, NULL, NULL, 0);
+    rc = Spawner_launch(exec->cmd, &(exec->pid), &(exec->infd),
+	    &(exec->outfd));
+    if (rc)
+    {
+	Daemon_printf_level(LEVEL_WARNING, "[%s] Cannot execute `%s': %s",
+		exec->actname, exec->cmd[0], strerror(rc));
+	freeExec(exec);
+	coproc_exited(self);
+	return;
+    }
+
+    Daemon_printf("[%s] Started coprocess %s (%d).",
+	    exec->actname, exec->cmdname, exec->pid);
+    cp->exec = exec;
+    cp->startedAt = EventLoop_now();
+
+    /* only watch for errors until the pipe is full */
+    fcntl(exec->infd, F_SETFL, O_NONBLOCK);
+    EventLoop_addFd(exec->infd, 0, &coproc_writable, exec);
+
+    actionExec_add(exec);
+    actionExec_running(exec);
+    coproc_write(self);
+}
+
+/* timer handler for restarting a coprocess */
+static void
+coproc_restart(void *data)
+{
+    Action *self = data;
+
+    self->coproc->restartTimer = NULL;
+    coproc_start(self);
+}
+
+static void
+coproc_exited(Action *self)
+{
+    Coproc *cp = self->coproc;
+
+    /* a record only partially written is written again completely */
+    cp->exec = NULL;
+    cp->written = 0;
+
+    /* not restarted when shutting down or removed from the config */
+    if (shuttingDown || self->retired)
+    {
+	coproc_drop(self);
+	return;
+    }
+
+    /* restart quickly after running for a while, otherwise back off */
+    if (cp->startedAt && EventLoop_now() - cp->startedAt >= COPROC_BACKOFF_MAX)
+    {
+	cp->backoff = COPROC_BACKOFF_MIN;
+    }
+
+    Daemon_printf_level(LEVEL_NOTICE,
+	    "[%s] Restarting coprocess %s in %lld ms.",
+	    self->name, self->command, cp->backoff);
+    cp->restartTimer = EventLoop_addTimer(cp->backoff,
+	    &coproc_restart, self);
+    cp->startedAt = 0;
+    cp->backoff *= 2;
+    if (cp->backoff > COPROC_BACKOFF_MAX) cp->backoff = COPROC_BACKOFF_MAX;
+}
+
+/* pass a match to a coprocess, applying the overflow policy if too many
+ * records are waiting */
+static void
+coproc_feed(Action *self, const char *line, const PCRE2_SIZE *ovec,
+	int numArgs)
+{
+    Coproc *cp = self->coproc;
+    Record *rec, *curr, **next;
+
+    rec = createRecord(self, line, ovec, numArgs);
+
+    if (policy == OP_COALESCE)
+    {
+	/* an identical waiting record does the same job, unless it's already
+	 * partially written */
+	for (curr = cp->first; curr; curr = curr->next)
+	{
+	    if (curr == cp->first && cp->written) continue;
+	    if (curr->len == rec->len
+		    && !memcmp(curr->data, rec->data, rec->len))
+	    {
+		++totalCoalesced;
+		free(rec);
+		return;
 	    }
+	}
+    }
+
+    /* an empty queue always takes a record, so even with a queue size of
+     * 0, the coprocess gets all records it can read right away */
+    if (cp->numRecords && cp->numRecords >= queueSize)
+    {
+	if (!cp->overflowing)
+	{
+	    /* log only once per overflow, this happens in bursts */
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "[%s] Coprocess %s not keeping up with %d records "
+		    "waiting, dropping records.", self->name,
+		    self->command, cp->numRecords);
+	    cp->overflowing = 1;
+	}
+	++totalDropped;
+	++cp->dropped;
+
+	/* a partially written record can't be dropped any more */
+	next = &(cp->first);
+	if (cp->written) next = &((*next)->next);
+	if (policy != OP_OLDEST || !*next)
+	{
+	    free(rec);
+	    return;
+	}
+
+	/* make room by dropping the oldest waiting record */
+	curr = *next;
+	*next = curr->next;
+	if (cp->last == curr) cp->last = cp->written ? cp->first : NULL;
+	--cp->numRecords;
+	free(curr);
+    }
+
+    if (cp->last) cp->last->next = rec;
+    else cp->first = rec;
+    cp->last = rec;
+    ++cp->numRecords;
+
+    if (cp->exec)
+    {
+	/* write right away unless already waiting for the pipe */
+	if (!cp->exec->timer) coproc_write(self);
+    }
+    else if (!cp->restartTimer)
+    {
+	/* not running yet */
+	coproc_start(self);
+    }
+}
+
+/* build the prefilter for a chain from the literals of its Actions and,
+ * if enabled, the combined DFA of their patterns. A chain can be shared by
+ * several Logfiles, so this may be called from several matcher threads for
+ * the same chain, only the first one builds it */
+static void
+buildFilter(Action *self)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    Prefilter *filter;
+    Action *curr;
+    int num = 0;
+
+    pthread_mutex_lock(&lock);
+    if (self->filter)
+    {
+	pthread_mutex_unlock(&lock);
+	return;
+    }
+
+    if (useDfa)
+    {
+	self->dfa = LazyDfa_new();
+	for (curr = self; curr; curr = curr->next)
+	{
+	    curr->dfaId = lazyDfa_add(self->dfa, curr->pattern);
+	    if (curr->dfaId < 0)
+	    {
+		Daemon_printf_level(LEVEL_DEBUG,
+			"[action.c] Pattern of action `%s' not supported by "
+			"the DFA", curr->name);
+	    }
+	    ++num;
+	}
+	lazyDfa_compile(self->dfa);
+	Daemon_printf_level(LEVEL_DEBUG,
+		"[action.c] DFA combines %d of %d patterns",
+		lazyDfa_count(self->dfa), num);
+    }
+
+    /* patterns handled by the DFA don't need their literals */
+    filter = Prefilter_new();
+    for (curr = self; curr; curr = curr->next)
+    {
+	curr->literalId = curr->literal && curr->dfaId < 0
+	    ? prefilter_add(filter, curr->literal, curr->literalLen)
+	    : -1;
+    }
+    prefilter_compile(filter);
+
+    /* publish it when complete, it is checked without the lock */
+    __atomic_store_n(&(self->filter), filter, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+}
+
+/* make sure a flag array of a matcher has room for num flags */
+static unsigned char *
+growFlags(unsigned char **flags, size_t *size, int num)
+{
+    if (*size < (size_t)num + 1)
+    {
+	*size = (size_t)num + 1;
+	free(*flags);
+	*flags = lladAlloc(*size);
+    }
+    return *flags;
+}
+
+/* create match data large enough for every Action */
+static pcre2_match_data *
+createMatchData(void)
+{
+    pcre2_match_data *data = pcre2_match_data_create(maxGroups, NULL);
+    if (!data)
+    {
+	/* same as lladAlloc(), fail quickly */
+	Daemon_print_level(LEVEL_CRIT, "Could not allocate match data");
+	exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+ActionMatcher *
+ActionMatcher_new(void)
+{
+    ActionMatcher *self = lladAlloc(sizeof(ActionMatcher));
+
+    self->data = createMatchData();
+    self->found = NULL;
+    self->dfaMatched = NULL;
+    self->foundSize = 0;
+    self->dfaMatchedSize = 0;
+    self->context = pcre2_match_context_create(NULL);
+    if (!self->context)
+    {
+	Daemon_print_level(LEVEL_CRIT, "Could not allocate match context");
+	exit(EXIT_FAILURE);
+    }
+
+    /* without a JIT stack of its own, a small one on the machine stack is
+     * used */
+    self->jitStack = pcre2_jit_stack_create(JIT_STACK_START, JIT_STACK_MAX,
+	    NULL);
+    if (self->jitStack)
+    {
+	pcre2_jit_stack_assign(self->context, NULL, self->jitStack);
+    }
+
+    return self;
+}
+
+void
+actionMatcher_free(ActionMatcher *self)
+{
+    if (!self) return;
+    pcre2_match_context_free(self->context);
+    pcre2_jit_stack_free(self->jitStack);
+    pcre2_match_data_free(self->data);
+    free(self->dfaMatched);
+    free(self->found);
+    free(self);
+}
+
+int
+action_match(const Action *self, ActionMatcher *matcher, const char *line,
+	size_t len)
+{
+    /* Actions may have been created after the matcher */
+    if (pcre2_get_ovector_count(matcher->data) < self->numGroups)
+    {
+	pcre2_match_data_free(matcher->data);
+	matcher->data = createMatchData();
+    }
+
+    return pcre2_match(self->re, (PCRE2_SPTR)line, len, 0, 0,
+	    matcher->data, matcher->context);
+}
+
+ActionMatches *
+ActionMatches_new(void)
+{
+    ActionMatches *self = lladAlloc(sizeof(ActionMatches));
+    memset(self, 0, sizeof(ActionMatches));
+    return self;
+}
+
+/* forget all recorded matches */
+static void
+actionMatches_clear(ActionMatches *self)
+{
+    PendingMatch *curr, *next;
+
+    for (curr = self->first; curr; curr = next)
+    {
+	next = curr->next;
+	free(curr);
+    }
+    self->first = NULL;
+    self->last = NULL;
+}
+
+void
+actionMatches_free(ActionMatches *self)
+{
+    if (!self) return;
+    actionMatches_clear(self);
+    free(self);
+}
+
+void
+action_matchChain(Action *self, ActionMatcher *matcher,
+	ActionMatches *matches, const char *line, size_t len)
+{
+    int rc;
+    int tried = 0;
+    const unsigned char *found = NULL;
+    const unsigned char *dfaMatched = NULL;
+    PendingMatch *pm;
+
+    if (!self) return;
 
-	    pthread_mutex_unlock(&numThreadsLock);
+    /* search all literals of the chain in one pass */
+    if (!__atomic_load_n(&(self->filter), __ATOMIC_ACQUIRE))
+    {
+	buildFilter(self);
+    }
+    if (prefilter_count(self->filter))
+    {
+	found = growFlags(&(matcher->found), &(matcher->foundSize),
+		prefilter_count(self->filter));
+	prefilter_scan(self->filter, line, len, matcher->found);
+    }
+    if (self->dfa && lazyDfa_count(self->dfa))
+    {
+	/* and all supported patterns in another one */
+	dfaMatched = growFlags(&(matcher->dfaMatched),
+		&(matcher->dfaMatchedSize), lazyDfa_count(self->dfa));
+	lazyDfa_scan(self->dfa, line, len, matcher->dfaMatched);
+    }
+    ++matches->lines;
+
+    while (self)
+    {
+	if ((found && self->literalId >= 0 && !found[self->literalId])
+		|| (dfaMatched && self->dfaId >= 0
+		    && !dfaMatched[self->dfaId]))
+	{
+	    /* required literal missing or DFA didn't match, can't match */
+	    ++matches->skipped;
+	    self = self->next;
+	    continue;
+	}
+
+	/* try to match the line */
+	++tried;
+	rc = action_match(self, matcher, line, len);
+	if (rc > 0)
+	{
+	    /* record the match with the positions of its groups, the number
+	     * of matched groups is in the return code of pcre2_match() */
+	    pm = lladAlloc(sizeof(PendingMatch)
+		    + 2 * (size_t)rc * sizeof(PCRE2_SIZE));
+	    pm->next = NULL;
+	    pm->action = self;
+	    pm->line = line;
+	    pm->numArgs = rc;
+	    memcpy(pm->ovec, pcre2_get_ovector_pointer(matcher->data),
+		    2 * (size_t)rc * sizeof(PCRE2_SIZE));
+	    if (matches->last) matches->last->next = pm;
+	    else matches->first = pm;
+	    matches->last = pm;
 	}
 
 	/* iterate through the whole chain */
 	self = self->next;
     }
+
+    if (!tried) ++matches->rejected;
+}
+
+void
+actionMatches_exec(ActionMatches *self, const char *logname)
+{
+    PendingMatch *pm;
+    Action *act;
+    ActionExec *exec;
+
+    for (pm = self->first; pm; pm = pm->next)
+    {
+	act = pm->action;
+	if (act->coproc)
+	{
+	    Daemon_printf("[%s]: Action `%s' matched, feeding `%s'.",
+		    logname, act->name, act->command);
+
+	    /* pass the match to the running coprocess instead */
+	    coproc_feed(act, pm->line, pm->ovec, pm->numArgs);
+	    continue;
+	}
+
+	Daemon_printf("[%s]: Action `%s' matched, executing `%s'.",
+		logname, act->name, act->command);
+
+	exec = createExec(act, pm->line, pm->ovec, pm->numArgs);
+
+	if (canStart(exec))
+	{
+	    if (!actionExec_start(exec))
+	    {
+		Daemon_printf_level(LEVEL_WARNING,
+			"[%s]: Unable to execute command for action `%s', "
+			"giving up.", logname, act->name);
+		freeExec(exec);
+	    }
+	}
+	else
+	{
+	    /* limits reached, run it later */
+	    enqueue(exec);
+	}
+    }
+    actionMatches_clear(self);
+
+    /* statistics are only updated here, in the main thread */
+    totalLines += self->lines;
+    totalRejected += self->rejected;
+    totalSkipped += self->skipped;
+    self->lines = 0;
+    self->rejected = 0;
+    self->skipped = 0;
+}
+
+void
+action_matchAndExecChain(Action *self, const char *logname,
+	const char *line, size_t len)
+{
+    if (!self) return;
+    if (!mainMatcher)
+    {
+	mainMatcher = ActionMatcher_new();
+	mainMatches = ActionMatches_new();
+    }
+
+    action_matchChain(self, mainMatcher, mainMatches, line, len);
+    actionMatches_exec(mainMatches, logname);
+}
+
+/* remove a coprocess Action from the list of coprocesses and stop
+ * restarting it */
+static void
+coproc_unlink(Action *self)
+{
+    Coproc *cp = self->coproc;
+    Action **curr = &firstCoproc;
+
+    while (*curr && *curr != self) curr = &((*curr)->coproc->nextCoproc);
+    if (*curr) *curr = cp->nextCoproc;
+    cp->nextCoproc = NULL;
+
+    if (cp->restartTimer) EventLoop_cancelTimer(cp->restartTimer);
+    cp->restartTimer = NULL;
+}
+
+/* destroy the state of a coprocess Action, a still running command is
+ * left alone */
+static void
+coproc_free(Action *self)
+{
+    Coproc *cp = self->coproc;
+
+    coproc_unlink(self);
+    while (cp->first) coproc_shift(cp);
+    free(cp);
+}
+
+static void
+destroy(Action *self)
+{
+    if (self->coproc) coproc_free(self);
+    free(self->command);
+    free(self->pattern);
+    free(self->name);
+    free(self);
+}
+
+/* keep an Action with queued or running commands until the last one is
+ * done */
+static void
+retire(Action *self)
+{
+    Coproc *cp = self->coproc;
+
+    self->retired = 1;
+    if (!cp) return;
+
+    /* a coprocess still gets the records waiting, then EOF */
+    coproc_unlink(self);
+    if (cp->exec && !cp->first) actionExec_closeInput(cp->exec);
 }
 
 void
@@ -526,65 +2049,151 @@ action_free(Action *self)
     {
 	last = curr;
 	curr = last->next;
-	pcre_free_study(last->extra);
-	pcre_free(last->re);
-	free(last);
+	last->next = NULL;
+
+	/* the pattern is never matched again */
+	dropFilter(last);
+	free(last->literal);
+	last->literal = NULL;
+	pcre2_code_free(last->re);
+	last->re = NULL;
+
+	if (last->execs) retire(last);
+	else destroy(last);
     }
 }
 
-int
-Action_waitForPending(void)
+/* timer handler for giving up on pending actions */
+static void
+giveUp(void *data)
 {
-    struct timespec ts;
+    (void)data; /* unused */
+
+    exitTimer = NULL;
+    Daemon_print_level(LEVEL_ERR, "Still pending actions, giving up.");
+
+    /* if commands are STILL running, this is an error condition */
+    waitResult = 0;
+    EventLoop_stop();
+}
+
+/* timer handler for closing pipes of pending actions */
+static void
+closePipes(void *data)
+{
+    ActionExec *curr, *next;
+    Action *act;
+
+    (void)data; /* unused */
 
-    if (sem_trywait(&threadsLock) < 0)
+    exitTimer = NULL;
+    Daemon_printf_level(LEVEL_NOTICE,
+	    "Pending actions after %d seconds, closing pipes.", exitWait);
+
+    /* queued commands are not started any more */
+    if (numQueued)
     {
-	/* threads are running, calculate absolute timeout */
-	if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Dropping %d queued commands.", numQueued);
+	while (firstQueued)
 	{
-	    Daemon_perror("clock_gettime()");
-	    return 0;
+	    curr = firstQueued;
+	    firstQueued = curr->next;
+	    freeExec(curr);
+	    ++totalDropped;
 	}
-	ts.tv_sec += exitWait;
+	lastQueued = NULL;
+	numQueued = 0;
+	if (!firstExec) EventLoop_stop();
+    }
 
-	Daemon_print("Waiting for pending actions to finish ...");
-	if (sem_timedwait(&threadsLock, &ts) < 0)
-	{
-	    Daemon_printf_level(LEVEL_NOTICE,
-		    "Pending actions after %d seconds, closing pipes.",
-		    exitWait);
+    /* and records not yet written to coprocesses */
+    for (act = firstCoproc; act; act = act->coproc->nextCoproc)
+    {
+	coproc_drop(act);
+    }
 
-	    /* threads are running after timeout, signal them to close their
-	     * pipes */
-	    sem_post(&forceExit);
+    /* and wait long enough for all to be terminated if necessary */
+    exitTimer = EventLoop_addTimer((termWait + pipeWait + 2) * 1000LL,
+	    &giveUp, NULL);
 
-	    /* and calculate absolute timeout until all should have finished */
-	    if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
-	    {
-		Daemon_perror("clock_gettime()");
-		return 0;
-	    }
-	    ts.tv_sec += termWait + pipeWait + 2;
+    for (curr = firstExec; curr; curr = next)
+    {
+	next = curr->next;
+	if (curr->outfd >= 0) actionExec_closePipe(curr);
+    }
+}
 
-	    if (sem_timedwait(&threadsLock, &ts) < 0)
-	    {
-		Daemon_print_level(LEVEL_ERR,
-			"Still pending actions, giving up.");
+int
+Action_waitForPending(void)
+{
+    Action *act;
+    Coproc *cp;
 
-		/* if threads are STILL running, this is an error condition */
-		return 0;
-	    }
+    shuttingDown = 1;
+
+    /* coprocesses are not restarted any more, running ones get EOF on their
+     * input after their last record */
+    for (act = firstCoproc; act; act = act->coproc->nextCoproc)
+    {
+	cp = act->coproc;
+	if (cp->restartTimer)
+	{
+	    EventLoop_cancelTimer(cp->restartTimer);
+	    cp->restartTimer = NULL;
 	}
-	Daemon_print("All actions finished.");
+	if (!cp->exec) coproc_drop(act);
+	else if (!cp->first) actionExec_closeInput(cp->exec);
     }
 
-    /* all fine, return TRUE */
-    return 1;
+    /* all fine if no commands are running or queued */
+    if (!firstExec && !firstQueued)
+    {
+	shuttingDown = 0;
+	return 1;
+    }
+
+    Daemon_print("Waiting for pending actions to finish ...");
+    waitResult = 1;
+    exitTimer = EventLoop_addTimer(exitWait * 1000LL, &closePipes, NULL);
+
+    /* runs until the last command finished or waiting timed out */
+    if (!EventLoop_run()) waitResult = 0;
+
+    if (exitTimer) EventLoop_cancelTimer(exitTimer);
+    exitTimer = NULL;
+    shuttingDown = 0;
+
+    if (waitResult) Daemon_print("All actions finished.");
+    return waitResult;
+}
+
+void
+Action_logStats(void)
+{
+    Daemon_printf("Actions: %d running, %d queued, %lu started, "
+	    "%lu dropped, %lu coalesced.", numRunning, numQueued,
+	    totalStarted, totalDropped, totalCoalesced);
+    if (firstCoproc)
+    {
+	Daemon_printf("Coprocesses: %d running, %lu records written.",
+		numCoprocs, totalRecords);
+    }
+    Daemon_printf("Prefilter: %lu of %lu lines rejected (%.1f%%), "
+	    "%lu pattern matches skipped.", totalRejected, totalLines,
+	    totalLines ? 100.0 * (double)totalRejected / (double)totalLines
+	    : 0.0, totalSkipped);
+    if (useDfa) LazyDfa_logStats();
 }
 
 void
 Action_atexit(void)
 {
     free(cmdpath);
+    free(overflow);
+    actionMatcher_free(mainMatcher);
+    actionMatches_free(mainMatches);
+    mainMatcher = NULL;
+    mainMatches = NULL;
 }
 
@@ -7,6 +7,7 @@
 
 #include "config.h"
 
+#include <stddef.h>
 #include <popt.h>
 
 extern const struct poptOption action_opts[];
@@ -20,15 +21,36 @@ struct action;
 /** Class representing an action to be executed.
  * This class holds information about actions to be executed (name, pattern and
  * command) and code to actually check matches and execute the command.
+ * Before matching, a line is searched once for literal strings required by
+ * the patterns of a chain, and patterns whose literal doesn't occur aren't
+ * tried at all.
+ * Optionally, all patterns of a chain are combined into a lazily built DFA
+ * (see LazyDfa), so a single pass over the line tells which patterns can
+ * match, and PCRE only runs for those to extract the groups.
  * 
- * Internally, POSIX threads are used for executing Actions. For each command
- * to be executed, a thread is launched that opens a pipe, captures the output
- * of the command (for logging) and tries to terminate the command if it seems
- * stuck (by default: if it does not produce any output for 2 minutes).
+ * Commands are executed in child processes controlled from the EventLoop. For
+ * each command, a pipe is opened to capture the output of the command (for
+ * logging) and the command is terminated if it seems stuck (by default: if it
+ * does not produce any output for 2 minutes). The exit of the child process
+ * is noticed through a pidfd, or through SIGCHLD on kernels without pidfds.
+ *
+ * The number of commands running at the same time is limited globally and
+ * optionally per Action (through the "concurrency" property in the config
+ * file). Commands exceeding these limits are queued. The queue is bounded as
+ * well; when it is full, a configurable policy decides which commands are
+ * dropped.
  *
  * After the pipe is closed, commands are given 2 seconds before sending them
  * a SIGTERM and another 10 seconds before forcing them to stop using SIGKILL.
  *
+ * Actions in coprocess mode (through the "mode" property in the config file)
+ * start their command once and keep it running. Each match is written to its
+ * stdin as a record, either NUL-terminated fields or a line holding a JSON
+ * array. Records waiting for a full pipe are bounded like the queue. A
+ * coprocess not accepting input for as long as a command may run without
+ * output is stopped like a stuck command, and a coprocess that exited is
+ * restarted with a growing delay.
+ *
  * All timeout values are configurable on the command line through libpopt
  * options.
  *
@@ -36,15 +58,77 @@ struct action;
  */
 typedef struct action Action;
 
+struct actionMatcher;
+
+/** Class holding the per-thread state for matching lines.
+ * The compiled patterns of Actions are only read while matching. Everything
+ * written during a match (the positions of the matched groups and the stack
+ * used by JIT compiled patterns) lives in an ActionMatcher, so several
+ * threads can match lines at the same time without locking, each using its
+ * own ActionMatcher.
+ * @class ActionMatcher "action.h"
+ */
+typedef struct actionMatcher ActionMatcher;
+
+struct actionMatches;
+
+/** Class collecting matches of lines for executing their commands later.
+ * Matching lines and executing the commands of the matching Actions are
+ * separate steps, so matching can be done in other threads. The matches are
+ * kept in order and refer to the matched lines, which must stay unchanged
+ * until the matches are executed.
+ * @class ActionMatches "action.h"
+ */
+typedef struct actionMatches ActionMatches;
+
 /** Append an Action to a given chain of actions.
+ * Actions created with Action_new() are set up for executing commands here,
+ * so this must be called from the main thread.
  * @memberof Action
  * @param self chain of Actions that act should be appended to, if self is NULL
- *             nothing is done.
- * @param act the Action to append to self.
+ *             act just starts a new chain.
+ * @param act the Action to append to self, may be a chain itself.
  * @returns the Action given in act.
  */
 Action *action_append(Action *self, Action *act);
 
+/** Create a new Action from config file entry.
+ * This works as a constructor. It compiles the pattern and copies everything
+ * needed from the config file entry, so the Action stays valid when the
+ * configuration is reloaded. Nothing else is touched, so this may be called
+ * from another thread, the Action is only used after appending it to a chain
+ * with action_append() in the main thread.
+ * @memberof Action
+ * @static
+ * @param cfgAct config file entry to create the new Action from.
+ * @returns the newly created Action, NULL if the pattern is invalid
+ */
+Action *Action_new(const CfgAct *cfgAct);
+
+/** Create new Actions for several config file entries at once.
+ * The patterns are compiled in a pool of threads, one per CPU, like
+ * Action_new() does for a single entry. The time each pattern took is
+ * logged, and patterns slow to compile are reported as a warning.
+ * @memberof Action
+ * @static
+ * @param cfgActs config file entries to create the Actions from, entries
+ *                that are NULL are skipped.
+ * @param actions receives the Action for each entry, NULL for skipped
+ *                entries and invalid patterns.
+ * @param num the number of entries
+ */
+void Action_newAll(const CfgAct *const *cfgActs, Action **actions,
+	size_t num);
+
+/** Keep the compiled patterns of Actions for the next start.
+ * They are written to the rule cache file with RuleCache_write().
+ * @memberof Action
+ * @static
+ * @param actions the Actions, entries that are NULL are skipped.
+ * @param num the number of Actions
+ */
+void Action_writeCache(Action *const *actions, size_t num);
+
 /** Create a new Action from config file entry and append it to chain.
  * This works as a constructor.
  * @memberof Action
@@ -55,6 +139,104 @@ Action *action_append(Action *self, Action *act);
  */
 Action *action_appendNew(Action *self, const CfgAct *cfgAct);
 
+/** Check whether an Action was created from an equal config file entry.
+ * @memberof Action
+ * @param self the Action
+ * @param cfgAct config file entry to compare with
+ * @returns 1 if name, pattern, command and all properties are the same,
+ *          0 otherwise
+ */
+int action_isConfigured(const Action *self, const CfgAct *cfgAct);
+
+/** Check whether a chain has an Action created from an equal config file
+ * entry.
+ * @memberof Action
+ * @param self chain of Actions, may be NULL
+ * @param cfgAct config file entry to compare with
+ * @returns 1 if action_isConfigured() is true for an Action of the chain,
+ *          0 otherwise
+ */
+int action_contains(const Action *self, const CfgAct *cfgAct);
+
+/** Remove an Action created from an equal config file entry from a chain.
+ * This is for keeping compiled Actions when the configuration is reloaded.
+ * No lines may be matched against the chain while doing this.
+ * @memberof Action
+ * @param chain pointer to the first Action of the chain, updated if the
+ *              first Action is removed
+ * @param cfgAct config file entry to compare with
+ * @returns the first Action for which action_isConfigured() is true, removed
+ *          from the chain, or NULL if there is none
+ */
+Action *action_take(Action **chain, const CfgAct *cfgAct);
+
+
+/** Create a new ActionMatcher.
+ * This works as a constructor.
+ * @memberof ActionMatcher
+ * @static
+ * @returns the new ActionMatcher
+ */
+ActionMatcher *ActionMatcher_new(void);
+
+/** Destructor for ActionMatcher.
+ * @memberof ActionMatcher
+ * @param self the ActionMatcher, may be NULL
+ */
+void actionMatcher_free(ActionMatcher *self);
+
+/** Match a line against the pattern of a single Action.
+ * This only reads the Action, so it is safe to call from several threads at
+ * the same time, as long as each thread uses a different matcher.
+ * @memberof Action
+ * @param self the Action
+ * @param matcher the ActionMatcher receiving the positions of the groups
+ * @param line the log line, doesn't need to be NUL-terminated
+ * @param len the length of the log line
+ * @returns the number of matched groups plus one for the whole match on
+ *          success, 0 or a negative PCRE2 error code otherwise
+ */
+int action_match(const Action *self, ActionMatcher *matcher,
+	const char *line, size_t len);
+
+/** Create an empty ActionMatches.
+ * This works as a constructor.
+ * @memberof ActionMatches
+ * @static
+ * @returns the new ActionMatches
+ */
+ActionMatches *ActionMatches_new(void);
+
+/** Destructor for ActionMatches.
+ * Matches not executed yet are dropped.
+ * @memberof ActionMatches
+ * @param self the ActionMatches, may be NULL
+ */
+void actionMatches_free(ActionMatches *self);
+
+/** Match a line against a chain of Actions, recording the matches.
+ * Nothing is executed, so this is safe to call from other threads than the
+ * main thread, as long as no chain is matched by more than one thread at a
+ * time and each thread uses its own ActionMatcher.
+ * @memberof Action
+ * @param self chain of Actions to check for matches
+ * @param matcher the ActionMatcher of the calling thread
+ * @param matches receives the matches, appended to earlier ones
+ * @param line the log line, doesn't need to be NUL-terminated, must stay
+ *             unchanged until the matches are executed
+ * @param len the length of the log line
+ */
+void action_matchChain(Action *self, ActionMatcher *matcher,
+	ActionMatches *matches, const char *line, size_t len);
+
+/** Execute the commands of recorded matches in the order they were found.
+ * This must be called from the main thread. Afterwards, the ActionMatches is
+ * empty again.
+ * @memberof ActionMatches
+ * @param self the ActionMatches
+ * @param logname the name of the Logfile the lines came from
+ */
+void actionMatches_exec(ActionMatches *self, const char *logname);
 
 /** Execute Actions matching a given log line.
  * This method walks through the chain of Actions, checking for each whether
@@ -62,13 +244,17 @@ Action *action_appendNew(Action *self, const CfgAct *cfgAct);
  * @memberof Action
  * @param self chain of Actions to check for matches
  * @param logname the name of the Logfile the line came from
- * @param line the log line that should be checked for matches
+ * @param line the log line that should be checked for matches, doesn't need
+ *             to be NUL-terminated
+ * @param len the length of the log line
  */
 void action_matchAndExecChain(Action *self,
-	const char *logname, const char *line);
+	const char *logname, const char *line, size_t len);
 
 /** Destructor for Actions.
- * This optionally destructs a whole chain of Actions.
+ * This optionally destructs a whole chain of Actions. An Action with queued
+ * or running commands is kept until the last of them is done, a coprocess
+ * gets EOF after the records still waiting for it.
  * @memberof Action
  * @param self chain of Actions to destroy.
  */
@@ -79,13 +265,19 @@ void action_free(Action *self);
  * and if so, waits for their completion. After a given timeout (configurable
  * through a libpopt option, default is 20 seconds), the Actions will close
  * their pipes and waiting continues long enough to give them time to be killed
- * by the controlling thread if necessary.
+ * if necessary. The EventLoop is run while waiting.
  * @memberof Action
  * @static
  * @returns 1 on success, 0 on error
  */
 int Action_waitForPending(void);
 
+/** Log statistics about running, queued and dropped commands.
+ * @memberof Action
+ * @static
+ */
+void Action_logStats(void);
+
 /** Call this at exit for final cleanup.
  * @memberof Action
  * @static
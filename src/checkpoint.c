@@ -0,0 +1,314 @@
+#define _POSIX_C_SOURCE 200809L
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "hash.h"
+#include "util.h"
+
+/* default state file location */
+#define STATEFILE_DEFAULT RUNSTATEDIR "/%s.state"
+
+/* first line of the state file, identifying the format version */
+#define STATEFILE_MAGIC "llad-state 2\n"
+
+/* first line of a state file without the skipping flag */
+#define STATEFILE_MAGIC_V1 "llad-state 1\n"
+
+static char *statefile = NULL;	/* state file location from popt */
+static int interval = 5;	/* minimum time between writes (sec) */
+
+const struct poptOption checkpoint_opts[] = {
+    {"statefile", '\0', POPT_ARG_STRING, &statefile, 0,
+	"Record read positions of logfiles in the file specified in <path>, "
+	"defaults to " RUNSTATEDIR "/<name>.state -- pass empty string to "
+	"disable resuming after a restart.", "path"},
+    {"checkpoint-interval", '\0', POPT_ARG_INT, &interval, 0,
+	"Write read positions to the state file at most every <sec> seconds, "
+	"defaults to 5.", "sec"},
+    POPT_TABLEEND
+};
+
+struct checkpoint;
+typedef struct checkpoint Checkpoint;
+
+struct checkpoint
+{
+    char *name;		/* canonical name of the file */
+    Checkpoint *next;	/* next checkpoint in the list */
+    Checkpoint *prev;	/* previous checkpoint in the list */
+    uint64_t hash;	/* hash of the bytes before offset */
+    off_t offset;	/* offset after the last line read */
+    dev_t dev;		/* device of the file */
+    ino_t ino;		/* inode of the file */
+    int skipping;	/* flag, offset is within a too long line */
+    int used;		/* flag, checkpoint still belongs to a Logfile */
+};
+
+static const char *stateFile = NULL;	/* real state file location */
+static char sfnbuf[PATH_MAX];		/* buffer for default location */
+static Checkpoint *first = NULL;	/* first checkpoint in the list */
+static HashTable *byName = NULL;	/* checkpoints by file name */
+static int dirty = 0;			/* flag, any checkpoint changed */
+
+static Checkpoint *
+find(const char *name)
+{
+    if (!byName) return NULL;
+    return hashTable_get(byName, name, strlen(name));
+}
+
+/* prepend a new checkpoint to the list and index it by name. A later entry
+ * for the same name replaces an earlier one */
+static void
+insert(Checkpoint *cp)
+{
+    if (!byName) byName = HashTable_new();
+    hashTable_put(byName, cp->name, strlen(cp->name), cp);
+    cp->prev = NULL;
+    cp->next = first;
+    if (first) first->prev = cp;
+    first = cp;
+}
+
+void
+Checkpoint_init(void)
+{
+    FILE *sf;
+    char line[PATH_MAX + 128];
+    unsigned long long dev, ino;
+    long long offset;
+    unsigned long long hash;
+    int skipping, namepos, v1;
+    size_t len;
+    Checkpoint *cp;
+
+    if (first) Checkpoint_done();
+
+    /* prefer option over default location, empty string disables */
+    if (!statefile)
+    {
+	snprintf(sfnbuf, PATH_MAX, STATEFILE_DEFAULT, Daemon_name());
+	stateFile = sfnbuf;
+    }
+    else if (strlen(statefile) > 0)
+    {
+	stateFile = statefile;
+    }
+    else
+    {
+	stateFile = NULL;
+	return;
+    }
+
+    if (!(sf = fopen(stateFile, "r")))
+    {
+	/* no state file is fine, e.g. on first start */
+	if (errno != ENOENT)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Could not read `%s': %s", stateFile, strerror(errno));
+	}
+	return;
+    }
+
+    if (!fgets(line, (int)sizeof(line), sf)
+	    || (strcmp(line, STATEFILE_MAGIC)
+		&& strcmp(line, STATEFILE_MAGIC_V1)))
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Ignoring `%s' with unknown format.", stateFile);
+	fclose(sf);
+	return;
+    }
+    v1 = !strcmp(line, STATEFILE_MAGIC_V1);
+
+    while (fgets(line, (int)sizeof(line), sf))
+    {
+	len = strlen(line);
+	if (len && line[len-1] == '\n') line[--len] = '\0';
+
+	/* the skipping flag came with format version 2 */
+	namepos = 0;
+	skipping = 0;
+	if ((v1 ? sscanf(line, "%llu %llu %lld %llx %n",
+			&dev, &ino, &offset, &hash, &namepos) < 4
+		    : sscanf(line, "%llu %llu %lld %llx %d %n",
+			&dev, &ino, &offset, &hash, &skipping, &namepos) < 5)
+		|| !namepos || !line[namepos])
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Ignoring invalid entry in `%s'.", stateFile);
+	    continue;
+	}
+
+	cp = lladAlloc(sizeof(Checkpoint));
+	cp->name = lladCloneString(line + namepos);
+	cp->dev = (dev_t)dev;
+	cp->ino = (ino_t)ino;
+	cp->offset = (off_t)offset;
+	cp->hash = (uint64_t)hash;
+	cp->skipping = skipping ? 1 : 0;
+	cp->used = 0;
+	insert(cp);
+    }
+
+    fclose(sf);
+}
+
+int
+Checkpoint_get(const char *name, dev_t *dev, ino_t *ino, off_t *offset,
+	uint64_t *hash, int *skipping)
+{
+    Checkpoint *cp;
+
+    if (!stateFile || !(cp = find(name))) return 0;
+
+    /* mark as still needed, unused entries are dropped on next write */
+    cp->used = 1;
+
+    *dev = cp->dev;
+    *ino = cp->ino;
+    *offset = cp->offset;
+    *hash = cp->hash;
+    *skipping = cp->skipping;
+    return 1;
+}
+
+void
+Checkpoint_set(const char *name, dev_t dev, ino_t ino, off_t offset,
+	uint64_t hash, int skipping)
+{
+    Checkpoint *cp;
+
+    /* names containing a newline can't be stored */
+    if (!stateFile || strchr(name, '\n')) return;
+
+    if (!(cp = find(name)))
+    {
+	cp = lladAlloc(sizeof(Checkpoint));
+	cp->name = lladCloneString(name);
+	insert(cp);
+    }
+    else if (cp->dev == dev && cp->ino == ino && cp->offset == offset
+	    && cp->hash == hash && cp->skipping == skipping)
+    {
+	cp->used = 1;
+	return;
+    }
+
+    cp->dev = dev;
+    cp->ino = ino;
+    cp->offset = offset;
+    cp->hash = hash;
+    cp->skipping = skipping;
+    cp->used = 1;
+    dirty = 1;
+}
+
+void
+Checkpoint_remove(const char *name)
+{
+    Checkpoint *cp;
+
+    if (!stateFile || !(cp = find(name))) return;
+
+    hashTable_remove(byName, name, strlen(name));
+    if (cp->prev) cp->prev->next = cp->next;
+    else first = cp->next;
+    if (cp->next) cp->next->prev = cp->prev;
+    if (cp->used) dirty = 1;
+    free(cp->name);
+    free(cp);
+}
+
+int
+Checkpoint_interval(void)
+{
+    if (!stateFile) return -1;
+    return interval > 0 ? interval : 0;
+}
+
+void
+Checkpoint_write(void)
+{
+    FILE *sf;
+    Checkpoint *cp;
+    char tmpName[PATH_MAX];
+
+    if (!stateFile || !dirty) return;
+
+    /* write to temporary file first, so the old state stays valid until the
+     * new one is complete */
+    snprintf(tmpName, PATH_MAX, "%s.tmp", stateFile);
+    if (!(sf = fopen(tmpName, "w")))
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not write `%s': %s", tmpName, strerror(errno));
+	return;
+    }
+
+    fputs(STATEFILE_MAGIC, sf);
+    for (cp = first; cp; cp = cp->next)
+    {
+	if (!cp->used) continue;
+	fprintf(sf, "%llu %llu %lld %016llx %d %s\n",
+		(unsigned long long)cp->dev, (unsigned long long)cp->ino,
+		(long long)cp->offset, (unsigned long long)cp->hash,
+		cp->skipping, cp->name);
+    }
+
+    /* only one fsync() per write of the whole state */
+    if (fflush(sf) != 0 || fsync(fileno(sf)) < 0)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not write `%s': %s", tmpName, strerror(errno));
+	fclose(sf);
+	unlink(tmpName);
+	return;
+    }
+    fclose(sf);
+
+    if (rename(tmpName, stateFile) < 0)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not rename `%s': %s", tmpName, strerror(errno));
+	unlink(tmpName);
+	return;
+    }
+
+    dirty = 0;
+}
+
+void
+Checkpoint_done(void)
+{
+    Checkpoint *curr, *last;
+
+    Checkpoint_write();
+
+    curr = first;
+    while (curr)
+    {
+	last = curr;
+	curr = last->next;
+	free(last->name);
+	free(last);
+    }
+
+    first = NULL;
+    hashTable_free(byName);
+    byName = NULL;
+    dirty = 0;
+}
+
+void
+Checkpoint_atexit(void)
+{
+    free(statefile);
+}
@@ -0,0 +1,107 @@
+#ifndef LLAD_CHECKPOINT_H
+#define LLAD_CHECKPOINT_H
+
+/** class Checkpoint
+ * @file
+ */
+
+/** Static class for persisting read positions of Logfiles.
+ * This class keeps a state file recording, for each Logfile, the device and
+ * inode of the file, the offset after the last complete line read and a hash
+ * of the bytes just before that offset. If the rest of a line too long to be
+ * read is being discarded, the offset is within that line, and this is
+ * recorded as well. This allows to resume reading where
+ * the last instance of the daemon stopped. Changes are only kept in memory
+ * until the state file is written, which is done at most once per configurable
+ * interval.
+ * @class Checkpoint "checkpoint.h"
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <popt.h>
+
+extern const struct poptOption checkpoint_opts[];
+
+/** libpopt option table for Checkpoint.
+ */
+#define CHECKPOINT_OPTS {NULL, '\0', POPT_ARG_INCLUDE_TABLE, (struct poptOption *)checkpoint_opts, 0, "Checkpoint options:", NULL},
+
+/** Number of bytes before the checkpoint offset that are hashed.
+ * @memberof Checkpoint
+ */
+#define CHECKPOINT_HASHLEN 64
+
+/** Initialize Checkpoint and load the state file if it exists.
+ * @memberof Checkpoint
+ * @static
+ */
+void Checkpoint_init(void);
+
+/** Write pending changes to the state file and free all resources.
+ * @memberof Checkpoint
+ * @static
+ */
+void Checkpoint_done(void);
+
+/** Get checkpoint recorded for a file.
+ * @memberof Checkpoint
+ * @static
+ * @param name canonical name of the file
+ * @param dev receives device of the file
+ * @param ino receives inode of the file
+ * @param offset receives offset after the last line read
+ * @param hash receives hash of the bytes before offset
+ * @param skipping receives 1 if offset is within a too long line being
+ *                 discarded, 0 otherwise
+ * @returns 1 if a checkpoint was found, 0 otherwise
+ */
+int Checkpoint_get(const char *name, dev_t *dev, ino_t *ino, off_t *offset,
+	uint64_t *hash, int *skipping);
+
+/** Record checkpoint for a file.
+ * The state file is not written by this method.
+ * @memberof Checkpoint
+ * @static
+ * @param name canonical name of the file
+ * @param dev device of the file
+ * @param ino inode of the file
+ * @param offset offset after the last line read
+ * @param hash hash of the bytes before offset
+ * @param skipping 1 if offset is within a too long line being discarded,
+ *                 0 otherwise
+ */
+void Checkpoint_set(const char *name, dev_t dev, ino_t ino, off_t offset,
+	uint64_t hash, int skipping);
+
+/** Forget the checkpoint of a file that is no longer watched.
+ * The state file is not written by this method.
+ * @memberof Checkpoint
+ * @static
+ * @param name canonical name of the file
+ */
+void Checkpoint_remove(const char *name);
+
+/** Get the minimum time between writes of the state file.
+ * @memberof Checkpoint
+ * @static
+ * @returns the configured interval in seconds, -1 if checkpointing is
+ *          disabled
+ */
+int Checkpoint_interval(void);
+
+/** Write the state file if any checkpoints changed.
+ * The file is written to a temporary name, synced to disk and then renamed,
+ * so there is always a consistent state file.
+ * @memberof Checkpoint
+ * @static
+ */
+void Checkpoint_write(void);
+
+/** Call this at exit for final cleanup.
+ * @memberof Checkpoint
+ * @static
+ */
+void Checkpoint_atexit(void);
+
+#endif
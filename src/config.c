@@ -1,57 +1,341 @@
+#define _DEFAULT_SOURCE
 #include "config.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "daemon.h"
+#include "hash.h"
 #include "common.h"
 
+/* maximum number of threads parsing included files */
+#define MAX_PARSERS 64
+
+/* size of the chunks of an Arena */
+#define ARENA_CHUNK (64 * 1024)
+
 static char *configFile = NULL;	    /* config file location from options */
 static const char *cfgFile;	    /* real config file location */
+static char *confDir = NULL;	    /* include directory from options */
 
 const struct poptOption config_opts[] = {
     {"config", 'c', POPT_ARG_STRING, &configFile, 0,
 	"Load config from <path> instead of the default " LLADCONF, "path"},
+    {"confdir", '\0', POPT_ARG_STRING, &confDir, 0,
+	"Also load all files named *.conf in <path>, in alphabetical order "
+	"after the config file. Defaults to the directory conf.d next to the "
+	"config file -- pass empty string to disable.", "path"},
     POPT_TABLEEND
 };
 
 struct cfgLog {
-    char *name;			/* logfile section name */
-    CfgAct *first;		/* first action block in section */
-    CfgLog *next;		/* next logfile section */
+    const char *name;		/* logfile section name */
+    const CfgAct *acts;		/* action blocks in section */
+    size_t numActs;		/* number of acts */
+    CfgLogWatch watch;		/* how changes are noticed */
+    int priority;		/* weight for scheduling scans */
 };
 
-struct cfgLogItor {
-    CfgLog *current;		/* current logfile section */
+struct cfgAct {
+    const char *name;		/* action block name */
+    const char *pattern;	/* pattern for action */
+    const char *command;	/* command for action */
+    int concurrency;		/* max running commands, 0 for no limit */
+    CfgActMode mode;		/* how the command is run */
+    CfgActFraming framing;	/* framing of records for a coprocess */
 };
 
-struct cfgAct {
-    char *name;			/* action block name */
-    char *pattern;		/* pattern for action */
-    char *command;		/* command for action */
-    CfgAct *next;		/* next action block */
+/* a chunk of memory of an Arena */
+typedef struct arenaChunk ArenaChunk;
+
+struct arenaChunk
+{
+    ArenaChunk *next;		/* next chunk, filled earlier */
+    size_t size;		/* usable size of data */
+    size_t used;		/* bytes of data in use */
+    char data[];		/* the memory handed out */
+};
+
+/* memory that is only freed all at once */
+typedef struct arena
+{
+    ArenaChunk *current;	/* chunk filled now */
+} Arena;
+
+/* a complete configuration. The strings are interned, so each distinct
+ * string is stored only once, and everything lives in a single Arena */
+typedef struct configTree
+{
+    Arena arena;		/* memory of everything below */
+    const CfgLog *logs;		/* logfile sections */
+    size_t numLogs;		/* number of logs */
+} ConfigTree;
+
+struct cfgLogItor {
+    const ConfigTree *tree;	/* configuration iterated over */
+    const CfgLog *current;	/* current logfile section */
 };
 
 struct cfgActItor {
     const CfgLog *container;	/* logfile section containing action blocks */
-    CfgAct *current;		/* current action block */
+    const CfgAct *current;	/* current action block */
 };
 
-static CfgLog *firstCfgLog = NULL;  /* first logfile section in config */
-static int lineNumber = 0;	    /* current line number while parsing */
-static int actionInProgress = 0;    /* if 1, action still parsing */
+/* Quote state of the word parser */
+enum qst
+{
+    Q_NORMAL,	/* outside of quotes */
+    Q_QUOTE,	/* inside single quotes (') */
+    Q_DBLQUOTE	/* inside double quotes (") */
+};
+
+/* parsing steps of Action blocks (state machine) */
+enum step
+{
+    ST_START,	    /* initial state, expect action name */
+    ST_NAME,	    /* name read, expect equals sign */
+    ST_NAME_EQUALS, /* equals sign read, expect beginning of block */
+    ST_BLOCK,	    /* beginning of block read, expect property name
+		     * or end of block */
+    ST_BLOCK_NAME,  /* valid property name read, expect equals sign */
+    ST_BLOCK_VALUE, /* equals sign read, expect property value */
+    ST_LOG_VALUE    /* equals sign after a section property name read,
+		     * expect its value */
+};
 
-/* put next "meaningful" line in buf */
+/* state of parsing a single config file. Each file gets its own, so
+ * several files can be parsed at the same time */
+typedef struct parser
+{
+    const char *fileName;	/* name of the file, for error messages */
+    char *buf;			/* whole contents of the file */
+    char *next;			/* start of the next line in buf */
+    char *end;			/* end of the contents, a NUL byte */
+    char saved;			/* first character of the next line,
+				 * replaced by NUL to terminate the current */
+    int lineNumber;		/* current line number */
+    int actionInProgress;	/* if 1, action still parsing */
+    Arena arena;		/* memory for the words parsed */
+    CfgLog *logs;		/* Logfile sections parsed */
+    size_t numLogs;		/* number of logs */
+    size_t logsSize;		/* allocated size of logs */
+    CfgAct *acts;		/* Action blocks of all sections, in order, the
+				 * acts pointers of logs are not set yet */
+    size_t numActs;		/* number of acts */
+    size_t actsSize;		/* allocated size of acts */
+
+    /* word parser */
+    enum qst qst;		/* Quote state */
+    int esc;			/* flag for escape */
+    char *word;			/* the word parsed so far */
+    size_t wordLen;		/* length of word */
+    size_t wordSize;		/* allocated size of word */
+
+    /* Action block parser */
+    char *name;			/* name of new Action block */
+    char *pattern;		/* pattern for new Action block */
+    char *command;		/* command for new Action block */
+    char *concurrency;		/* concurrency for new Action block */
+    char *mode;			/* mode for new Action block */
+    char *framing;		/* framing for new Action block */
+    char **blockval;		/* property value, ptr to pattern, command,
+				 * concurrency, mode or framing */
+    enum step step;		/* parser step */
+} Parser;
+
+/* config files parsed by parseAll(), shared by its threads */
+typedef struct parseJob
+{
+    Parser *parsers;		/* a Parser for each file */
+    int *results;		/* receives the result for each file */
+    size_t num;			/* number of files */
+    size_t next;		/* next file to parse, under lock */
+    pthread_mutex_t lock;	/* protects next */
+} ParseJob;
+
+static ConfigTree *config = NULL;   /* the current configuration */
+
+/* hand out memory from an Arena, aligned for any type */
+static void *
+arena_alloc(Arena *self, size_t size)
+{
+    ArenaChunk *chunk = self->current;
+    size_t chunkSize;
+    void *mem;
+
+    size = (size + 7) & ~(size_t)7;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+	/* big requests get a chunk of their own */
+	chunkSize = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+	chunk = lladAlloc(sizeof(ArenaChunk) + chunkSize);
+	chunk->size = chunkSize;
+	chunk->used = 0;
+	chunk->next = self->current;
+	self->current = chunk;
+    }
+    mem = chunk->data + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+/* copy a string of a given length to an Arena */
 static char *
-nextLine(char *buf, FILE *cfg, int fullLine)
+arena_string(Arena *self, const char *s, size_t len)
 {
-    char *ptr;
-   
-    while (fgets(buf, 1024, cfg))
+    char *copy = arena_alloc(self, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* free all memory of an Arena */
+static void
+arena_free(Arena *self)
+{
+    ArenaChunk *curr, *next;
+
+    for (curr = self->current; curr; curr = next)
+    {
+	next = curr->next;
+	free(curr);
+    }
+    self->current = NULL;
+}
+
+/* get the single copy of a string in an Arena */
+static const char *
+intern(Arena *arena, HashTable *strings, const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = hashTable_get(strings, s, len);
+
+    if (!copy)
+    {
+	copy = arena_string(arena, s, len);
+	hashTable_put(strings, copy, len, copy);
+    }
+    return copy;
+}
+
+/* prepare a Parser for a config file */
+static void
+parser_init(Parser *self, const char *fileName)
+{
+    memset(self, 0, sizeof(Parser));
+    self->fileName = fileName;
+}
+
+/* discard an incomplete Action block, its words stay in the Arena of the
+ * Parser */
+static void
+parser_discardAction(Parser *self)
+{
+    self->name = NULL;
+    self->pattern = NULL;
+    self->command = NULL;
+    self->concurrency = NULL;
+    self->mode = NULL;
+    self->framing = NULL;
+    self->blockval = NULL;
+}
+
+/* free the buffers needed while parsing */
+static void
+parser_done(Parser *self)
+{
+    parser_discardAction(self);
+    free(self->word);
+    free(self->buf);
+    self->word = NULL;
+    self->buf = NULL;
+}
+
+/* free everything, including the sections parsed */
+static void
+parser_free(Parser *self)
+{
+    parser_done(self);
+    free(self->logs);
+    free(self->acts);
+    arena_free(&(self->arena));
+}
+
+/* read the whole file in one go, returns 1 on success, 0 on error */
+static int
+parser_read(Parser *self)
+{
+    struct stat st;
+    size_t len = 0, size;
+    ssize_t rc;
+    int fd;
+
+    if ((fd = open(self->fileName, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+	Daemon_printf_level(LEVEL_ERR,
+		"Could not read `%s': %s", self->fileName, strerror(errno));
+	return 0;
+    }
+
+    /* the size is just a hint, the file could still grow */
+    size = fstat(fd, &st) == 0 && st.st_size > 0 ? (size_t)st.st_size : 0;
+    self->buf = lladAlloc(size + 1);
+    for (;;)
+    {
+	if (len == size)
+	{
+	    size = size ? 2 * size : 4096;
+	    self->buf = lladRealloc(self->buf, size + 1);
+	}
+	rc = read(fd, self->buf + len, size - len);
+	if (rc < 0 && errno == EINTR) continue;
+	if (rc < 0)
+	{
+	    Daemon_printf_level(LEVEL_ERR, "Could not read `%s': %s",
+		    self->fileName, strerror(errno));
+	    close(fd);
+	    return 0;
+	}
+	if (!rc) break;
+	len += (size_t)rc;
+    }
+    close(fd);
+
+    self->buf[len] = '\0';
+    self->next = self->buf;
+    self->end = self->buf + len;
+    self->saved = *self->buf;
+    return 1;
+}
+
+/* return next "meaningful" line, terminated with NUL after its newline */
+static char *
+parser_nextLine(Parser *self, int fullLine)
+{
+    char *line, *ptr;
+
+    while (self->next < self->end)
     {
-	++lineNumber;
-	ptr = buf;
+	/* give back the first character, cut off by the previous line */
+	*self->next = self->saved;
+	line = self->next;
+	ptr = memchr(line, '\n', (size_t)(self->end - line));
+	self->next = ptr ? ptr + 1 : self->end;
+	self->saved = *self->next;
+	*self->next = '\0';
+	++self->lineNumber;
+	ptr = line;
 
 	/* if fullLine requested, just give the next full line */
 	if (fullLine) return ptr;
@@ -86,92 +370,83 @@ skipWhitespace(char **pos)
     }
 }
 
+/* append characters to the word being parsed */
+static void
+parser_append(Parser *self, const char *chars, size_t len)
+{
+    if (self->wordLen + len >= self->wordSize)
+    {
+	if (!self->wordSize) self->wordSize = 256;
+	while (self->wordLen + len >= self->wordSize) self->wordSize *= 2;
+	self->word = lladRealloc(self->word, self->wordSize);
+    }
+    memcpy(self->word + self->wordLen, chars, len);
+    self->wordLen += len;
+}
+
 /* parse and return a word at a given start position, honouring quotes
  * and escapes.
  * This can be called multiple times for words spanning across multiple lines.
  */
 static char *
-parseWord(char **pos)
+parser_word(Parser *self, char **pos)
 {
-    /* Quote state */
-    enum qst
-    {
-	Q_NORMAL,	/* outside of quotes */
-	Q_QUOTE,	/* inside single quotes (') */
-	Q_DBLQUOTE	/* inside double quotes (") */
-    };
+    char *word;			/* return value */
+    char *run;			/* start of characters copied unchanged */
 
-    /* Parser state */
-    struct state
+    while (**pos)
     {
-	enum qst qst;	    /* Quote state */
-	int esc;	    /* flag for escape */
-	char buf[1024];	    /* parsing buffer */
-	char *bufptr;	    /* current position in the buffer */
-    };
-
-    char *word = NULL;		    /* return value */
-    static int initialized = 0;	    /* flag for static initialization */
-    static struct state st;	    /* current state of the parser */
-
-    if (!initialized)
-    {
-	/* initialize state */
-	initialized = 1;
-	memset(&st, 0, sizeof(struct state));
-	st.bufptr = st.buf;
-    }
-
-    while (**pos && st.bufptr < st.buf+1023)
-    {
-	if (st.esc)
+	if (self->esc)
 	{
 	    /* in escape mode, copy any next character and end escape mode */
-	    *st.bufptr++ = **pos;
+	    parser_append(self, *pos, 1);
 	    ++*pos;
-	    st.esc = 0;
+	    self->esc = 0;
 	}
-	else if (st.qst)
+	else if (self->qst)
 	{
 	    if (**pos == '\\' &&
-		    ((st.qst == Q_QUOTE && *(*pos+1) == '\'') ||
-		     (st.qst == Q_DBLQUOTE && *(*pos+1) == '"')))
+		    ((self->qst == Q_QUOTE && *(*pos+1) == '\'') ||
+		     (self->qst == Q_DBLQUOTE && *(*pos+1) == '"')))
 	    {
 		/* in quote mode, only the quote character can be escaped */
 		++*pos;
-		st.esc = 1;
+		self->esc = 1;
 	    }
-	    else if ((st.qst == Q_QUOTE && **pos == '\'') ||
-		(st.qst == Q_DBLQUOTE && **pos == '"'))
+	    else if ((self->qst == Q_QUOTE && **pos == '\'') ||
+		(self->qst == Q_DBLQUOTE && **pos == '"'))
 	    {
 		/* found matching quote character -> end quote mode */
 		++*pos;
-		st.qst = Q_NORMAL;
+		self->qst = Q_NORMAL;
 	    }
 	    else
 	    {
-		/* just copy any other character */
-		*st.bufptr++ = **pos;
-		++*pos;
+		/* just copy any other characters, all at once */
+		run = *pos;
+		while (**pos && **pos != '\\' && **pos != '\''
+			&& **pos != '"') ++*pos;
+		if (*pos == run) ++*pos;
+		parser_append(self, run, (size_t)(*pos - run));
 	    }
 	}
 	else if (**pos == '\\')
 	{
 	    /* enter escape mode */
 	    ++*pos;
-	    st.esc = 1;
+	    self->esc = 1;
 	}
 	else if (**pos == '\'')
 	{
 	    /* enter single quote mode */
 	    ++*pos;
-	    st.qst = Q_QUOTE;
+	    self->qst = Q_QUOTE;
 	}
 	else if (**pos == '"')
 	{
 	    /* enter double quote mode */
 	    ++*pos;
-	    st.qst = Q_DBLQUOTE;
+	    self->qst = Q_DBLQUOTE;
 	}
 	else if (**pos == ' ' || **pos == '\t' || **pos == '=' || **pos == '{'
 		|| **pos == '}' || **pos == '\r' || **pos == '\n')
@@ -180,15 +455,14 @@ parseWord(char **pos)
 	     * skip any trailing whitespace */
 	    skipWhitespace(pos);
 
-	    /* clone read word */
-	    word = lladCloneString(st.buf);
+	    /* copy the word read, the buffer is reused for the next */
+	    word = arena_string(&(self->arena), self->word, self->wordLen);
 #ifdef DEBUG
 	    Daemon_printf_level(LEVEL_DEBUG,
 		    "[config.c] parseWord(): found `%s'", word);
 #endif
 	    /* reinitialize state */
-	    memset(&st, 0, sizeof(struct state));
-	    st.bufptr = st.buf;
+	    self->wordLen = 0;
 
 	    /* and return */
 	    return word;
@@ -196,16 +470,10 @@ parseWord(char **pos)
 	else
 	{
 	    /* normal character -> copy */
-	    *st.bufptr++ = **pos;
+	    parser_append(self, *pos, 1);
 	    ++*pos;
 	}
     }
-    if (**pos)
-    {
-	/* end of parsing buffer reached -> error */
-	Daemon_print_level(LEVEL_CRIT, "Buffer full reading configuration.");
-	exit(EXIT_FAILURE);
-    }
 
 #ifdef DEBUG
     Daemon_print_level(LEVEL_DEBUG, "[config.c] parseWord(): incomplete");
@@ -216,108 +484,72 @@ parseWord(char **pos)
     return NULL;
 }
 
-/* parse Action blocks, append complete blocks to given Logfile section.
- * return 1 if line ends inside of a word, 0 otherwise */
+/* parse Action blocks, append complete blocks to the current Logfile
+ * section.
+ * return 1 if line ends inside of a word, 0 otherwise, -1 on error */
 static int
-parseActions(CfgLog *log, char *line)
+parser_actions(Parser *self, char *line)
 {
-    /* parsing steps (state machine) */
-    enum step
-    {
-	ST_START,	/* initial state, expect action name */
-	ST_NAME,	/* name read, expect equals sign */
-	ST_NAME_EQUALS,	/* equals sign read, expect beginning of block */
-	ST_BLOCK,	/* beginning of block read, expect property name
-			 * or end of block */
-	ST_BLOCK_NAME,	/* valid property name read, expect equals sign */
-	ST_BLOCK_VALUE	/* equals sign read, expect property value */
-    };
-
-    /* Parser state */
-    struct state
-    {
-	CfgLog *lastLog;	/* Logfile section from last invocation */
-	char *name;		/* name of new Action block */
-	char *pattern;		/* pattern for new Action block */
-	char *command;		/* command for new Action block */
-	char *blockname;	/* property name inside block */
-	char **blockval;	/* property value, ptr to pattern or command */
-	CfgAct *currentAction;	/* currently completed Action block */
-	enum step step;		/* parser step */
-    };
-
-    static int initialized = 0;	/* flag for static initialization */
-    static struct state st;	/* parser state */
+    CfgLog *log = &(self->logs[self->numLogs - 1]);  /* current section */
     char *ptr;			/* working pointer, position in line */
+    char *blockname;		/* property name inside block */
     CfgAct *nextAction;		/* newly parsed Action block */
-
-    if (!initialized)
-    {
-	/* initialize parser state */
-	initialized = 1;
-	memset(&st, 0, sizeof(struct state));
-	st.lastLog = log;
-    }
-    else if (log != st.lastLog)
-    {
-	/* reinitialize parser state if called for different Logfile section */
-	free(st.name);
-	free(st.pattern);
-	free(st.command);
-	memset(&st, 0, sizeof(struct state));
-	st.lastLog = log;
-    }
+    long concurrency;		/* parsed concurrency of Action block */
+    char *endptr;		/* end of parsed concurrency */
+    CfgActMode mode;		/* parsed mode of Action block */
+    CfgActFraming framing;	/* parsed framing of Action block */
+    char *value;		/* value of a section property */
+    long priority;		/* parsed priority of Logfile section */
 
     ptr = line; /* point to beginning of line */
 
     while (*ptr)
     {
 	/* state machine */
-	switch (st.step)
+	switch (self->step)
 	{
 	    case ST_START:
 		/* need a word as name of Action */
-		if ((st.name = parseWord(&ptr)))
+		if ((self->name = parser_word(self, &ptr)))
 		{
-		    if (!strlen(st.name))
+		    if (!strlen(self->name))
 		    {
 			/* empty name -> error */
-			free(st.name);
 			Daemon_printf_level(LEVEL_ERR,
 				"Error in `%s': Expected action name in line "
-				"%d, got `%c'", cfgFile, lineNumber, *ptr);
+				"%d, got `%c'", self->fileName,
+				self->lineNumber, *ptr);
 			return -1;
 		    }
 		    Daemon_printf_level(LEVEL_DEBUG,
-			    "[config.c] Found action: %s", st.name);
+			    "[config.c] Found action: %s", self->name);
 		    /* name found -> transition to ST_NAME */
-		    st.step = ST_NAME;
+		    self->step = ST_NAME;
 
 		    /* set flag that we are not done yet */
-		    actionInProgress = 1;
+		    self->actionInProgress = 1;
 		}
 
 		/* no word complete -> need whole next line */
 		else return 1;
 
 		break;
-	    
+
 	    case ST_NAME:
 		if (*ptr == '=')
 		{
 		    /* found -> transition to ST_NAME_EQUALS */
-		    st.step = ST_NAME_EQUALS;
+		    self->step = ST_NAME_EQUALS;
 		    ++ptr;
 		    skipWhitespace(&ptr);
 		}
 		else
 		{
 		    /* error */
-		    free(st.name);
 		    Daemon_printf_level(LEVEL_ERR,
 			    "Error in `%s': Unexpected `%c' in line %d, "
 			    "expected `='",
-			    cfgFile, *ptr, lineNumber);
+			    self->fileName, *ptr, self->lineNumber);
 		    return -1;
 		}
 		break;
@@ -326,18 +558,24 @@ parseActions(CfgLog *log, char *line)
 		if (*ptr == '{')
 		{
 		    /* found -> transition to ST_BLOCK */
-		    st.step = ST_BLOCK;
+		    self->step = ST_BLOCK;
 		    ++ptr;
 		    skipWhitespace(&ptr);
 		}
+		else if (!strcmp(self->name, "watch")
+			|| !strcmp(self->name, "priority"))
+		{
+		    /* not a block, but a property of the section
+		     * -> transition to ST_LOG_VALUE */
+		    self->step = ST_LOG_VALUE;
+		}
 		else
 		{
 		    /* error */
-		    free(st.name);
 		    Daemon_printf_level(LEVEL_ERR,
 			    "Error in `%s': Unexpected `%c' in line %d, "
 			    "expected `{'",
-			    cfgFile, *ptr, lineNumber);
+			    self->fileName, *ptr, self->lineNumber);
 		    return -1;
 		}
 		break;
@@ -347,127 +585,155 @@ parseActions(CfgLog *log, char *line)
 		if (*ptr == '}')
 		{
 		    /* end of block found, transition to ST_START state */
-		    st.step = ST_START;
+		    self->step = ST_START;
 
-		    /* block is only complete with pattern and command */
-		    if (st.pattern && st.command)
+		    /* concurrency is optional, 0 means no limit */
+		    concurrency = 0;
+		    if (self->concurrency)
 		    {
-			/* have both -> create new Action block object */
-			nextAction = lladAlloc(sizeof(CfgAct));
-			if (st.currentAction)
+			concurrency = strtol(self->concurrency, &endptr, 10);
+			if (!*self->concurrency || *endptr || concurrency < 0
+				|| concurrency > 65535)
 			{
-			    st.currentAction->next = nextAction;
+			    /* not a valid number -> error */
+			    Daemon_printf_level(LEVEL_ERR,
+				    "Error in `%s': Invalid concurrency `%s' for "
+				    "action `%s' at line %d.", self->fileName,
+				    self->concurrency, self->name,
+				    self->lineNumber);
+			    return -1;
 			}
-			else
+		    }
+
+		    /* mode is optional, commands are executed per match by
+		     * default */
+		    mode = CAM_EXEC;
+		    if (self->mode)
+		    {
+			if (!strcmp(self->mode, "coprocess")) mode = CAM_COPROCESS;
+			else if (strcmp(self->mode, "exec"))
 			{
-			    log->first = nextAction;
+			    /* unknown mode -> error */
+			    Daemon_printf_level(LEVEL_ERR,
+				    "Error in `%s': Invalid mode `%s' for "
+				    "action `%s' at line %d.", self->fileName,
+				    self->mode, self->name, self->lineNumber);
+			    return -1;
 			}
-			nextAction->name = st.name;
-			nextAction->pattern = st.pattern;
-			nextAction->command = st.command;
-			nextAction->next = NULL;
-			Daemon_printf_level(LEVEL_DEBUG,
-				"[config.c] pattern: `%s' command: `%s'",
-				st.pattern, st.command);
-
-			/* done with this action: */
-			actionInProgress = 0;
 		    }
-		    else
+
+		    /* framing is optional and only used for coprocesses */
+		    framing = CAF_NUL;
+		    if (self->framing)
+		    {
+			if (!strcmp(self->framing, "json")) framing = CAF_JSON;
+			if (mode != CAM_COPROCESS || (framing != CAF_JSON
+				    && strcmp(self->framing, "nul")))
+			{
+			    /* unknown framing or not a coprocess -> error */
+			    Daemon_printf_level(LEVEL_ERR,
+				    "Error in `%s': Invalid framing `%s' for "
+				    "action `%s' at line %d.", self->fileName,
+				    self->framing, self->name,
+				    self->lineNumber);
+			    return -1;
+			}
+		    }
+
+		    /* block is only complete with pattern and command */
+		    if (!self->pattern || !self->command)
 		    {
 			/* error -> incomplete block */
 			Daemon_printf_level(LEVEL_ERR,
 				"Error in `%s': Incomplete action `%s' "
 				"at line %d.",
-				cfgFile, st.name, lineNumber);
-			free(st.name);
-			free(st.pattern);
-			free(st.command);
+				self->fileName, self->name, self->lineNumber);
 			return -1;
 		    }
 
-		    /* reinitialize state */
-		    memset(&st, 0, sizeof(struct state));
-		    st.lastLog = log;
-		    st.currentAction = nextAction;
+		    /* have both -> append new Action block, it belongs to
+		     * the last section */
+		    if (self->numActs == self->actsSize)
+		    {
+			self->actsSize = self->actsSize
+			    ? 2 * self->actsSize : 64;
+			self->acts = lladRealloc(self->acts,
+				self->actsSize * sizeof(CfgAct));
+		    }
+		    nextAction = &(self->acts[self->numActs++]);
+		    ++log->numActs;
+		    nextAction->name = self->name;
+		    nextAction->pattern = self->pattern;
+		    nextAction->command = self->command;
+		    nextAction->concurrency = (int)concurrency;
+		    nextAction->mode = mode;
+		    nextAction->framing = framing;
+		    Daemon_printf_level(LEVEL_DEBUG,
+			    "[config.c] pattern: `%s' command: `%s'",
+			    self->pattern, self->command);
+
+		    /* done with this action */
+		    parser_discardAction(self);
+		    self->actionInProgress = 0;
 
 		    /* skip '}' and any following whitespace */
 		    ++ptr;
 		    skipWhitespace(&ptr);
 		}
-		else if ((st.blockname = parseWord(&ptr)))
+		else if ((blockname = parser_word(self, &ptr)))
 		{
-		    if (!strlen(st.blockname))
+		    /* word inside a block is property name */
+		    if (!strlen(blockname))
 		    {
 			/* empty name -> error */
-			free(st.name);
-			free(st.blockname);
-			free(st.command);
-			free(st.pattern);
 			Daemon_printf_level(LEVEL_ERR,
 				"Error in `%s': Expected config value in line "
-				"%d, got `%c'.", cfgFile, lineNumber, *ptr);
+				"%d, got `%c'.", self->fileName,
+				self->lineNumber, *ptr);
 			return -1;
 		    }
-
-		    /* word inside a block is property name */
-		    if (!strncmp(st.blockname, "pattern", 7))
+		    else if (!strncmp(blockname, "pattern", 7))
 		    {
-			if (st.pattern)
-			{
-			    /* already got pattern for this action -> error */
-			    Daemon_printf_level(LEVEL_ERR,
-				    "Error in `%s': Found second pattern for "
-				    "action `%s' in line %d",
-				    cfgFile, st.name, lineNumber);
-			    free(st.name);
-			    free(st.blockname);
-			    free(st.command);
-			    free(st.pattern);
-			    return -1;
-			}
-
-			/* found "pattern" -> transition to ST_BLOCK_NAME */
-			st.step = ST_BLOCK_NAME;
-
-			/* and set value pointer to pattern */
-			st.blockval = &(st.pattern);
+			self->blockval = &(self->pattern);
 		    }
-		    else if (!strncmp(st.blockname, "command", 7))
+		    else if (!strncmp(blockname, "command", 7))
 		    {
-			if (st.command)
-			{
-			    /* already got pattern for this action -> error */
-			    Daemon_printf_level(LEVEL_ERR,
-				    "Error in `%s': Found second command for "
-				    "action `%s' in line %d",
-				    cfgFile, st.name, lineNumber);
-			    free(st.name);
-			    free(st.blockname);
-			    free(st.command);
-			    free(st.pattern);
-			    return -1;
-			}
-
-			/* found "command" -> transition to ST_BLOCK_NAME */
-			st.step = ST_BLOCK_NAME;
-
-			/* and set value pointer to command */
-			st.blockval = &(st.command);
+			self->blockval = &(self->command);
+		    }
+		    else if (!strncmp(blockname, "concurrency", 11))
+		    {
+			self->blockval = &(self->concurrency);
+		    }
+		    else if (!strncmp(blockname, "mode", 4))
+		    {
+			self->blockval = &(self->mode);
+		    }
+		    else if (!strncmp(blockname, "framing", 7))
+		    {
+			self->blockval = &(self->framing);
 		    }
 		    else
 		    {
 			/* unknown property name -> error */
-			free(st.command);
-			free(st.pattern);
-			free(st.name);
 			Daemon_printf_level(LEVEL_ERR,
 				"Error in `%s': Unknown config value `%s' in "
-				"line %d", cfgFile, st.blockname, lineNumber);
-			free(st.blockname);
+				"line %d", self->fileName, blockname,
+				self->lineNumber);
+			return -1;
+		    }
+
+		    if (*(self->blockval))
+		    {
+			/* already got this property for this action -> error */
+			Daemon_printf_level(LEVEL_ERR,
+				"Error in `%s': Found second %s for action `%s' "
+				"in line %d", self->fileName, blockname,
+				self->name, self->lineNumber);
 			return -1;
 		    }
-		    free(st.blockname);
+
+		    /* found -> transition to ST_BLOCK_NAME */
+		    self->step = ST_BLOCK_NAME;
 		}
 
 		/* still in block and no word complete
@@ -481,46 +747,68 @@ parseActions(CfgLog *log, char *line)
 		if (*ptr == '=')
 		{
 		    /* found -> transition to ST_BLOCK_VALUE */
-		    st.step = ST_BLOCK_VALUE;
+		    self->step = ST_BLOCK_VALUE;
 		    ++ptr;
 		    skipWhitespace(&ptr);
 		}
 		else
 		{
 		    /* error */
-		    free(st.name);
 		    Daemon_printf_level(LEVEL_ERR,
 			    "Error in `%s': Unexpected `%c' in line %d, "
 			    "expected `='",
-			    cfgFile, *ptr, lineNumber);
+			    self->fileName, *ptr, self->lineNumber);
 		    return -1;
 		}
 		break;
 
 	    case ST_BLOCK_VALUE:
 		/* need word for property value */
-		if ((*(st.blockval) = parseWord(&ptr)))
+		if ((*(self->blockval) = parser_word(self, &ptr)))
+		{
+		    /* found -> transition to ST_BLOCK */
+		    self->step = ST_BLOCK;
+		}
+
+		/* no word complete -> need whole next line */
+		else return 1;
+
+		break;
+
+	    case ST_LOG_VALUE:
+		/* need word for section property value */
+		if ((value = parser_word(self, &ptr)))
 		{
-		    if (!strlen(st.name))
+		    if (!strcmp(self->name, "priority"))
 		    {
-			/* empty name -> error */
-			free(st.name);
-			if (st.blockval == &(st.command))
+			priority = strtol(value, &endptr, 10);
+			if (!*value || *endptr || priority < 1 || priority > 100)
 			{
+			    /* not a valid number -> error */
 			    Daemon_printf_level(LEVEL_ERR,
-				    "Error in `%s': Expected command in line "
-				    "%d, got `%c'", cfgFile, lineNumber, *ptr);
-			}
-			else
-			{
-			    Daemon_printf_level(LEVEL_ERR,
-				    "Error in `%s': Expected pattern in line "
-				    "%d, got `%c'", cfgFile, lineNumber, *ptr);
+				    "Error in `%s': Invalid priority `%s' at "
+				    "line %d.", self->fileName, value,
+				    self->lineNumber);
+			    return -1;
 			}
+			log->priority = (int)priority;
+		    }
+		    else if (!strcmp(value, "poll")) log->watch = CLW_POLL;
+		    else if (!strcmp(value, "inotify")) log->watch = CLW_INOTIFY;
+		    else if (!strcmp(value, "auto")) log->watch = CLW_AUTO;
+		    else
+		    {
+			/* unknown watch mode -> error */
+			Daemon_printf_level(LEVEL_ERR,
+				"Error in `%s': Invalid watch `%s' at line %d.",
+				self->fileName, value, self->lineNumber);
 			return -1;
 		    }
-		    /* found -> transition to ST_BLOCK */
-		    st.step = ST_BLOCK;
+		    self->name = NULL;
+
+		    /* property done -> transition to ST_START */
+		    self->step = ST_START;
+		    self->actionInProgress = 0;
 		}
 
 		/* no word complete -> need whole next line */
@@ -534,82 +822,79 @@ parseActions(CfgLog *log, char *line)
     return 0;
 }
 
-/* parse config file */
+/* read and parse a config file into the list of Logfile sections of the
+ * Parser, returns 1 on success, 0 on error */
 static int
-loadConfigEntries(FILE *cfg)
+parser_load(Parser *self)
 {
-    CfgLog *currentLog = NULL;
+    CfgLog *currentLog;
     int needFullLine = 0;
-    char buf[1024];
     char *ptr;
     char *ptr2;
 
-    lineNumber = 0;
+    if (!parser_read(self)) return 0;
 
     /* read line for line, ignoring trainling whitespace and comments */
-    while ((ptr = nextLine(buf, cfg, needFullLine)))
+    while ((ptr = parser_nextLine(self, needFullLine)))
     {
 	if (!needFullLine && *ptr == '[')
 	{
 	    /* first character is '[' -> new logfile section found */
 	    ++ptr;
 
-	    if (actionInProgress)
+	    if (self->actionInProgress)
 	    {
 		/* new section while action is incomplete is an error */
 		Daemon_printf_level(LEVEL_ERR,
 			"Error in `%s': Found '[' before action block was "
-			"completed in line %d.", cfgFile, lineNumber);
+			"completed in line %d.", self->fileName,
+			self->lineNumber);
 		return 0;
 	    }
 
 	    /* search for matching ']' */
-	    for (ptr2 = ptr; *ptr2; ++ptr2)
+	    if (!(ptr2 = strchr(ptr, ']')))
 	    {
-		if (*ptr2 == ']')
-		{
-		    /* found -> create new Logfile section object */
-		    *ptr2 = '\0';
-		    Daemon_printf_level(LEVEL_DEBUG,
-			    "[config.c] Found logfile section: %s", ptr);
-		    if (currentLog)
-		    {
-			currentLog->next = lladAlloc(sizeof(CfgLog));
-			currentLog = currentLog->next;
-		    }
-		    else
-		    {
-			currentLog = lladAlloc(sizeof(CfgLog));
-			firstCfgLog = currentLog;
-		    }
-		    currentLog->name = lladCloneString(ptr);
-		    currentLog->first = NULL;
-		    currentLog->next = NULL;
-		    goto loadConfigNext;
-		}
+		/* missing ']' -> error */
+		Daemon_printf_level(LEVEL_ERR,
+			"Error in `%s': '[' without matching ']' in line %d.",
+			self->fileName, self->lineNumber);
+		return 0;
 	    }
 
-	    /* missing ']' -> error */
-	    Daemon_printf_level(LEVEL_ERR,
-		    "Error in `%s': '[' without matching ']' in line %d.",
-		    cfgFile, lineNumber);
-	    return 0;
+	    /* found -> append new Logfile section */
+	    *ptr2 = '\0';
+	    Daemon_printf_level(LEVEL_DEBUG,
+		    "[config.c] Found logfile section: %s", ptr);
+	    if (self->numLogs == self->logsSize)
+	    {
+		self->logsSize = self->logsSize ? 2 * self->logsSize : 16;
+		self->logs = lladRealloc(self->logs,
+			self->logsSize * sizeof(CfgLog));
+	    }
+	    currentLog = &(self->logs[self->numLogs++]);
+	    currentLog->name = arena_string(&(self->arena), ptr,
+		    (size_t)(ptr2 - ptr));
+	    currentLog->acts = NULL;
+	    currentLog->numActs = 0;
+	    currentLog->watch = CLW_AUTO;
+	    currentLog->priority = 1;
+	    self->step = ST_START;
 	}
-	else if (currentLog)
+	else if (self->numLogs)
 	{
 	    /* no section start -> try to parse actions */
-	    needFullLine = parseActions(currentLog, ptr);
+	    needFullLine = parser_actions(self, ptr);
 	    if (needFullLine < 0) return 0;
 	}
-loadConfigNext:;
     }
 
-    if (actionInProgress)
+    if (self->actionInProgress)
     {
 	/* end of file while action is incompete -> error */
 	Daemon_printf_level(LEVEL_ERR,
 		"Error in `%s': Unexpected end of file before action block "
-		"was completed.", cfgFile);
+		"was completed.", self->fileName);
 	return 0;
     }
 
@@ -617,43 +902,210 @@ loadConfigNext:;
     return 1;
 }
 
-void
-Config_done(void)
+/* parse config files taken from a ParseJob until none are left, the main
+ * function of the parser threads */
+static void *
+parserMain(void *data)
 {
-    CfgLog *logc, *logl;
-    CfgAct *actc, *actl;
+    ParseJob *job = data;
+    size_t i;
 
-    logc = firstCfgLog;
-    while (logc)
+    for (;;)
     {
-	logl = logc;
-	logc = logl->next;
+	pthread_mutex_lock(&(job->lock));
+	i = job->next++;
+	pthread_mutex_unlock(&(job->lock));
+	if (i >= job->num) break;
 
-	actc = logl->first;
-	while (actc)
+	job->results[i] = parser_load(&(job->parsers[i]));
+	parser_done(&(job->parsers[i]));
+    }
+    return NULL;
+}
+
+/* parse several config files in a pool of threads, one per CPU. returns 1
+ * if all of them were parsed successfully, 0 otherwise */
+static int
+parseAll(Parser *parsers, size_t num)
+{
+    ParseJob job;
+    pthread_t threads[MAX_PARSERS];
+    sigset_t all, old;
+    int cpus;
+    int numThreads = 0;
+    size_t i;
+    int ok = 1;
+
+    job.parsers = parsers;
+    job.results = lladAlloc((num + 1) * sizeof(int));
+    job.num = num;
+    job.next = 0;
+    pthread_mutex_init(&(job.lock), NULL);
+
+    /* the calling thread parses as well */
+    cpus = lladWorkers(num, MAX_PARSERS);
+
+    /* the daemon handles signals in its main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; numThreads < cpus - 1; ++numThreads)
+    {
+	if ((errno = pthread_create(&(threads[numThreads]), NULL,
+			&parserMain, &job)))
 	{
-	    actl = actc;
-	    actc = actl->next;
+	    /* the threads started so far do all the work */
+	    Daemon_perror("pthread_create()");
+	    break;
+	}
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-	    free(actl->name);
-	    free(actl->pattern);
-	    free(actl->command);
-	    free(actl);
+    parserMain(&job);
+    for (i = 0; i < (size_t)numThreads; ++i) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&(job.lock));
+
+    for (i = 0; i < num; ++i) if (!job.results[i]) ok = 0;
+    free(job.results);
+    return ok;
+}
+
+/* select included config files */
+static int
+isConfName(const struct dirent *entry)
+{
+    size_t len = strlen(entry->d_name);
+
+    return entry->d_name[0] != '.' && len > 5
+	&& !strcmp(entry->d_name + len - 5, ".conf");
+}
+
+/* list the included config files in alphabetical order, returns the number
+ * of files and a new array of their names in *names */
+static size_t
+listIncludes(char ***names)
+{
+    struct dirent **entries;
+    char *tmp, *dir;
+    size_t i;
+    int n;
+
+    *names = NULL;
+
+    /* prefer option over directory next to the config file, empty string
+     * disables */
+    if (confDir && !*confDir) return 0;
+    if (confDir)
+    {
+	dir = lladCloneString(confDir);
+    }
+    else
+    {
+	tmp = lladCloneString(cfgFile);
+	dir = lladAlloc(strlen(cfgFile) + sizeof("/conf.d"));
+	strcpy(dir, dirname(tmp));
+	strcat(dir, "/conf.d");
+	free(tmp);
+    }
+
+    if ((n = scandir(dir, &entries, &isConfName, &alphasort)) < 0)
+    {
+	/* no include directory is fine */
+	if (errno != ENOENT || confDir)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Could not read `%s': %s", dir, strerror(errno));
 	}
+	free(dir);
+	return 0;
+    }
 
-	free(logl->name);
-	free(logl);
+    *names = lladAlloc(((size_t)n + 1) * sizeof(char *));
+    for (i = 0; i < (size_t)n; ++i)
+    {
+	(*names)[i] = lladAlloc(strlen(dir) + strlen(entries[i]->d_name) + 2);
+	strcpy((*names)[i], dir);
+	strcat((*names)[i], "/");
+	strcat((*names)[i], entries[i]->d_name);
+	free(entries[i]);
     }
+    free(entries);
+    free(dir);
+    return (size_t)n;
+}
 
-    firstCfgLog = NULL;
+/* free a configuration, everything at once */
+static void
+freeConfig(ConfigTree *tree)
+{
+    if (!tree) return;
+    arena_free(&(tree->arena));
+    free(tree);
 }
 
-int
-Config_init(void)
+/* copy the sections of all Parsers, in file order, to a new configuration
+ * stored in a single Arena */
+static ConfigTree *
+buildConfig(const Parser *parsers, size_t num)
 {
-    FILE *cfg;
+    ConfigTree *tree = lladAlloc(sizeof(ConfigTree));
+    HashTable *strings = HashTable_new();
+    CfgLog *logs, *log;
+    CfgAct *acts, *act;
+    const CfgAct *src;
+    size_t i, j, k, numLogs = 0, numActs = 0;
+
+    for (i = 0; i < num; ++i)
+    {
+	numLogs += parsers[i].numLogs;
+	numActs += parsers[i].numActs;
+    }
 
-    if (firstCfgLog) Config_done();
+    tree->arena.current = NULL;
+    logs = arena_alloc(&(tree->arena), (numLogs + 1) * sizeof(CfgLog));
+    acts = arena_alloc(&(tree->arena), (numActs + 1) * sizeof(CfgAct));
+    tree->logs = logs;
+    tree->numLogs = numLogs;
+
+    log = logs;
+    act = acts;
+    for (i = 0; i < num; ++i)
+    {
+	/* the Action blocks of a Parser follow each other in section
+	 * order */
+	src = parsers[i].acts;
+	for (j = 0; j < parsers[i].numLogs; ++j, ++log)
+	{
+	    *log = parsers[i].logs[j];
+	    log->name = intern(&(tree->arena), strings, log->name);
+	    log->acts = act;
+	    for (k = 0; k < log->numActs; ++k, ++act, ++src)
+	    {
+		*act = *src;
+		act->name = intern(&(tree->arena), strings, act->name);
+		act->pattern = intern(&(tree->arena), strings, act->pattern);
+		act->command = intern(&(tree->arena), strings, act->command);
+	    }
+	}
+    }
+
+    Daemon_printf_level(LEVEL_DEBUG,
+	    "[config.c] %lu sections with %lu actions, %lu distinct strings.",
+	    (unsigned long)numLogs, (unsigned long)numActs,
+	    (unsigned long)hashTable_count(strings));
+    hashTable_free(strings);
+    return tree;
+}
+
+/* read and parse the configuration file and the included files into a new
+ * configuration at *tree, returns 1 on success, 0 on error */
+static int
+loadConfig(ConfigTree **tree)
+{
+    Parser *parsers;
+    char **includes;
+    size_t i, numFiles;
+    struct timespec start;
+    int ok;
 
     /* prefer option over compile-time configuration
      * for config file location */
@@ -666,24 +1118,78 @@ Config_init(void)
 	cfgFile = LLADCONF;
     }
 
-    /* try reading configuration file */
-    if ((cfg = fopen(cfgFile, "r")))
+    *tree = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* the config file comes first, then the included files, each of them
+     * parsed on its own */
+    numFiles = listIncludes(&includes) + 1;
+    parsers = lladAlloc(numFiles * sizeof(Parser));
+    parser_init(&(parsers[0]), cfgFile);
+    for (i = 1; i < numFiles; ++i) parser_init(&(parsers[i]), includes[i-1]);
+
+    ok = parseAll(parsers, numFiles);
+    if (ok) *tree = buildConfig(parsers, numFiles);
+
+    for (i = 0; i < numFiles; ++i) parser_free(&(parsers[i]));
+    for (i = 1; i < numFiles; ++i) free(includes[i-1]);
+    free(includes);
+    free(parsers);
+    if (!ok) return 0;
+
+    Daemon_printf_level(LEVEL_DEBUG,
+	    "[config.c] Parsed %lu config files in %ld ms.",
+	    (unsigned long)numFiles, lladElapsedUs(&start) / 1000);
+    return 1;
+}
+
+void
+Config_done(void)
+{
+    freeConfig(config);
+    config = NULL;
+}
+
+int
+Config_init(void)
+{
+    char *path;
+
+    if (config) Config_done();
+
+    /* the daemon changes its working directory, so a relative path must be
+     * resolved now for reloading later */
+    if (configFile && *configFile != '/'
+	    && (path = realpath(configFile, NULL)))
     {
-	if (!loadConfigEntries(cfg))
-	{
-	    fclose(cfg);
-	    Config_done();
-	    return 0;
-	}
-	fclose(cfg);
+	free(configFile);
+	configFile = path;
     }
-    else
+    if (confDir && *confDir && *confDir != '/'
+	    && (path = realpath(confDir, NULL)))
+    {
+	free(confDir);
+	confDir = path;
+    }
+
+    return loadConfig(&config);
+}
+
+int
+Config_reload(void)
+{
+    ConfigTree *tree;
+
+    if (!loadConfig(&tree))
     {
 	Daemon_printf_level(LEVEL_ERR,
-		"Could not read `%s': %s", cfgFile, strerror(errno));
+		"Keeping current configuration, `%s' has errors.", cfgFile);
 	return 0;
     }
 
+    /* only replace the current configuration if the new one is valid */
+    freeConfig(config);
+    config = tree;
     return 1;
 }
 
@@ -691,6 +1197,7 @@ CfgLogItor *
 Config_cfgLogItor()
 {
     CfgLogItor *i = lladAlloc(sizeof(CfgLogItor));
+    i->tree = config;
     i->current = NULL;
     return i;
 }
@@ -704,8 +1211,13 @@ cfgLogItor_current(const CfgLogItor *self)
 int
 cfgLogItor_moveNext(CfgLogItor *self)
 {
-    if (self->current) self->current = self->current->next;
-    else self->current = firstCfgLog;
+    if (self->current) ++self->current;
+    else if (self->tree) self->current = self->tree->logs;
+    if (self->current
+	    && self->current == self->tree->logs + self->tree->numLogs)
+    {
+	self->current = NULL;
+    }
     return (self->current != NULL);
 }
 
@@ -721,6 +1233,18 @@ cfgLog_name(const CfgLog *self)
     return self->name;
 }
 
+CfgLogWatch
+cfgLog_watch(const CfgLog *self)
+{
+    return self->watch;
+}
+
+int
+cfgLog_priority(const CfgLog *self)
+{
+    return self->priority;
+}
+
 CfgActItor *
 cfgLog_cfgActItor(const CfgLog *self)
 {
@@ -739,8 +1263,12 @@ cfgActItor_current(const CfgActItor *self)
 int
 cfgActItor_moveNext(CfgActItor *self)
 {
-    if (self->current) self->current = self->current->next;
-    else self->current = self->container->first;
+    if (self->current) ++self->current;
+    else self->current = self->container->acts;
+    if (self->current == self->container->acts + self->container->numActs)
+    {
+	self->current = NULL;
+    }
     return (self->current != NULL);
 }
 
@@ -768,10 +1296,29 @@ cfgAct_command(const CfgAct *self)
     return self->command;
 }
 
+int
+cfgAct_concurrency(const CfgAct *self)
+{
+    return self->concurrency;
+}
+
+CfgActMode
+cfgAct_mode(const CfgAct *self)
+{
+    return self->mode;
+}
+
+CfgActFraming
+cfgAct_framing(const CfgAct *self)
+{
+    return self->framing;
+}
+
 void
 Config_atexit(void)
 {
     Config_done();
     free(configFile);
+    free(confDir);
 }
 
@@ -9,7 +9,15 @@
  * This class reads the configuration file for llad. It is parsed and the
  * values are stored in an object tree consisting of CfgLog entries for
  * Logfile sections and CfgAct entries for Action blocks inside Logfile
- * sections. Methods for walking the tree are provided.
+ * sections. Methods for walking the tree are provided. The whole tree is
+ * kept in arrays in a single memory arena, with each distinct name, pattern
+ * and command stored once, so it is freed at once as well.
+ *
+ * Files named *.conf in an include directory (conf.d next to the config file
+ * by default) are read as well, in alphabetical order after the config file.
+ * Each file is read at once and parsed by its own reentrant parser, so the
+ * included files are parsed in parallel. There are no limits on the length
+ * of lines or values.
  * @class Config "config.h"
  */
 
@@ -42,6 +50,31 @@ struct cfgAct;
  */
 typedef struct cfgAct CfgAct;
 
+/** Modes for running the command of an Action.
+ */
+typedef enum cfgActMode
+{
+    CAM_EXEC,		/**< execute the command for each match */
+    CAM_COPROCESS	/**< keep the command running, feed matches on stdin */
+} CfgActMode;
+
+/** Framing of the records written to a coprocess.
+ */
+typedef enum cfgActFraming
+{
+    CAF_NUL,		/**< each field terminated by a NUL byte */
+    CAF_JSON		/**< one JSON array of strings per line */
+} CfgActFraming;
+
+/** How changes of a Logfile are noticed.
+ */
+typedef enum cfgLogWatch
+{
+    CLW_AUTO,		/**< poll on network filesystems, inotify otherwise */
+    CLW_INOTIFY,	/**< use inotify events */
+    CLW_POLL		/**< check size and inode periodically */
+} CfgLogWatch;
+
 struct cfgActItor;
 
 /** class for iterating over a list of CfgAct entries.
@@ -58,6 +91,16 @@ typedef struct cfgActItor CfgActItor;
  */
 int Config_init(void);
 
+/** Read and parse the config file again.
+ * If the new configuration is valid, it replaces the current one and all
+ * CfgLog and CfgAct entries of the current one become invalid. Otherwise,
+ * the errors are logged and the current configuration is kept.
+ * @memberof Config
+ * @static
+ * @returns 1 if the configuration was replaced, 0 on error
+ */
+int Config_reload(void);
+
 /** static destruction of Config.
  * should be called when the config file values are no longer needed, frees all
  * resources allocated by Config_init().
@@ -102,6 +145,22 @@ void cfgLogItor_free(CfgLogItor *self);
  */
 const char *cfgLog_name(const CfgLog *self);
 
+/** Get how changes of the logfile are noticed.
+ * @memberof CfgLog
+ * @param self the Logfile section
+ * @returns configured watch mode, CLW_AUTO if not configured
+ */
+CfgLogWatch cfgLog_watch(const CfgLog *self);
+
+/** Get scheduling priority of the logfile.
+ * A logfile with priority n is read n times as much per turn as one with
+ * priority 1 when several logfiles have new lines.
+ * @memberof CfgLog
+ * @param self the Logfile section
+ * @returns configured priority, 1 if not configured
+ */
+int cfgLog_priority(const CfgLog *self);
+
 /** Create iterator for iterating over all Action blocks of a Logfile section.
  * @memberof CfgLog
  * @param self the Logfile section
@@ -152,6 +211,28 @@ const char *cfgAct_pattern(const CfgAct *self);
  */
 const char *cfgAct_command(const CfgAct *self);
 
+/** Get maximum number of concurrently running commands for Action.
+ * @memberof CfgAct
+ * @param self the Action block
+ * @returns configured concurrency, 0 if not limited
+ */
+int cfgAct_concurrency(const CfgAct *self);
+
+/** Get mode for running the command of Action.
+ * @memberof CfgAct
+ * @param self the Action block
+ * @returns configured mode, CAM_EXEC if not configured
+ */
+CfgActMode cfgAct_mode(const CfgAct *self);
+
+/** Get framing of records written to the command of Action.
+ * Only meaningful in CAM_COPROCESS mode.
+ * @memberof CfgAct
+ * @param self the Action block
+ * @returns configured framing, CAF_NUL if not configured
+ */
+CfgActFraming cfgAct_framing(const CfgAct *self);
+
 /** Call this at exit for final cleanup.
  * @memberof Config
  * @static
@@ -1,27 +1,73 @@
-#define _BSD_SOURCE
-#define _POSIX_SOURCE
+#define _GNU_SOURCE
 #include "daemon.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 
+#include "util.h"
+
 static const char *daemonName = NULL;	/* name, eg. for logging */
 static int nodetach = 0;		/* flag, run in foreground if 1 */
 static char *pidfile = NULL;		/* pidfile location from popt */
 static int loglevel = LOG_INFO;		/* default log priority */
 static int logfacility = 0;		/* set to facility when log opened */
+static int logQueue = 4096;		/* log queue size from popt */
 
 /* default pidfile location */
 #define PIDFILE_DEFAULT RUNSTATEDIR "/%s.pid"
 
+/* length of a log message stored in the log queue itself, longer messages
+ * are allocated */
+#define LOG_MSG_INLINE 216
+
+/* maximum number of log messages written at once */
+#define LOG_BATCH 64
+
+/* a log message waiting in the log queue */
+typedef struct logRecord
+{
+    size_t seq;			/* ready to be written if position + 1, free
+				 * for the position given */
+    time_t time;		/* time the message was logged */
+    char *text;			/* the message, inline or allocated */
+    size_t len;			/* length of text */
+    int level;			/* log priority */
+    char msg[LOG_MSG_INLINE];	/* short messages */
+} LogRecord;
+
+/* The log queue is a ring of LogRecords written by any thread without
+ * locking and read by the logger thread only. Writers claim a position by
+ * advancing tail, each record tells by its sequence number whether it is
+ * free for that position or ready to be read. */
+static LogRecord *ring = NULL;		/* the records */
+static size_t ringMask = 0;		/* number of records - 1 */
+static size_t tail = 0;			/* next position to be claimed */
+static size_t head = 0;			/* next position to be read */
+static unsigned long dropped = 0;	/* messages lost, the ring was full */
+static int queueing = 0;		/* flag, messages go to the ring */
+static int sleeping = 0;		/* flag, logger thread waits for evfd */
+static int stopping = 0;		/* flag, logger thread should exit */
+static int evfd = -1;			/* eventfd waking the logger thread */
+static int logsock = -1;		/* socket connected to the syslog daemon */
+static pid_t logpid = 0;		/* pid given in syslog messages */
+static pthread_t logger;		/* the logger thread */
+static int loggerStarted = 0;		/* flag, logger must be joined */
+
 struct level
 {
     const int val;
@@ -75,6 +121,11 @@ const struct poptOption daemon_opts[] = {
 	"reaches from 0 (only print/log emergencies) to 7 (print/log "
 	"everyting including debugging info) to 7 . The default is 6 "
 	"(infos, notices, warnings and everything more important). ", "level"},
+    {"log-queue", '\0', POPT_ARG_INT, &logQueue, 0,
+	"Queue up to <n> log messages for a logger thread writing them, so a "
+	"slow syslog daemon doesn't stall matching. If the queue is full, "
+	"messages are dropped and counted. Defaults to 4096, pass 0 to log "
+	"directly.", "n"},
     POPT_TABLEEND
 };
 
@@ -86,6 +137,370 @@ loginit(void)
     openlog(daemonName, LOG_CONS | LOG_NOWAIT | LOG_PID, logfacility);
 }
 
+/* connect to the syslog daemon for writing log messages in batches,
+ * returns 1 on success, 0 on error */
+static int
+logconnect(void)
+{
+    struct sockaddr_un addr;
+
+    if (logsock >= 0) close(logsock);
+    logsock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (logsock < 0) return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, _PATH_LOG, sizeof(addr.sun_path) - 1);
+    if (connect(logsock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+	close(logsock);
+	logsock = -1;
+	return 0;
+    }
+    return 1;
+}
+
+/* send records to the syslog daemon, formatted like syslog() does, so
+ * the pattern for recognizing own log lines still matches */
+static void
+logsend(LogRecord *const *recs, size_t num)
+{
+    struct mmsghdr msgs[LOG_BATCH];
+    struct iovec iov[2 * LOG_BATCH];
+    char hdrs[LOG_BATCH][128];
+    char stamp[32];
+    struct tm tm;
+    size_t i, sent = 0;
+    int rc, len, retried = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < num; ++i)
+    {
+	localtime_r(&(recs[i]->time), &tm);
+	strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", &tm);
+	len = snprintf(hdrs[i], sizeof(hdrs[i]), "<%d>%s %s[%d]: ",
+		logfacility | recs[i]->level, stamp, daemonName, (int)logpid);
+	if (len < 0 || (size_t)len >= sizeof(hdrs[i])) len = 0;
+
+	iov[2*i].iov_base = hdrs[i];
+	iov[2*i].iov_len = (size_t)len;
+	iov[2*i+1].iov_base = recs[i]->text;
+	iov[2*i+1].iov_len = recs[i]->len;
+	msgs[i].msg_hdr.msg_iov = &(iov[2*i]);
+	msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    while (sent < num)
+    {
+	rc = sendmmsg(logsock, msgs + sent, (unsigned int)(num - sent), 0);
+	if (rc > 0)
+	{
+	    sent += (size_t)rc;
+	    continue;
+	}
+	if (rc < 0 && errno == EINTR) continue;
+
+	/* the syslog daemon may have been restarted, connect once again */
+	if (!retried++ && logconnect()) continue;
+	break;
+    }
+
+    /* let syslog() handle the rest */
+    for (i = sent; i < num; ++i)
+    {
+	syslog(logfacility | recs[i]->level, "%s", recs[i]->text);
+    }
+}
+
+/* write records, syslog daemon or stderr */
+static void
+logwrite(LogRecord *const *recs, size_t num)
+{
+    struct iovec iov[3 * LOG_BATCH];
+    char pfxs[LOG_BATCH][8];
+    size_t i;
+
+    if (logfacility)
+    {
+	if (logsock >= 0)
+	{
+	    logsend(recs, num);
+	}
+	else for (i = 0; i < num; ++i)
+	{
+	    syslog(logfacility | recs[i]->level, "%s", recs[i]->text);
+	}
+	return;
+    }
+
+    for (i = 0; i < num; ++i)
+    {
+	snprintf(pfxs[i], sizeof(pfxs[i]), "[%s] ", strlvl[recs[i]->level]);
+	iov[3*i].iov_base = pfxs[i];
+	iov[3*i].iov_len = strlen(pfxs[i]);
+	iov[3*i+1].iov_base = recs[i]->text;
+	iov[3*i+1].iov_len = recs[i]->len;
+	iov[3*i+2].iov_base = (void *)"\n";
+	iov[3*i+2].iov_len = 1;
+    }
+    if (writev(STDERR_FILENO, iov, (int)(3 * num)) < 0) return;
+}
+
+/* main function of the logger thread, writes queued records in batches */
+static void *
+loggerMain(void *data)
+{
+    LogRecord *batch[LOG_BATCH];
+    LogRecord report;
+    LogRecord *rec;
+    unsigned long lost;
+    uint64_t count;
+    size_t i, n;
+
+    (void)data; /* unused */
+
+    for (;;)
+    {
+	/* take the records ready, in order */
+	for (n = 0; n < LOG_BATCH; ++n)
+	{
+	    rec = &(ring[(head + n) & ringMask]);
+	    if (__atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE) != head + n + 1)
+	    {
+		break;
+	    }
+	    batch[n] = rec;
+	}
+
+	if (n)
+	{
+	    logwrite(batch, n);
+
+	    /* free the records for the next round of the ring */
+	    for (i = 0; i < n; ++i)
+	    {
+		if (batch[i]->text != batch[i]->msg) free(batch[i]->text);
+		__atomic_store_n(&(batch[i]->seq), head + i + ringMask + 1,
+			__ATOMIC_RELEASE);
+	    }
+	    head += n;
+	    continue;
+	}
+
+	if ((lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED)))
+	{
+	    report.time = time(NULL);
+	    report.level = LOG_WARNING;
+	    snprintf(report.msg, LOG_MSG_INLINE, "Dropped %lu log messages, "
+		    "the log queue was full.", lost);
+	    report.text = report.msg;
+	    report.len = strlen(report.msg);
+	    rec = &report;
+	    logwrite(&rec, 1);
+	}
+
+	/* only exit when everything is written */
+	if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) break;
+
+	/* announce waiting before checking once again, a writer checks the
+	 * flag after its record is ready */
+	__atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+	rec = &(ring[head & ringMask]);
+	if (__atomic_load_n(&(rec->seq), __ATOMIC_SEQ_CST) == head + 1
+		|| __atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+	{
+	    __atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+	    continue;
+	}
+	if (read(evfd, &count, sizeof(count)) < 0 && errno != EINTR) break;
+    }
+    return NULL;
+}
+
+/* put a message in the log queue, returns 1 if it was queued or dropped, 0
+ * if it must be logged directly */
+static int
+logqueue(int level, const char *message_fmt, va_list ap)
+{
+    LogRecord *rec;
+    size_t pos, seq;
+    uint64_t one = 1;
+    va_list again;
+    int len;
+
+    if (!__atomic_load_n(&queueing, __ATOMIC_ACQUIRE)) return 0;
+
+    /* claim the next position, unless its record wasn't read yet */
+    pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+	rec = &(ring[pos & ringMask]);
+	seq = __atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE);
+	if (seq == pos)
+	{
+	    if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    {
+		break;
+	    }
+	}
+	else if ((ptrdiff_t)(seq - pos) < 0)
+	{
+	    /* full, the logger thread can't keep up */
+	    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+	    return 1;
+	}
+	else pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    }
+
+    rec->time = time(NULL);
+    rec->level = level;
+    rec->text = rec->msg;
+    va_copy(again, ap);
+    len = vsnprintf(rec->msg, LOG_MSG_INLINE, message_fmt, ap);
+    if (len < 0)
+    {
+	len = 0;
+	rec->msg[0] = '\0';
+    }
+    else if ((size_t)len >= LOG_MSG_INLINE)
+    {
+	/* doesn't fit, freed by the logger thread */
+	rec->text = lladAlloc((size_t)len + 1);
+	vsnprintf(rec->text, (size_t)len + 1, message_fmt, again);
+    }
+    va_end(again);
+    rec->len = (size_t)len;
+    __atomic_store_n(&(rec->seq), pos + 1, __ATOMIC_SEQ_CST);
+
+    /* wake up the logger thread if it waits */
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST)
+	    && __atomic_exchange_n(&sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+	if (write(evfd, &one, sizeof(one)) < 0) return 1;
+    }
+    return 1;
+}
+
+/* queue a formatted message, see logqueue() */
+static int
+logqueuef(int level, const char *message_fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int
+logqueuef(int level, const char *message_fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, message_fmt);
+    rc = logqueue(level, message_fmt, ap);
+    va_end(ap);
+    return rc;
+}
+
+/* stop the logger thread after everything queued was written */
+static void
+stoplogger(void)
+{
+    uint64_t one = 1;
+
+    if (!loggerStarted) return;
+    loggerStarted = 0;
+
+    /* messages logged from now on are written directly */
+    __atomic_store_n(&queueing, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+    if (write(evfd, &one, sizeof(one)) < 0)
+    {
+	Daemon_perror("Daemon write()");
+    }
+    pthread_join(logger, NULL);
+
+    close(evfd);
+    evfd = -1;
+    if (logsock >= 0) close(logsock);
+    logsock = -1;
+    free(ring);
+    ring = NULL;
+    if (dropped)
+    {
+	Daemon_printf_level(LEVEL_WARNING, "Dropped %lu log messages, the "
+		"log queue was full.", dropped);
+    }
+}
+
+/* a forked process has no logger thread, it logs directly */
+static void
+forkedChild(void)
+{
+    queueing = 0;
+    loggerStarted = 0;
+}
+
+void
+Daemon_startLogger(void)
+{
+    sigset_t all, old;
+    size_t size, i;
+    static int registered = 0;
+
+    if (logQueue <= 0 || loggerStarted) return;
+    if (logQueue > 1024 * 1024) logQueue = 1024 * 1024;
+
+    /* a power of two, so positions map to records by masking */
+    size = 1;
+    while (size < (size_t)logQueue) size <<= 1;
+    ring = lladAlloc(size * sizeof(LogRecord));
+    for (i = 0; i < size; ++i) ring[i].seq = i;
+    ringMask = size - 1;
+    tail = 0;
+    head = 0;
+    dropped = 0;
+    stopping = 0;
+    sleeping = 0;
+
+    if ((evfd = eventfd(0, EFD_CLOEXEC)) < 0)
+    {
+	Daemon_perror("eventfd()");
+	free(ring);
+	ring = NULL;
+	return;
+    }
+
+    /* the same pid syslog() would give */
+    logpid = getpid();
+    if (logfacility) logconnect();
+
+    /* the daemon handles signals in its main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    errno = pthread_create(&logger, NULL, &loggerMain, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (errno)
+    {
+	Daemon_perror("pthread_create()");
+	close(evfd);
+	evfd = -1;
+	if (logsock >= 0) close(logsock);
+	logsock = -1;
+	free(ring);
+	ring = NULL;
+	return;
+    }
+
+    loggerStarted = 1;
+    __atomic_store_n(&queueing, 1, __ATOMIC_SEQ_CST);
+
+    /* write what is queued even when exiting because of an error */
+    if (!registered)
+    {
+	registered = 1;
+	pthread_atfork(NULL, NULL, &forkedChild);
+	atexit(&stoplogger);
+    }
+}
+
 const char *
 level_str(const Level *l)
 {
@@ -106,6 +521,7 @@ void
 Daemon_perror(const char *message)
 {
     if (loglevel < LOG_ERR) return;
+    if (logqueuef(LOG_ERR, "%s: %s", message, strerror(errno))) return;
     if (logfacility)
     {
 	syslog(logfacility | LOG_ERR, "%s: %s", message, strerror(errno));
@@ -120,6 +536,7 @@ void
 Daemon_print_level(const Level *level, const char *message)
 {
     if (level_int(level) > loglevel) return;
+    if (logqueuef(level_int(level), "%s", message)) return;
     if (logfacility)
     {
 	syslog(logfacility | level_int(level), "%s", message);
@@ -135,6 +552,7 @@ void
 Daemon_vprintf_level(const Level *level, const char *message_fmt, va_list ap)
 {
     if (level_int(level) > loglevel) return;
+    if (logqueue(level_int(level), message_fmt, ap)) return;
     if (logfacility)
     {
 	vsyslog(logfacility | level_int(level), message_fmt, ap);
@@ -346,8 +764,9 @@ Daemon_daemonize(const daemon_loop daemon_main, void *data)
 	}
     }
 
-    /* execute main daemon code */
+    /* execute main daemon code, it may start the logger thread */
     rc = daemon_main(data);
+    stoplogger();
 
     /* and on exit, remove pidfile */
     if (!nodetach && pfn) unlink(pfn);
@@ -120,6 +120,19 @@ void Daemon_init(const char *name);
  */
 int Daemon_daemonize(const daemon_loop daemon_main, void *data);
 
+/** Start writing log messages from a thread of its own.
+ * Afterwards, messages are put in a lock-free queue and written in batches
+ * by a logger thread, so logging never waits for a slow syslog daemon. If
+ * the queue is full, messages are dropped and the number of dropped
+ * messages is logged later. Messages are sent to the syslog daemon
+ * formatted like syslog() does, with the same pid. The logger thread is
+ * stopped when the daemon main routine returns or the process exits, after
+ * writing everything queued. A forked child process logs directly.
+ * @memberof Daemon
+ * @static
+ */
+void Daemon_startLogger(void);
+
 /** Print message with standard log level.
  * @memberof Daemon
  * @static
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include "eventloop.h"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "daemon.h"
+#include "util.h"
+
+/* maximum number of events handled per epoll_wait() */
+#define MAX_EVENTS 64
+
+/* number of signals that can be handled */
+#define MAX_SIGNALS 65
+
+/* information about a registered file descriptor */
+struct fdWatch;
+typedef struct fdWatch FdWatch;
+
+struct fdWatch
+{
+    EventLoop_fdHandler handler;    /* handler for events */
+    void *data;			    /* data for the handler */
+    FdWatch *next;		    /* next in list of removed watches */
+    int fd;			    /* the file descriptor */
+    int removed;		    /* flag, unregistered while handling */
+};
+
+struct timer
+{
+    EventLoop_timerHandler handler; /* handler for expiry */
+    void *data;			    /* data for the handler */
+    long long due;		    /* expiry time (ms, monotonic) */
+    size_t index;		    /* position in the timer heap */
+};
+
+/* information about a handled signal */
+struct signalHandling
+{
+    EventLoop_signalHandler handler;	/* handler for the signal */
+    void *data;				/* data for the handler */
+};
+
+static int epfd = -1;			/* epoll file descriptor */
+static int tfd = -1;			/* timerfd for all Timers */
+static int sfd = -1;			/* signalfd for all signals */
+static int running = 0;			/* flag, EventLoop_run() continues */
+
+static FdWatch **watches = NULL;	/* registered watches, indexed by fd */
+static int nwatches = 0;		/* size of watches */
+static FdWatch *removedWatches = NULL;	/* removed, but not yet freed */
+
+static Timer **heap = NULL;		/* binary min-heap of Timers by due */
+static size_t heapsize = 0;		/* capacity of heap */
+static size_t ntimers = 0;		/* number of Timers in heap */
+static long long armed = -1;		/* time tfd is armed for, -1 if not */
+
+static sigset_t sigmask;		/* signals handled through sfd */
+static struct signalHandling signals[MAX_SIGNALS];
+
+long long
+EventLoop_now(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) return 0;
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* helpers for the timer heap */
+static void
+heapSwap(size_t a, size_t b)
+{
+    Timer *tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->index = a;
+    heap[b]->index = b;
+}
+
+static void
+heapUp(size_t i)
+{
+    while (i > 0 && heap[(i-1)/2]->due > heap[i]->due)
+    {
+	heapSwap(i, (i-1)/2);
+	i = (i-1)/2;
+    }
+}
+
+static void
+heapDown(size_t i)
+{
+    size_t smallest;
+
+    for (;;)
+    {
+	smallest = i;
+	if (2*i+1 < ntimers && heap[2*i+1]->due < heap[smallest]->due)
+	{
+	    smallest = 2*i+1;
+	}
+	if (2*i+2 < ntimers && heap[2*i+2]->due < heap[smallest]->due)
+	{
+	    smallest = 2*i+2;
+	}
+	if (smallest == i) break;
+	heapSwap(i, smallest);
+	i = smallest;
+    }
+}
+
+static void
+heapRemove(Timer *timer)
+{
+    size_t i = timer->index;
+
+    --ntimers;
+    if (i == ntimers) return;
+    heap[i] = heap[ntimers];
+    heap[i]->index = i;
+    heapUp(i);
+    heapDown(heap[i]->index);
+}
+
+/* arm timerfd for the earliest Timer, if it changed */
+static void
+armTimer(void)
+{
+    struct itimerspec its;
+    long long due = ntimers ? heap[0]->due : -1;
+
+    if (due == armed) return;
+    armed = due;
+
+    memset(&its, 0, sizeof(its));
+    if (due >= 0)
+    {
+	/* 0 would disarm the timer, so use at least 1 ns */
+	its.it_value.tv_sec = due / 1000;
+	its.it_value.tv_nsec = (due % 1000) * 1000000 + 1;
+    }
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+    {
+	Daemon_perror("timerfd_settime()");
+    }
+}
+
+/* handle expiry of the timerfd, call handlers of all expired Timers */
+static void
+timerExpired(void *data, uint32_t events)
+{
+    uint64_t expirations;
+    long long now;
+    Timer *timer;
+
+    (void)data;
+    (void)events;
+
+    if (read(tfd, &expirations, sizeof(expirations)) < 0
+	    && errno != EAGAIN)
+    {
+	Daemon_perror("timerfd read()");
+    }
+    armed = -1;
+
+    now = EventLoop_now();
+    while (ntimers && heap[0]->due <= now)
+    {
+	timer = heap[0];
+	heapRemove(timer);
+	timer->handler(timer->data);
+	free(timer);
+    }
+
+    armTimer();
+}
+
+/* handle signals received on the signalfd */
+static void
+signalReceived(void *data, uint32_t events)
+{
+    struct signalfd_siginfo si;
+    int signum;
+
+    (void)data;
+    (void)events;
+
+    while (read(sfd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+    {
+	signum = (int)si.ssi_signo;
+	if (signum > 0 && signum < MAX_SIGNALS && signals[signum].handler)
+	{
+	    signals[signum].handler(signals[signum].data, signum);
+	}
+    }
+}
+
+int
+EventLoop_init(void)
+{
+    if (epfd >= 0) EventLoop_done();
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+	Daemon_perror("epoll_create1()");
+	return 0;
+    }
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0)
+    {
+	Daemon_perror("timerfd_create()");
+	close(epfd);
+	epfd = -1;
+	return 0;
+    }
+    armed = -1;
+    EventLoop_addFd(tfd, EPOLLIN, &timerExpired, NULL);
+
+    sigemptyset(&sigmask);
+    memset(signals, 0, sizeof(signals));
+    sfd = -1;
+
+    return 1;
+}
+
+void
+EventLoop_done(void)
+{
+    int i;
+    FdWatch *w;
+
+    if (epfd < 0) return;
+
+    for (i = 1; i < MAX_SIGNALS; ++i)
+    {
+	if (signals[i].handler) EventLoop_removeSignal(i);
+    }
+    if (sfd >= 0) close(sfd);
+    sfd = -1;
+
+    for (i = 0; i < nwatches; ++i) free(watches[i]);
+    free(watches);
+    watches = NULL;
+    nwatches = 0;
+    while (removedWatches)
+    {
+	w = removedWatches;
+	removedWatches = w->next;
+	free(w);
+    }
+
+    while (ntimers) free(heap[--ntimers]);
+    free(heap);
+    heap = NULL;
+    heapsize = 0;
+
+    close(tfd);
+    tfd = -1;
+    close(epfd);
+    epfd = -1;
+}
+
+int
+EventLoop_addFd(int fd, uint32_t events,
+	EventLoop_fdHandler handler, void *data)
+{
+    struct epoll_event ev;
+    FdWatch *w;
+    int newsize;
+
+    if (fd < 0) return 0;
+
+    if (fd >= nwatches)
+    {
+	/* grow table of watches to include fd */
+	newsize = nwatches ? nwatches : 64;
+	while (newsize <= fd) newsize *= 2;
+	watches = lladRealloc(watches, (size_t)newsize * sizeof(FdWatch *));
+	memset(watches + nwatches, 0,
+		(size_t)(newsize - nwatches) * sizeof(FdWatch *));
+	nwatches = newsize;
+    }
+
+    w = lladAlloc(sizeof(FdWatch));
+    w->handler = handler;
+    w->data = data;
+    w->next = NULL;
+    w->fd = fd;
+    w->removed = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = w;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+	Daemon_perror("epoll_ctl()");
+	free(w);
+	return 0;
+    }
+
+    watches[fd] = w;
+    return 1;
+}
+
+int
+EventLoop_modFd(int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    if (fd < 0 || fd >= nwatches || !watches[fd]) return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = watches[fd];
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+	Daemon_perror("epoll_ctl()");
+	return 0;
+    }
+    return 1;
+}
+
+void
+EventLoop_removeFd(int fd)
+{
+    FdWatch *w;
+
+    if (fd < 0 || fd >= nwatches || !(w = watches[fd])) return;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    watches[fd] = NULL;
+
+    /* events for this watch could still be pending in the current batch,
+     * so only free it after handling the batch */
+    w->removed = 1;
+    w->next = removedWatches;
+    removedWatches = w;
+}
+
+int
+EventLoop_addSignal(int signum,
+	EventLoop_signalHandler handler, void *data)
+{
+    struct sigaction sa;
+
+    if (signum <= 0 || signum >= MAX_SIGNALS) return 0;
+
+    /* block the signal, so it is only received through the signalfd */
+    sigaddset(&sigmask, signum);
+    sigprocmask(SIG_BLOCK, &sigmask, NULL);
+
+    if (sfd < 0)
+    {
+	sfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sfd < 0)
+	{
+	    Daemon_perror("signalfd()");
+	    return 0;
+	}
+	EventLoop_addFd(sfd, EPOLLIN, &signalReceived, NULL);
+    }
+    else if (signalfd(sfd, &sigmask, 0) < 0)
+    {
+	Daemon_perror("signalfd()");
+	return 0;
+    }
+
+    signals[signum].handler = handler;
+    signals[signum].data = data;
+
+    /* default disposition, so child processes don't inherit an ignored
+     * signal. It's blocked, so this doesn't affect us. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&(sa.sa_mask));
+    sigaction(signum, &sa, NULL);
+
+    return 1;
+}
+
+void
+EventLoop_removeSignal(int signum)
+{
+    struct sigaction sa;
+    sigset_t set;
+
+    if (signum <= 0 || signum >= MAX_SIGNALS || !signals[signum].handler)
+    {
+	return;
+    }
+
+    signals[signum].handler = NULL;
+    signals[signum].data = NULL;
+
+    /* ignore the signal before unblocking it */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&(sa.sa_mask));
+    sigaction(signum, &sa, NULL);
+
+    sigdelset(&sigmask, signum);
+    if (sfd >= 0) signalfd(sfd, &sigmask, 0);
+    sigemptyset(&set);
+    sigaddset(&set, signum);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+Timer *
+EventLoop_addTimer(long long ms, EventLoop_timerHandler handler, void *data)
+{
+    Timer *timer;
+
+    if (ntimers == heapsize)
+    {
+	heapsize = heapsize ? 2 * heapsize : 16;
+	heap = lladRealloc(heap, heapsize * sizeof(Timer *));
+    }
+
+    timer = lladAlloc(sizeof(Timer));
+    timer->handler = handler;
+    timer->data = data;
+    timer->due = EventLoop_now() + (ms > 0 ? ms : 0);
+    timer->index = ntimers;
+    heap[ntimers++] = timer;
+    heapUp(timer->index);
+
+    armTimer();
+    return timer;
+}
+
+void
+EventLoop_cancelTimer(Timer *timer)
+{
+    if (!timer) return;
+    heapRemove(timer);
+    free(timer);
+    armTimer();
+}
+
+int
+EventLoop_run(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+    FdWatch *w;
+    int n, i;
+
+    running = 1;
+    while (running)
+    {
+	n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+	if (n < 0)
+	{
+	    if (errno == EINTR) continue;
+	    Daemon_perror("epoll_wait()");
+	    return 0;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+	    w = events[i].data.ptr;
+	    if (!w->removed) w->handler(w->data, events[i].events);
+	}
+
+	/* now it's safe to free removed watches */
+	while (removedWatches)
+	{
+	    w = removedWatches;
+	    removedWatches = w->next;
+	    free(w);
+	}
+    }
+
+    return 1;
+}
+
+void
+EventLoop_stop(void)
+{
+    running = 0;
+}
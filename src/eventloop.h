@@ -0,0 +1,150 @@
+#ifndef LLAD_EVENTLOOP_H
+#define LLAD_EVENTLOOP_H
+
+/** class EventLoop
+ * @file
+ */
+
+/** Static class for a single-threaded event loop.
+ * This implementation uses the Linux epoll API. It multiplexes events on file
+ * descriptors, signals (received through a signalfd) and timers (all driven
+ * by a single timerfd armed for the earliest deadline). Handlers are called
+ * from EventLoop_run(), so no locking is needed between them.
+ * @class EventLoop "eventloop.h"
+ */
+
+#include <stdint.h>
+
+struct timer;
+
+/** Class representing a timer registered with the EventLoop.
+ * @class Timer "eventloop.h"
+ */
+typedef struct timer Timer;
+
+/** Handler for events on a file descriptor.
+ * @memberof EventLoop
+ * @param data the data given when registering the file descriptor
+ * @param events the epoll events that occured
+ */
+typedef void (*EventLoop_fdHandler)(void *data, uint32_t events);
+
+/** Handler for an expired Timer.
+ * The Timer is destroyed automatically after the handler returns, so the
+ * handler must not cancel it.
+ * @memberof EventLoop
+ * @param data the data given when adding the Timer
+ */
+typedef void (*EventLoop_timerHandler)(void *data);
+
+/** Handler for a received signal.
+ * @memberof EventLoop
+ * @param data the data given when registering the signal
+ * @param signum the number of the received signal
+ */
+typedef void (*EventLoop_signalHandler)(void *data, int signum);
+
+/** Initialize the EventLoop.
+ * @memberof EventLoop
+ * @static
+ * @returns 1 on success, 0 on error
+ */
+int EventLoop_init(void);
+
+/** Destroy the EventLoop.
+ * All remaining registrations and Timers are dropped and all signals are
+ * set back to being ignored.
+ * @memberof EventLoop
+ * @static
+ */
+void EventLoop_done(void);
+
+/** Register a file descriptor.
+ * @memberof EventLoop
+ * @static
+ * @param fd the file descriptor to watch
+ * @param events the epoll events to watch for
+ * @param handler called when any of the events occur
+ * @param data passed to the handler
+ * @returns 1 on success, 0 on error
+ */
+int EventLoop_addFd(int fd, uint32_t events,
+	EventLoop_fdHandler handler, void *data);
+
+/** Change the events to watch for on a registered file descriptor.
+ * @memberof EventLoop
+ * @static
+ * @param fd the registered file descriptor
+ * @param events the epoll events to watch for
+ * @returns 1 on success, 0 on error
+ */
+int EventLoop_modFd(int fd, uint32_t events);
+
+/** Unregister a file descriptor.
+ * This must be done before closing it. It's safe to do this from any handler.
+ * @memberof EventLoop
+ * @static
+ * @param fd the registered file descriptor
+ */
+void EventLoop_removeFd(int fd);
+
+/** Handle a signal in the EventLoop.
+ * The signal is blocked and received through a signalfd instead.
+ * @memberof EventLoop
+ * @static
+ * @param signum the signal to handle
+ * @param handler called when the signal is received
+ * @param data passed to the handler
+ * @returns 1 on success, 0 on error
+ */
+int EventLoop_addSignal(int signum,
+	EventLoop_signalHandler handler, void *data);
+
+/** Stop handling a signal, it is ignored afterwards.
+ * @memberof EventLoop
+ * @static
+ * @param signum the signal
+ */
+void EventLoop_removeSignal(int signum);
+
+/** Add a Timer.
+ * @memberof EventLoop
+ * @static
+ * @param ms time until the Timer expires, in milliseconds
+ * @param handler called when the Timer expires
+ * @param data passed to the handler
+ * @returns the new Timer
+ */
+Timer *EventLoop_addTimer(long long ms,
+	EventLoop_timerHandler handler, void *data);
+
+/** Cancel and destroy a Timer that didn't expire yet.
+ * @memberof EventLoop
+ * @static
+ * @param timer the Timer
+ */
+void EventLoop_cancelTimer(Timer *timer);
+
+/** Current monotonic time.
+ * @memberof EventLoop
+ * @static
+ * @returns current time in milliseconds
+ */
+long long EventLoop_now(void);
+
+/** Run the EventLoop.
+ * Handlers are called as events occur until EventLoop_stop() is called.
+ * @memberof EventLoop
+ * @static
+ * @returns 1 when stopped normally, 0 on error
+ */
+int EventLoop_run(void);
+
+/** Stop the EventLoop.
+ * EventLoop_run() returns after all currently pending events were handled.
+ * @memberof EventLoop
+ * @static
+ */
+void EventLoop_stop(void);
+
+#endif
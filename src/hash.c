@@ -0,0 +1,158 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+
+/* initial number of buckets, must be a power of 2 */
+#define INITIAL_BUCKETS 16
+
+/* an entry of the table, followed by the key */
+struct hashEntry;
+typedef struct hashEntry HashEntry;
+
+struct hashEntry
+{
+    HashEntry *next;	/* next entry in the same bucket */
+    void *value;	/* the value */
+    uint64_t hash;	/* hash of the key */
+    size_t len;		/* length of the key */
+    char key[];		/* the key */
+};
+
+struct hashTable
+{
+    HashEntry **buckets;    /* chains of entries */
+    size_t numBuckets;	    /* number of buckets, a power of 2 */
+    size_t count;	    /* number of entries */
+};
+
+HashTable *
+HashTable_new(void)
+{
+    HashTable *self = lladAlloc(sizeof(HashTable));
+    self->numBuckets = INITIAL_BUCKETS;
+    self->buckets = lladAlloc(self->numBuckets * sizeof(HashEntry *));
+    memset(self->buckets, 0, self->numBuckets * sizeof(HashEntry *));
+    self->count = 0;
+    return self;
+}
+
+/* find the link pointing to the entry for a key, or to the end of its
+ * bucket */
+static HashEntry **
+findEntry(const HashTable *self, const void *key, size_t len, uint64_t hash)
+{
+    HashEntry **curr = &(self->buckets[hash & (self->numBuckets - 1)]);
+
+    while (*curr && ((*curr)->hash != hash || (*curr)->len != len
+		|| memcmp((*curr)->key, key, len)))
+    {
+	curr = &((*curr)->next);
+    }
+    return curr;
+}
+
+/* double the number of buckets and redistribute the entries */
+static void
+grow(HashTable *self)
+{
+    HashEntry **buckets;
+    HashEntry *curr, *next;
+    size_t i, numBuckets = 2 * self->numBuckets;
+
+    buckets = lladAlloc(numBuckets * sizeof(HashEntry *));
+    memset(buckets, 0, numBuckets * sizeof(HashEntry *));
+
+    for (i = 0; i < self->numBuckets; ++i)
+    {
+	for (curr = self->buckets[i]; curr; curr = next)
+	{
+	    next = curr->next;
+	    curr->next = buckets[curr->hash & (numBuckets - 1)];
+	    buckets[curr->hash & (numBuckets - 1)] = curr;
+	}
+    }
+
+    free(self->buckets);
+    self->buckets = buckets;
+    self->numBuckets = numBuckets;
+}
+
+void *
+hashTable_get(const HashTable *self, const void *key, size_t len)
+{
+    HashEntry *entry = *findEntry(self, key, len, lladHash(key, len));
+    return entry ? entry->value : NULL;
+}
+
+void *
+hashTable_put(HashTable *self, const void *key, size_t len, void *value)
+{
+    uint64_t hash = lladHash(key, len);
+    HashEntry **link = findEntry(self, key, len, hash);
+    HashEntry *entry = *link;
+    void *old;
+
+    if (entry)
+    {
+	/* key exists, just replace the value */
+	old = entry->value;
+	entry->value = value;
+	return old;
+    }
+
+    entry = lladAlloc(sizeof(HashEntry) + len);
+    entry->next = NULL;
+    entry->value = value;
+    entry->hash = hash;
+    entry->len = len;
+    memcpy(entry->key, key, len);
+    *link = entry;
+
+    /* keep chains short */
+    if (++self->count > self->numBuckets) grow(self);
+    return NULL;
+}
+
+void *
+hashTable_remove(HashTable *self, const void *key, size_t len)
+{
+    HashEntry **link = findEntry(self, key, len, lladHash(key, len));
+    HashEntry *entry = *link;
+    void *value;
+
+    if (!entry) return NULL;
+
+    *link = entry->next;
+    value = entry->value;
+    free(entry);
+    --self->count;
+    return value;
+}
+
+size_t
+hashTable_count(const HashTable *self)
+{
+    return self->count;
+}
+
+void
+hashTable_free(HashTable *self)
+{
+    HashEntry *curr, *next;
+    size_t i;
+
+    if (!self) return;
+    for (i = 0; i < self->numBuckets; ++i)
+    {
+	for (curr = self->buckets[i]; curr; curr = next)
+	{
+	    next = curr->next;
+	    free(curr);
+	}
+    }
+    free(self->buckets);
+    free(self);
+}
@@ -0,0 +1,72 @@
+#ifndef LLAD_HASH_H
+#define LLAD_HASH_H
+
+/** class HashTable
+ * @file
+ */
+
+#include <stddef.h>
+
+struct hashTable;
+
+/** Class for a hash table mapping keys to pointers.
+ * Keys are arbitrary byte strings and are copied into the table. Collisions
+ * are chained, and the number of buckets doubles whenever there are more
+ * entries than buckets, so lookups take constant time on average no matter
+ * how many entries there are.
+ * @class HashTable "hash.h"
+ */
+typedef struct hashTable HashTable;
+
+/** Create an empty HashTable.
+ * This works as a constructor.
+ * @memberof HashTable
+ * @static
+ * @returns the new HashTable
+ */
+HashTable *HashTable_new(void);
+
+/** Look up the value for a key.
+ * @memberof HashTable
+ * @param self the HashTable
+ * @param key the key
+ * @param len the length of the key
+ * @returns the value, or NULL if the key is not in the HashTable
+ */
+void *hashTable_get(const HashTable *self, const void *key, size_t len);
+
+/** Set the value for a key.
+ * @memberof HashTable
+ * @param self the HashTable
+ * @param key the key
+ * @param len the length of the key
+ * @param value the value, must not be NULL
+ * @returns the previous value for the key, or NULL if there was none
+ */
+void *hashTable_put(HashTable *self, const void *key, size_t len,
+	void *value);
+
+/** Remove a key.
+ * @memberof HashTable
+ * @param self the HashTable
+ * @param key the key
+ * @param len the length of the key
+ * @returns the value removed, or NULL if the key was not in the HashTable
+ */
+void *hashTable_remove(HashTable *self, const void *key, size_t len);
+
+/** Get the number of entries in a HashTable.
+ * @memberof HashTable
+ * @param self the HashTable
+ * @returns the number of entries
+ */
+size_t hashTable_count(const HashTable *self);
+
+/** Destructor for HashTable.
+ * The values are not freed.
+ * @memberof HashTable
+ * @param self the HashTable, may be NULL
+ */
+void hashTable_free(HashTable *self);
+
+#endif
@@ -0,0 +1,1409 @@
+#include "lazydfa.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "daemon.h"
+#include "util.h"
+
+/* number of possible byte values */
+#define NUM_BYTES 256
+
+/* maximum number of NFA nodes for a top-level alternative of a pattern,
+ * larger ones (typically because of big counted repetitions) aren't
+ * supported */
+#define MAX_PATTERN_NODES 10000
+
+/* maximum count in a counted repetition */
+#define MAX_REPEAT 1000
+
+/* memory for cached DFA states per LazyDfa, the cache is cleared when this
+ * is exceeded */
+#define DFA_CACHE_SIZE (4 * 1024 * 1024)
+
+/* number of hash buckets for looking up DFA states, must be a power of 2 */
+#define NUM_BUCKETS 1024
+
+/* a set of bytes */
+typedef struct byteSet
+{
+    unsigned char bits[NUM_BYTES / 8];
+} ByteSet;
+
+/* types of nodes of a parsed pattern */
+typedef enum nodeType
+{
+    NT_EMPTY,		/* matches the empty string */
+    NT_SET,		/* matches one byte of a set */
+    NT_CAT,		/* concatenation of children */
+    NT_ALT,		/* alternative of children */
+    NT_REPEAT		/* repetition of the child */
+} NodeType;
+
+/* node of a parsed pattern */
+struct node;
+typedef struct node Node;
+
+struct node
+{
+    Node *child;	/* first child of NT_CAT, NT_ALT and NT_REPEAT */
+    Node *next;		/* next child of the parent */
+    NodeType type;	/* type of the node */
+    int set;		/* byte set of NT_SET */
+    int min;		/* minimum count of NT_REPEAT */
+    int max;		/* maximum count of NT_REPEAT, -1 for no limit */
+};
+
+/* state for parsing a pattern */
+typedef struct parser
+{
+    LazyDfa *dfa;	/* LazyDfa receiving the byte sets */
+    const char *p;	/* current position in the pattern */
+    int bad;		/* flag, pattern is not supported */
+    int endOnly;	/* flag, alternative ends with $ */
+} Parser;
+
+/* results of parsing an escape sequence */
+typedef enum escResult
+{
+    ESC_SET,		/* matches one byte of a set */
+    ESC_EMPTY,		/* assertion, treated as matching the empty string */
+    ESC_ANY,		/* back reference, treated as matching anything */
+    ESC_BAD		/* not supported */
+} EscResult;
+
+/* types of NFA nodes */
+typedef enum nfaType
+{
+    NN_SET,		/* consume a byte of a set and continue at out */
+    NN_SPLIT,		/* continue at out and out1 */
+    NN_MATCH		/* a pattern matched */
+} NfaType;
+
+/* node of the NFA */
+typedef struct nfaNode
+{
+    NfaType type;	/* type of the node */
+    int out;		/* next node */
+    int out1;		/* other next node of NN_SPLIT */
+    int arg;		/* byte set of NN_SET, pattern id of NN_MATCH */
+    int endOnly;	/* flag, NN_MATCH only counts at the end of a line */
+    unsigned mark;	/* generation this node was last added to a set */
+} NfaNode;
+
+/* a cached DFA state, which is a set of NFA nodes */
+struct dfaState;
+typedef struct dfaState DfaState;
+
+struct dfaState
+{
+    DfaState *hnext;	/* next state in the same hash bucket */
+    DfaState **trans;	/* next state per byte class, NULL if unknown */
+    int *nodes;		/* sorted NN_SET and NN_MATCH nodes */
+    int *matches;	/* patterns matching in this state */
+    int *endMatches;	/* patterns matching at the end of a line */
+    uint64_t hash;	/* hash of nodes */
+    int numNodes;	/* number of nodes */
+    int numMatches;	/* number of matches */
+    int numEndMatches;	/* number of endMatches */
+};
+
+struct lazyDfa
+{
+    NfaNode *nfa;	/* nodes of the NFA */
+    ByteSet *sets;	/* byte sets used by the NFA */
+    int *anchored;	/* start nodes only tried at the beginning of a line */
+    int *search;	/* start nodes tried at every position */
+    int *work;		/* node set while computing a state */
+    int *stack;		/* stack for following NN_SPLIT nodes */
+    DfaState **buckets;	/* hash buckets of cached DFA states */
+    DfaState *start;	/* state at the beginning of a line, NULL if not
+			 * cached */
+    pthread_mutex_t lock;   /* serializes scans, they modify the cache */
+    size_t memory;	/* memory used by cached states */
+    unsigned long resets;   /* number of times the cache was cleared */
+    unsigned gen;	/* current generation for marking nodes */
+    int numNfa;		/* number of NFA nodes */
+    int nfaSize;	/* allocated NFA nodes */
+    int numSets;	/* number of byte sets */
+    int numAnchored;	/* number of anchored start nodes */
+    int numSearch;	/* number of search start nodes */
+    int numPatterns;	/* number of patterns */
+    int numClasses;	/* number of byte classes */
+    unsigned char cls[NUM_BYTES];   /* byte class of each byte */
+    unsigned char rep[NUM_BYTES];   /* a byte of each byte class */
+};
+
+/* statistics of all LazyDfa objects, which may be scanned from different
+ * threads, so they are updated atomically */
+static unsigned long totalStates = 0;	/* DFA states built */
+static unsigned long totalResets = 0;	/* DFA caches cleared when full */
+
+static Node *parseAlt(Parser *ps);
+
+static void
+setClear(ByteSet *self)
+{
+    memset(self->bits, 0, sizeof(self->bits));
+}
+
+static void
+setAdd(ByteSet *self, int b)
+{
+    self->bits[b >> 3] = (unsigned char)(self->bits[b >> 3] | 1 << (b & 7));
+}
+
+static void
+setAddRange(ByteSet *self, int lo, int hi)
+{
+    for (; lo <= hi; ++lo) setAdd(self, lo);
+}
+
+static int
+setHas(const ByteSet *self, int b)
+{
+    return (self->bits[b >> 3] >> (b & 7)) & 1;
+}
+
+static void
+setInvert(ByteSet *self)
+{
+    size_t i;
+    for (i = 0; i < sizeof(self->bits); ++i)
+    {
+	self->bits[i] = (unsigned char)~self->bits[i];
+    }
+}
+
+static void
+setUnion(ByteSet *self, const ByteSet *other)
+{
+    size_t i;
+    for (i = 0; i < sizeof(self->bits); ++i)
+    {
+	self->bits[i] = (unsigned char)(self->bits[i] | other->bits[i]);
+    }
+}
+
+/* fill a set with all bytes matched by a class escape like \d */
+static void
+classEscape(ByteSet *self, int c)
+{
+    int b;
+
+    setClear(self);
+    switch (tolower(c))
+    {
+	case 'd':
+	    setAddRange(self, '0', '9');
+	    break;
+	case 'w':
+	    setAddRange(self, '0', '9');
+	    setAddRange(self, 'A', 'Z');
+	    setAddRange(self, 'a', 'z');
+	    setAdd(self, '_');
+	    break;
+	case 's':
+	    for (b = 0; b < NUM_BYTES; ++b) if (isspace(b)) setAdd(self, b);
+	    break;
+	case 'h':
+	    setAdd(self, ' ');
+	    setAdd(self, '\t');
+	    setAdd(self, 0xa0);
+	    break;
+	case 'v':
+	    setAddRange(self, '\n', '\r');
+	    setAdd(self, 0x85);
+	    break;
+    }
+
+    /* upper case escapes are negated */
+    if (isupper(c)) setInvert(self);
+}
+
+/* add a POSIX class like [:alpha:], ps->p points to the opening bracket.
+ * returns 0 if it isn't supported */
+static int
+parsePosix(Parser *ps, ByteSet *set)
+{
+    static const char *const names[] = {
+	"alnum", "alpha", "ascii", "blank", "cntrl", "digit", "graph",
+	"lower", "print", "punct", "space", "upper", "word", "xdigit", NULL
+    };
+    const char *p = ps->p + 2;
+    const char *end;
+    ByteSet cls;
+    int negate = 0;
+    int i, b, in;
+
+    if (ps->p[1] != ':') return 0;
+    if (*p == '^')
+    {
+	negate = 1;
+	++p;
+    }
+    if (!(end = strstr(p, ":]"))) return 0;
+
+    for (i = 0; names[i]; ++i)
+    {
+	if ((size_t)(end - p) == strlen(names[i])
+		&& !strncmp(p, names[i], (size_t)(end - p))) break;
+    }
+    if (!names[i]) return 0;
+
+    setClear(&cls);
+    for (b = 0; b < NUM_BYTES; ++b)
+    {
+	switch (i)
+	{
+	    case 0: in = isalnum(b); break;
+	    case 1: in = isalpha(b); break;
+	    case 2: in = b < 128; break;
+	    case 3: in = b == ' ' || b == '\t'; break;
+	    case 4: in = iscntrl(b); break;
+	    case 5: in = isdigit(b); break;
+	    case 6: in = isgraph(b); break;
+	    case 7: in = islower(b); break;
+	    case 8: in = isprint(b); break;
+	    case 9: in = ispunct(b); break;
+	    case 10: in = isspace(b); break;
+	    case 11: in = isupper(b); break;
+	    case 12: in = isalnum(b) || b == '_'; break;
+	    default: in = isxdigit(b); break;
+	}
+	if (in) setAdd(&cls, b);
+    }
+    if (negate) setInvert(&cls);
+    setUnion(set, &cls);
+
+    ps->p = end + 2;
+    return 1;
+}
+
+/* skip up to and including a given character */
+static const char *
+skipTo(const char *p, char c)
+{
+    while (*p && *p != c) ++p;
+    return *p ? p + 1 : p;
+}
+
+/* value of a hex digit */
+static int
+hexValue(char c)
+{
+    if (isdigit((unsigned char)c)) return c - '0';
+    return tolower((unsigned char)c) - 'a' + 10;
+}
+
+/* parse an escape sequence, ps->p points to the character after the
+ * backslash. For ESC_SET, ch receives the byte if it's a single one,
+ * otherwise -1 */
+static EscResult
+parseEscape(Parser *ps, ByteSet *set, int *ch, int inClass)
+{
+    const char *p = ps->p;
+    int c = (unsigned char)*p;
+    int i, v;
+
+    *ch = -1;
+    setClear(set);
+    if (!c) return ESC_BAD;
+    ++p;
+
+    if (!isalnum(c))
+    {
+	/* escaped special character */
+	v = c;
+    }
+    else switch (c)
+    {
+	case 'a': v = '\a'; break;
+	case 'e': v = 0x1b; break;
+	case 'f': v = '\f'; break;
+	case 'n': v = '\n'; break;
+	case 'r': v = '\r'; break;
+	case 't': v = '\t'; break;
+
+	case 'b':
+	    /* backspace in a class, word boundary otherwise */
+	    if (inClass)
+	    {
+		v = '\b';
+		break;
+	    }
+	    ps->p = p;
+	    return ESC_EMPTY;
+
+	case 'B':
+	case 'A':
+	case 'G':
+	case 'K':
+	case 'z':
+	case 'Z':
+	case 'E':
+	    /* assertions only restrict where a pattern matches */
+	    ps->p = p;
+	    return inClass ? ESC_BAD : ESC_EMPTY;
+
+	case 'd':
+	case 'D':
+	case 'w':
+	case 'W':
+	case 's':
+	case 'S':
+	case 'h':
+	case 'H':
+	case 'v':
+	case 'V':
+	    classEscape(set, c);
+	    ps->p = p;
+	    return ESC_SET;
+
+	case 'N':
+	    /* anything but a newline */
+	    if (inClass || *p == '{') return ESC_BAD;
+	    setAddRange(set, 0, NUM_BYTES - 1);
+	    setInvert(set);
+	    setAdd(set, '\n');
+	    setInvert(set);
+	    ps->p = p;
+	    return ESC_SET;
+
+	case 'x':
+	    v = 0;
+	    if (*p == '{')
+	    {
+		for (++p, i = 0; isxdigit((unsigned char)*p); ++p, ++i)
+		{
+		    v = v * 16 + hexValue(*p);
+		    if (v >= NUM_BYTES) return ESC_BAD;
+		}
+		if (*p != '}' || !i) return ESC_BAD;
+		++p;
+	    }
+	    else
+	    {
+		for (i = 0; i < 2 && isxdigit((unsigned char)*p); ++i, ++p)
+		{
+		    v = v * 16 + hexValue(*p);
+		}
+	    }
+	    break;
+
+	case 'o':
+	    if (*p != '{') return ESC_BAD;
+	    for (++p, v = 0, i = 0; *p >= '0' && *p <= '7'; ++p, ++i)
+	    {
+		v = v * 8 + (*p - '0');
+		if (v >= NUM_BYTES) return ESC_BAD;
+	    }
+	    if (*p != '}' || !i) return ESC_BAD;
+	    ++p;
+	    break;
+
+	case '0':
+	    for (v = 0, i = 0; i < 2 && *p >= '0' && *p <= '7'; ++i, ++p)
+	    {
+		v = v * 8 + (*p - '0');
+	    }
+	    break;
+
+	case 'c':
+	    /* control character */
+	    if (!*p || (unsigned char)*p > 127) return ESC_BAD;
+	    v = toupper((unsigned char)*p) ^ 0x40;
+	    ++p;
+	    break;
+
+	case 'g':
+	case 'k':
+	    /* back references by name or number */
+	    if (inClass) return ESC_BAD;
+	    if (*p == '{') p = skipTo(p, '}');
+	    else if (*p == '<') p = skipTo(p, '>');
+	    else if (*p == '\'') p = skipTo(p + 1, '\'');
+	    else
+	    {
+		if (*p == '-' || *p == '+') ++p;
+		while (isdigit((unsigned char)*p)) ++p;
+	    }
+	    ps->p = p;
+	    return ESC_ANY;
+
+	default:
+	    if (c >= '1' && c <= '9' && !inClass)
+	    {
+		/* back reference or octal character, either way it's covered
+		 * by matching anything */
+		while (isdigit((unsigned char)*p)) ++p;
+		ps->p = p;
+		return ESC_ANY;
+	    }
+	    return ESC_BAD;
+    }
+
+    setAdd(set, v);
+    *ch = v;
+    ps->p = p;
+    return ESC_SET;
+}
+
+/* allocate a node of a parsed pattern */
+static Node *
+newNode(NodeType type)
+{
+    Node *self = lladAlloc(sizeof(Node));
+    memset(self, 0, sizeof(Node));
+    self->type = type;
+    return self;
+}
+
+/* free a node of a parsed pattern, its children and following siblings */
+static void
+freeNode(Node *self)
+{
+    Node *next;
+
+    while (self)
+    {
+	next = self->next;
+	freeNode(self->child);
+	free(self);
+	self = next;
+    }
+}
+
+/* create a node matching one byte of a set */
+static Node *
+setNode(Parser *ps, const ByteSet *set)
+{
+    LazyDfa *dfa = ps->dfa;
+    Node *self = newNode(NT_SET);
+    int i;
+
+    /* use the same index for the same set */
+    for (i = 0; i < dfa->numSets; ++i)
+    {
+	if (!memcmp(&(dfa->sets[i]), set, sizeof(ByteSet))) break;
+    }
+    if (i == dfa->numSets)
+    {
+	dfa->sets = lladRealloc(dfa->sets,
+		(size_t)(dfa->numSets + 1) * sizeof(ByteSet));
+	dfa->sets[dfa->numSets++] = *set;
+    }
+
+    self->set = i;
+    return self;
+}
+
+/* create a node matching any string */
+static Node *
+anyNode(Parser *ps)
+{
+    Node *self = newNode(NT_REPEAT);
+    ByteSet set;
+
+    setClear(&set);
+    setInvert(&set);
+    self->child = setNode(ps, &set);
+    self->min = 0;
+    self->max = -1;
+    return self;
+}
+
+/* parse a character class, ps->p points to the opening bracket */
+static Node *
+parseClass(Parser *ps)
+{
+    ByteSet set, esc;
+    const char *p = ps->p + 1;
+    int negate = 0;
+    int first = 1;
+    int lo, hi;
+
+    setClear(&set);
+    if (*p == '^')
+    {
+	negate = 1;
+	++p;
+    }
+
+    /* a closing bracket right at the start is part of the class */
+    while (*p && (*p != ']' || first))
+    {
+	first = 0;
+	if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+	{
+	    ps->p = p;
+	    if (!parsePosix(ps, &set))
+	    {
+		ps->bad = 1;
+		return NULL;
+	    }
+	    p = ps->p;
+	    continue;
+	}
+
+	if (*p == '\\')
+	{
+	    ps->p = p + 1;
+	    if (parseEscape(ps, &esc, &lo, 1) != ESC_SET)
+	    {
+		ps->bad = 1;
+		return NULL;
+	    }
+	    p = ps->p;
+	    if (lo < 0)
+	    {
+		/* class escape like \d, can't start a range */
+		setUnion(&set, &esc);
+		continue;
+	    }
+	}
+	else
+	{
+	    lo = (unsigned char)*p++;
+	}
+
+	if (p[0] == '-' && p[1] && p[1] != ']')
+	{
+	    /* range */
+	    if (p[1] == '[')
+	    {
+		ps->bad = 1;
+		return NULL;
+	    }
+	    if (p[1] == '\\')
+	    {
+		ps->p = p + 2;
+		if (parseEscape(ps, &esc, &hi, 1) != ESC_SET || hi < 0)
+		{
+		    ps->bad = 1;
+		    return NULL;
+		}
+		p = ps->p;
+	    }
+	    else
+	    {
+		hi = (unsigned char)p[1];
+		p += 2;
+	    }
+	    if (hi < lo)
+	    {
+		ps->bad = 1;
+		return NULL;
+	    }
+	    setAddRange(&set, lo, hi);
+	}
+	else
+	{
+	    setAdd(&set, lo);
+	}
+    }
+
+    if (*p != ']')
+    {
+	ps->bad = 1;
+	return NULL;
+    }
+    ps->p = p + 1;
+
+    if (negate) setInvert(&set);
+    return setNode(ps, &set);
+}
+
+/* parse a group, ps->p points to the opening parenthesis */
+static Node *
+parseGroup(Parser *ps)
+{
+    const char *p = ps->p + 1;
+    int lookaround = 0;
+    Node *self;
+
+    if (*p == '?')
+    {
+	++p;
+	if (*p == '#')
+	{
+	    /* comment */
+	    ps->p = skipTo(p, ')');
+	    return newNode(NT_EMPTY);
+	}
+	else if (*p == ':' || *p == '>' || *p == '|')
+	{
+	    /* non-capturing, atomic and branch reset groups all match a
+	     * subset of the plain group */
+	    ++p;
+	}
+	else if (*p == '=' || *p == '!')
+	{
+	    ++p;
+	    lookaround = 1;
+	}
+	else if (*p == '<' && (p[1] == '=' || p[1] == '!'))
+	{
+	    p += 2;
+	    lookaround = 1;
+	}
+	else if (*p == 'P' && p[1] == '=')
+	{
+	    /* back reference by name */
+	    ps->p = skipTo(p, ')');
+	    return anyNode(ps);
+	}
+	else if (*p == 'P' && p[1] == '<') p = skipTo(p + 2, '>');
+	else if (*p == '<') p = skipTo(p + 1, '>');
+	else if (*p == '\'') p = skipTo(p + 1, '\'');
+	else
+	{
+	    /* options, conditions, recursion, ... */
+	    ps->bad = 1;
+	    return NULL;
+	}
+    }
+    else if (*p == '*')
+    {
+	/* verbs */
+	ps->bad = 1;
+	return NULL;
+    }
+
+    ps->p = p;
+    self = parseAlt(ps);
+    if (ps->bad || *ps->p != ')')
+    {
+	ps->bad = 1;
+	freeNode(self);
+	return NULL;
+    }
+    ++ps->p;
+
+    if (lookaround)
+    {
+	/* lookarounds only restrict where a pattern matches */
+	freeNode(self);
+	return newNode(NT_EMPTY);
+    }
+    return self;
+}
+
+/* parse a single item of a pattern */
+static Node *
+parseAtom(Parser *ps)
+{
+    ByteSet set;
+    int ch;
+
+    switch (*ps->p)
+    {
+	case '(':
+	    return parseGroup(ps);
+
+	case '[':
+	    return parseClass(ps);
+
+	case '.':
+	    /* anything but a newline */
+	    ++ps->p;
+	    setClear(&set);
+	    setAdd(&set, '\n');
+	    setInvert(&set);
+	    return setNode(ps, &set);
+
+	case '^':
+	case '$':
+	    /* anchors inside a pattern only restrict where it matches */
+	    ++ps->p;
+	    return newNode(NT_EMPTY);
+
+	case '\\':
+	    ++ps->p;
+	    switch (parseEscape(ps, &set, &ch, 0))
+	    {
+		case ESC_SET:
+		    return setNode(ps, &set);
+		case ESC_EMPTY:
+		    return newNode(NT_EMPTY);
+		case ESC_ANY:
+		    return anyNode(ps);
+		default:
+		    ps->bad = 1;
+		    return NULL;
+	    }
+
+	default:
+	    setClear(&set);
+	    setAdd(&set, (unsigned char)*ps->p++);
+	    return setNode(ps, &set);
+    }
+}
+
+/* parse a quantifier, returns 1 if one was found */
+static int
+parseQuantifier(Parser *ps, int *min, int *max)
+{
+    const char *p = ps->p;
+
+    switch (*p)
+    {
+	case '*':
+	    *min = 0;
+	    *max = -1;
+	    ++p;
+	    break;
+
+	case '+':
+	    *min = 1;
+	    *max = -1;
+	    ++p;
+	    break;
+
+	case '?':
+	    *min = 0;
+	    *max = 1;
+	    ++p;
+	    break;
+
+	case '{':
+	    /* only {n}, {n,} and {n,m}. PCRE versions differ in what else
+	     * is a quantifier or literal text, so that isn't supported */
+	    ++p;
+	    if (!isdigit((unsigned char)*p))
+	    {
+		ps->bad = 1;
+		return 0;
+	    }
+	    for (*min = 0; isdigit((unsigned char)*p); ++p)
+	    {
+		if (*min <= MAX_REPEAT) *min = *min * 10 + (*p - '0');
+	    }
+	    *max = *min;
+	    if (*p == ',')
+	    {
+		++p;
+		if (isdigit((unsigned char)*p))
+		{
+		    for (*max = 0; isdigit((unsigned char)*p); ++p)
+		    {
+			if (*max <= MAX_REPEAT) *max = *max * 10 + (*p - '0');
+		    }
+		}
+		else *max = -1;
+	    }
+	    if (*p != '}' || *min > MAX_REPEAT || *max > MAX_REPEAT
+		    || (*max >= 0 && *max < *min))
+	    {
+		ps->bad = 1;
+		return 0;
+	    }
+	    ++p;
+	    break;
+
+	default:
+	    return 0;
+    }
+
+    /* lazy and possessive quantifiers match a subset */
+    if (*p == '?' || *p == '+') ++p;
+    ps->p = p;
+    return 1;
+}
+
+/* parse a sequence of items up to the end of an alternative */
+static Node *
+parseSeq(Parser *ps, int top)
+{
+    Node *self = newNode(NT_CAT);
+    Node **tail = &(self->child);
+    Node **last = NULL;
+    Node *atom;
+    ByteSet set;
+    int min, max;
+
+    while (!ps->bad && *ps->p && *ps->p != '|' && *ps->p != ')')
+    {
+	if (parseQuantifier(ps, &min, &max))
+	{
+	    if (!last)
+	    {
+		ps->bad = 1;
+		break;
+	    }
+
+	    /* repeat the last item */
+	    atom = newNode(NT_REPEAT);
+	    atom->min = min;
+	    atom->max = max;
+	    atom->child = *last;
+	    *last = atom;
+	    tail = &(atom->next);
+	    continue;
+	}
+	if (ps->bad) break;
+
+	if (ps->p[0] == '\\' && ps->p[1] == 'Q')
+	{
+	    /* quoted literal characters */
+	    for (ps->p += 2; *ps->p && !(ps->p[0] == '\\' && ps->p[1] == 'E');
+		    ++ps->p)
+	    {
+		setClear(&set);
+		setAdd(&set, (unsigned char)*ps->p);
+		atom = setNode(ps, &set);
+		*tail = atom;
+		last = tail;
+		tail = &(atom->next);
+	    }
+	    if (*ps->p) ps->p += 2;
+	    continue;
+	}
+
+	if (top && *ps->p == '$' && (!ps->p[1] || ps->p[1] == '|'))
+	{
+	    /* end of a top-level alternative, only matches at the end of
+	     * the line */
+	    ps->endOnly = 1;
+	    ++ps->p;
+	    continue;
+	}
+
+	if (!(atom = parseAtom(ps))) break;
+	*tail = atom;
+	last = tail;
+	tail = &(atom->next);
+    }
+
+    return self;
+}
+
+/* parse alternatives inside a group */
+static Node *
+parseAlt(Parser *ps)
+{
+    Node *self = newNode(NT_ALT);
+    Node **tail = &(self->child);
+
+    for (;;)
+    {
+	*tail = parseSeq(ps, 0);
+	tail = &((*tail)->next);
+	if (ps->bad || *ps->p != '|') break;
+	++ps->p;
+    }
+
+    return self;
+}
+
+/* number of NFA nodes needed for a parsed pattern, saturating above the
+ * maximum for a pattern */
+static long
+nodeSize(const Node *self)
+{
+    const Node *c;
+    long size = 0;
+
+    switch (self->type)
+    {
+	case NT_EMPTY:
+	    break;
+
+	case NT_SET:
+	    size = 1;
+	    break;
+
+	case NT_CAT:
+	case NT_ALT:
+	    for (c = self->child; c; c = c->next)
+	    {
+		size += nodeSize(c) + 1;
+		if (size > MAX_PATTERN_NODES) break;
+	    }
+	    break;
+
+	case NT_REPEAT:
+	    size = nodeSize(self->child) + 1;
+	    size *= self->max < 0 ? self->min + 1 : self->max;
+	    break;
+    }
+
+    return size > MAX_PATTERN_NODES ? MAX_PATTERN_NODES + 1 : size;
+}
+
+/* append a node to the NFA */
+static int
+newNfa(LazyDfa *self, NfaType type, int out, int out1, int arg)
+{
+    NfaNode *n;
+
+    if (self->numNfa == self->nfaSize)
+    {
+	self->nfaSize = self->nfaSize ? 2 * self->nfaSize : 256;
+	self->nfa = lladRealloc(self->nfa,
+		(size_t)self->nfaSize * sizeof(NfaNode));
+    }
+
+    n = &(self->nfa[self->numNfa]);
+    n->type = type;
+    n->out = out;
+    n->out1 = out1;
+    n->arg = arg;
+    n->endOnly = 0;
+    n->mark = 0;
+    return self->numNfa++;
+}
+
+static int compileNode(LazyDfa *self, const Node *node, int next);
+
+/* compile a list of nodes to be matched one after the other, the NFA is
+ * built backwards from the node following them */
+static int
+compileCat(LazyDfa *self, const Node *node, int next)
+{
+    if (!node) return next;
+    return compileNode(self, node, compileCat(self, node->next, next));
+}
+
+/* compile a parsed pattern to NFA nodes continuing at next, returns the
+ * start node */
+static int
+compileNode(LazyDfa *self, const Node *node, int next)
+{
+    const Node *c;
+    int start, s, i;
+
+    switch (node->type)
+    {
+	case NT_SET:
+	    return newNfa(self, NN_SET, next, -1, node->set);
+
+	case NT_CAT:
+	    return compileCat(self, node->child, next);
+
+	case NT_ALT:
+	    start = -1;
+	    for (c = node->child; c; c = c->next)
+	    {
+		s = compileNode(self, c, next);
+		start = start < 0 ? s : newNfa(self, NN_SPLIT, s, start, 0);
+	    }
+	    return start < 0 ? next : start;
+
+	case NT_REPEAT:
+	    start = next;
+	    if (node->max < 0)
+	    {
+		/* loop back to a split node */
+		start = newNfa(self, NN_SPLIT, -1, next, 0);
+		s = compileNode(self, node->child, start);
+		self->nfa[start].out = s;
+	    }
+	    else
+	    {
+		/* optional copies, each one can skip the rest */
+		for (i = node->min; i < node->max; ++i)
+		{
+		    s = compileNode(self, node->child, start);
+		    start = newNfa(self, NN_SPLIT, s, start, 0);
+		}
+	    }
+
+	    /* required copies */
+	    for (i = 0; i < node->min; ++i)
+	    {
+		start = compileNode(self, node->child, start);
+	    }
+	    return start;
+
+	default:
+	    return next;
+    }
+}
+
+LazyDfa *
+LazyDfa_new(void)
+{
+    LazyDfa *self = lladAlloc(sizeof(LazyDfa));
+    memset(self, 0, sizeof(LazyDfa));
+    pthread_mutex_init(&(self->lock), NULL);
+    return self;
+}
+
+int
+lazyDfa_add(LazyDfa *self, const char *pattern)
+{
+    Parser ps;
+    Node *branch;
+    int numNfa = self->numNfa;
+    int numSets = self->numSets;
+    int numAnchored = self->numAnchored;
+    int numSearch = self->numSearch;
+    int anchored, start;
+
+    ps.dfa = self;
+    ps.p = pattern;
+    ps.bad = 0;
+
+    /* each top-level alternative gets its own start and match nodes, so ^
+     * and $ can be handled exactly there */
+    for (;;)
+    {
+	anchored = 0;
+	if (*ps.p == '^')
+	{
+	    anchored = 1;
+	    ++ps.p;
+	}
+	ps.endOnly = 0;
+	branch = parseSeq(&ps, 1);
+
+	if (ps.bad || nodeSize(branch) > MAX_PATTERN_NODES)
+	{
+	    /* not supported, forget everything added for this pattern */
+	    freeNode(branch);
+	    self->numNfa = numNfa;
+	    self->numSets = numSets;
+	    self->numAnchored = numAnchored;
+	    self->numSearch = numSearch;
+	    return -1;
+	}
+
+	start = newNfa(self, NN_MATCH, -1, -1, self->numPatterns);
+	self->nfa[start].endOnly = ps.endOnly;
+	start = compileNode(self, branch, start);
+	freeNode(branch);
+
+	if (anchored)
+	{
+	    self->anchored = lladRealloc(self->anchored,
+		    (size_t)(self->numAnchored + 1) * sizeof(int));
+	    self->anchored[self->numAnchored++] = start;
+	}
+	else
+	{
+	    self->search = lladRealloc(self->search,
+		    (size_t)(self->numSearch + 1) * sizeof(int));
+	    self->search[self->numSearch++] = start;
+	}
+
+	if (*ps.p != '|') break;
+	++ps.p;
+    }
+
+    if (*ps.p)
+    {
+	/* unbalanced parenthesis */
+	self->numNfa = numNfa;
+	self->numSets = numSets;
+	self->numAnchored = numAnchored;
+	self->numSearch = numSearch;
+	return -1;
+    }
+
+    return self->numPatterns++;
+}
+
+void
+lazyDfa_compile(LazyDfa *self)
+{
+    unsigned char cls[NUM_BYTES];
+    int map[2 * NUM_BYTES];
+    int i, b, key, n;
+
+    /* split bytes into classes, so that no byte set distinguishes between
+     * bytes of the same class */
+    memset(self->cls, 0, NUM_BYTES);
+    self->numClasses = 1;
+    for (i = 0; i < self->numSets; ++i)
+    {
+	for (key = 0; key < 2 * self->numClasses; ++key) map[key] = -1;
+	n = 0;
+	for (b = 0; b < NUM_BYTES; ++b)
+	{
+	    key = self->cls[b] * 2 + setHas(&(self->sets[i]), b);
+	    if (map[key] < 0) map[key] = n++;
+	    cls[b] = (unsigned char)map[key];
+	}
+	memcpy(self->cls, cls, NUM_BYTES);
+	self->numClasses = n;
+    }
+    for (b = NUM_BYTES - 1; b >= 0; --b) self->rep[self->cls[b]] =
+	(unsigned char)b;
+
+    self->work = lladAlloc((size_t)(self->numNfa + 1) * sizeof(int));
+    self->stack = lladAlloc((size_t)(self->numNfa + 1) * sizeof(int));
+    self->buckets = lladAlloc(NUM_BUCKETS * sizeof(DfaState *));
+    memset(self->buckets, 0, NUM_BUCKETS * sizeof(DfaState *));
+}
+
+int
+lazyDfa_count(const LazyDfa *self)
+{
+    return self->numPatterns;
+}
+
+/* start computing a new set of NFA nodes */
+static void
+nextGen(LazyDfa *self)
+{
+    int i;
+
+    if (!++self->gen)
+    {
+	/* wrapped around, so old marks could look current */
+	for (i = 0; i < self->numNfa; ++i) self->nfa[i].mark = 0;
+	self->gen = 1;
+    }
+}
+
+/* add a node and all nodes reachable through NN_SPLIT nodes to the work
+ * set, only keeping NN_SET and NN_MATCH nodes */
+static void
+addClosure(LazyDfa *self, int n, int *len)
+{
+    int sp = 0;
+    NfaNode *node;
+
+    if (self->nfa[n].mark == self->gen) return;
+    self->nfa[n].mark = self->gen;
+    self->stack[sp++] = n;
+
+    while (sp)
+    {
+	node = &(self->nfa[self->stack[--sp]]);
+	if (node->type != NN_SPLIT)
+	{
+	    self->work[(*len)++] = (int)(node - self->nfa);
+	    continue;
+	}
+	if (self->nfa[node->out].mark != self->gen)
+	{
+	    self->nfa[node->out].mark = self->gen;
+	    self->stack[sp++] = node->out;
+	}
+	if (self->nfa[node->out1].mark != self->gen)
+	{
+	    self->nfa[node->out1].mark = self->gen;
+	    self->stack[sp++] = node->out1;
+	}
+    }
+}
+
+static int
+compareInt(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* drop all cached DFA states */
+static void
+clearCache(LazyDfa *self)
+{
+    DfaState *s, *next;
+    int i;
+
+    for (i = 0; i < NUM_BUCKETS; ++i)
+    {
+	for (s = self->buckets[i]; s; s = next)
+	{
+	    next = s->hnext;
+	    free(s);
+	}
+	self->buckets[i] = NULL;
+    }
+    self->start = NULL;
+    self->memory = 0;
+}
+
+/* find or create the DFA state for the current work set of len nodes */
+static DfaState *
+intern(LazyDfa *self, int len)
+{
+    DfaState *s;
+    uint64_t hash;
+    size_t size;
+    int i, numMatches = 0, numEndMatches = 0;
+    DfaState **bucket;
+
+    qsort(self->work, (size_t)len, sizeof(int), &compareInt);
+    hash = lladHash(self->work, (size_t)len * sizeof(int));
+    bucket = &(self->buckets[hash & (NUM_BUCKETS - 1)]);
+
+    for (s = *bucket; s; s = s->hnext)
+    {
+	if (s->hash == hash && s->numNodes == len
+		&& !memcmp(s->nodes, self->work, (size_t)len * sizeof(int)))
+	{
+	    return s;
+	}
+    }
+
+    for (i = 0; i < len; ++i)
+    {
+	if (self->nfa[self->work[i]].type != NN_MATCH) continue;
+	if (self->nfa[self->work[i]].endOnly) ++numEndMatches;
+	else ++numMatches;
+    }
+
+    /* one allocation holding transitions, nodes and matches */
+    size = sizeof(DfaState) + (size_t)self->numClasses * sizeof(DfaState *)
+	+ (size_t)(len + numMatches + numEndMatches) * sizeof(int);
+    if (self->memory && self->memory + size > DFA_CACHE_SIZE)
+    {
+	clearCache(self);
+	++self->resets;
+	__atomic_add_fetch(&totalResets, 1, __ATOMIC_RELAXED);
+    }
+
+    s = lladAlloc(size);
+    s->trans = (DfaState **)(s + 1);
+    s->nodes = (int *)(s->trans + self->numClasses);
+    s->matches = s->nodes + len;
+    s->endMatches = s->matches + numMatches;
+    memset(s->trans, 0, (size_t)self->numClasses * sizeof(DfaState *));
+    memcpy(s->nodes, self->work, (size_t)len * sizeof(int));
+    s->numNodes = len;
+    s->numMatches = 0;
+    s->numEndMatches = 0;
+    for (i = 0; i < len; ++i)
+    {
+	if (self->nfa[self->work[i]].type != NN_MATCH) continue;
+	if (self->nfa[self->work[i]].endOnly)
+	{
+	    s->endMatches[s->numEndMatches++] = self->nfa[self->work[i]].arg;
+	}
+	else
+	{
+	    s->matches[s->numMatches++] = self->nfa[self->work[i]].arg;
+	}
+    }
+    s->hash = hash;
+
+    s->hnext = self->buckets[hash & (NUM_BUCKETS - 1)];
+    self->buckets[hash & (NUM_BUCKETS - 1)] = s;
+    self->memory += size;
+    __atomic_add_fetch(&totalStates, 1, __ATOMIC_RELAXED);
+    return s;
+}
+
+/* compute the state at the beginning of a line */
+static DfaState *
+startState(LazyDfa *self)
+{
+    int i, len = 0;
+
+    nextGen(self);
+    for (i = 0; i < self->numAnchored; ++i)
+    {
+	addClosure(self, self->anchored[i], &len);
+    }
+    for (i = 0; i < self->numSearch; ++i)
+    {
+	addClosure(self, self->search[i], &len);
+    }
+
+    self->start = intern(self, len);
+    return self->start;
+}
+
+/* compute the state following a state on a byte class */
+static DfaState *
+nextState(LazyDfa *self, DfaState *s, int c)
+{
+    DfaState *next;
+    NfaNode *node;
+    unsigned long resets = self->resets;
+    int i, len = 0;
+    int b = self->rep[c];
+
+    nextGen(self);
+    for (i = 0; i < s->numNodes; ++i)
+    {
+	node = &(self->nfa[s->nodes[i]]);
+	if (node->type == NN_SET && setHas(&(self->sets[node->arg]), b))
+	{
+	    addClosure(self, node->out, &len);
+	}
+    }
+
+    /* unanchored patterns can start at every position */
+    for (i = 0; i < self->numSearch; ++i)
+    {
+	addClosure(self, self->search[i], &len);
+    }
+
+    next = intern(self, len);
+
+    /* if the cache was cleared, s doesn't exist any more */
+    if (self->resets == resets) s->trans[c] = next;
+    return next;
+}
+
+/* mark patterns as matched */
+static void
+markMatches(const int *ids, int n, unsigned char *matched)
+{
+    while (n--) matched[ids[n]] = 1;
+}
+
+void
+lazyDfa_scan(LazyDfa *self, const char *line, size_t len,
+	unsigned char *matched)
+{
+    const unsigned char *p = (const unsigned char *)line;
+    const unsigned char *end = p + len;
+    DfaState *s, *next;
+    int c;
+
+    memset(matched, 0, (size_t)self->numPatterns);
+
+    pthread_mutex_lock(&(self->lock));
+    s = self->start ? self->start : startState(self);
+    while (p < end)
+    {
+	if (s->numMatches) markMatches(s->matches, s->numMatches, matched);
+
+	/* $ matches before a newline at the end as well */
+	if (s->numEndMatches && p == end - 1 && *p == '\n')
+	{
+	    markMatches(s->endMatches, s->numEndMatches, matched);
+	}
+
+	c = self->cls[*p++];
+	if (!(next = s->trans[c])) next = nextState(self, s, c);
+	s = next;
+    }
+
+    markMatches(s->matches, s->numMatches, matched);
+    markMatches(s->endMatches, s->numEndMatches, matched);
+    pthread_mutex_unlock(&(self->lock));
+}
+
+void
+lazyDfa_free(LazyDfa *self)
+{
+    if (!self) return;
+    if (self->buckets) clearCache(self);
+    free(self->buckets);
+    free(self->stack);
+    free(self->work);
+    free(self->search);
+    free(self->anchored);
+    free(self->sets);
+    free(self->nfa);
+    pthread_mutex_destroy(&(self->lock));
+    free(self);
+}
+
+void
+LazyDfa_logStats(void)
+{
+    Daemon_printf("Combined automata: %lu DFA states built, "
+	    "%lu cache resets.",
+	    __atomic_load_n(&totalStates, __ATOMIC_RELAXED),
+	    __atomic_load_n(&totalResets, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,85 @@
+#ifndef LLAD_LAZYDFA_H
+#define LLAD_LAZYDFA_H
+
+/** class LazyDfa
+ * @file
+ */
+
+#include <stddef.h>
+
+struct lazyDfa;
+
+/** Class for matching many patterns in a single pass over a line.
+ * All added patterns are compiled into one NFA. While scanning lines, a DFA
+ * is built from it on demand, one state at a time, so each byte of a line
+ * normally costs one table lookup, no matter how many patterns there are.
+ * The DFA states are cached up to a fixed memory size, the cache is cleared
+ * when it is full.
+ *
+ * The automaton only decides which patterns match somewhere in a line, it
+ * doesn't extract capturing groups. It may also report a pattern matching
+ * when it doesn't, because constructs it can't handle exactly (like
+ * lookarounds, word boundaries or back references) are approximated by
+ * something matching more. So a reported match must be confirmed by
+ * actually matching the pattern, but a pattern not reported can't match.
+ * @class LazyDfa "lazydfa.h"
+ */
+typedef struct lazyDfa LazyDfa;
+
+/** Create an empty LazyDfa.
+ * This works as a constructor.
+ * @memberof LazyDfa
+ * @static
+ * @returns the new LazyDfa
+ */
+LazyDfa *LazyDfa_new(void);
+
+/** Add a pattern to a LazyDfa.
+ * This is only possible before lazyDfa_compile() is called.
+ * @memberof LazyDfa
+ * @param self the LazyDfa
+ * @param pattern a regular expression in perl compatible syntax
+ * @returns the id of the pattern, numbered from 0, or -1 if the pattern
+ *          uses features not supported by LazyDfa
+ */
+int lazyDfa_add(LazyDfa *self, const char *pattern);
+
+/** Prepare a LazyDfa for scanning after all patterns are added.
+ * @memberof LazyDfa
+ * @param self the LazyDfa
+ */
+void lazyDfa_compile(LazyDfa *self);
+
+/** Get the number of patterns in a LazyDfa.
+ * @memberof LazyDfa
+ * @param self the LazyDfa
+ * @returns the number of patterns
+ */
+int lazyDfa_count(const LazyDfa *self);
+
+/** Find the patterns possibly matching a line.
+ * This may be called from several threads at once, scanning is serialized
+ * because it builds missing states in the cache.
+ * @memberof LazyDfa
+ * @param self the compiled LazyDfa
+ * @param line the line, doesn't need to be NUL-terminated
+ * @param len the length of the line
+ * @param matched array with one flag per pattern id, set to 1 for each
+ *                pattern possibly matching and to 0 for all others
+ */
+void lazyDfa_scan(LazyDfa *self, const char *line, size_t len,
+	unsigned char *matched);
+
+/** Destructor for LazyDfa.
+ * @memberof LazyDfa
+ * @param self the LazyDfa
+ */
+void lazyDfa_free(LazyDfa *self);
+
+/** Log statistics about all LazyDfa objects.
+ * @memberof LazyDfa
+ * @static
+ */
+void LazyDfa_logStats(void);
+
+#endif
@@ -5,17 +5,27 @@
 #include <libgen.h>
 
 #include "action.h"
+#include "checkpoint.h"
 #include "config.h"
 #include "daemon.h"
+#include "eventloop.h"
 #include "logfile.h"
+#include "pipeline.h"
+#include "rulecache.h"
+#include "spawner.h"
 #include "watcher.h"
 #include "util.h"
 
 /* libpopt table including options from all modules */
 static const struct poptOption opts[] = {
     ACTION_OPTS
+    CHECKPOINT_OPTS
     CONFIG_OPTS
     LOGFILE_OPTS
+    PIPELINE_OPTS
+    RULECACHE_OPTS
+    SPAWNER_OPTS
+    WATCHER_OPTS
     DAEMON_OPTS
     POPT_AUTOHELP
     POPT_TABLEEND
@@ -29,9 +39,34 @@ svcmain(void *data)
 
     (void)(data); /* unused */
 
+    if (!EventLoop_init()) return EXIT_FAILURE;
+
+    /* start spawner helper before compiling any patterns, so it stays
+     * small */
+    if (!Spawner_init())
+    {
+	EventLoop_done();
+	return EXIT_FAILURE;
+    }
+
+    /* start logger and matcher threads after the spawner helper was
+     * forked */
+    Daemon_startLogger();
+    if (!Pipeline_init())
+    {
+	Spawner_done();
+	EventLoop_done();
+	return EXIT_FAILURE;
+    }
+
     LogfileList_init();
 
-    if ((rc = Watcher_watchlogs()))
+    rc = Watcher_watchlogs();
+
+    /* execute matches of lines already read */
+    Pipeline_flush();
+
+    if (rc)
     {
 	/* only wait if Watcher ran successfully, otherwise there can be no
 	 * actions launched. */
@@ -39,6 +74,9 @@ svcmain(void *data)
     }
 
     LogfileList_done();
+    Pipeline_done();
+    Spawner_done();
+    EventLoop_done();
 
     Daemon_print("Daemon stopped");
 
@@ -90,7 +128,9 @@ main(int argc, const char **argv)
 
     /* call final cleanup routines */
     Action_atexit();
+    Checkpoint_atexit();
     Config_atexit();
+    RuleCache_atexit();
     Daemon_atexit();
 
     free(cmd);
@@ -1,6 +1,5 @@
 #define _FILE_OFFSET_BITS 64
-#define _POSIX_C_SOURCE 200112L
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 #include "logfile.h"
 
 #include <stdio.h>
@@ -13,21 +12,52 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "action.h"
+#include "checkpoint.h"
 #include "config.h"
 #include "daemon.h"
+#include "eventloop.h"
+#include "hash.h"
+#include "pipeline.h"
+#include "rulecache.h"
 #include "util.h"
 
 /* Maximum size a newly opened logfile can have, so we read it from the
  * beginning. If it is bigger than this, just wait for new content */
 #define MAX_SCAN_COMPLETE_FILE 8192
 
-/* Size of the buffer for reading lines from a logfile */
-#define SCAN_BUFSIZE 4096
+/* Initial size of the buffer for reading lines from a logfile, allocated per
+ * Logfile while the file is opened. It grows as needed for long lines, up to
+ * the configured maximum line length. */
+#define SCAN_BUFSIZE 65536
+
+/* Default maximum length of a log line */
+#define DEFAULT_MAX_LINE 65536
+
+/* Interval for reading rotated files while draining them (ms) */
+#define DRAIN_POLL 1000
+
+/* Default number of bytes read from a logfile per turn when several logfiles
+ * have new lines */
+#define DEFAULT_SCAN_QUANTUM 65536
+
+/* Characters making the base name of a section a wildcard pattern */
+#define GLOB_CHARS "*?["
 
 static int noignore = 0;	/* flag for not ignoring "own" log lines */
+static int maxLine = DEFAULT_MAX_LINE;	/* maximum length of a log line */
+static int skipLong = 0;	/* flag for skipping instead of truncating */
+static int drainGrace = 5;	/* time to keep reading rotated files (sec) */
+static int scanQuantum = DEFAULT_SCAN_QUANTUM;	/* bytes per turn */
 static char ignorepattern[128];	/* pattern for recognizing "own" log lines */
+static size_t ignorelen;	/* length of ignorepattern */
 
 const struct poptOption logfile_opts[] = {
     {"no-ignore", '\0', POPT_ARG_NONE, &noignore, 0,
@@ -37,17 +67,67 @@ const struct poptOption logfile_opts[] = {
 	"of children and running out of file descriptors if your patterns "
 	"match exactly the lines created by the output of your commands. "
 	"You have been warned.", NULL},
+    {"max-line", '\0', POPT_ARG_INT, &maxLine, 0,
+	"Maximum length of a log line in <bytes>, longer lines are truncated "
+	"to this length before matching, defaults to 65536.", "bytes"},
+    {"skip-long-lines", '\0', POPT_ARG_NONE, &skipLong, 0,
+	"Skip lines longer than the maximum length instead of matching them "
+	"truncated.", NULL},
+    {"drain-grace", '\0', POPT_ARG_INT, &drainGrace, 0,
+	"Keep reading a logfile for <sec> seconds after it was rotated or "
+	"deleted, so lines written right before are not lost, defaults "
+	"to 5.", "sec"},
+    {"scan-quantum", '\0', POPT_ARG_INT, &scanQuantum, 0,
+	"Read at most <bytes> times the priority of a logfile before "
+	"turning to the next logfile with new lines, defaults to 65536. "
+	"0 reads each logfile to the end.", "bytes"},
     POPT_TABLEEND
 };
 
+/* state for reading lines from an opened file */
+typedef struct logReader
+{
+    char *buf;		/* read buffer, starts with incomplete line if any */
+    size_t bufsize;	/* current size of buf */
+    size_t buflen;	/* number of bytes currently in buf */
+    off_t pos;		/* file offset after the last read() */
+    dev_t dev;		/* device of the opened file */
+    ino_t ino;		/* inode of the opened file */
+    int fd;		/* file descriptor, -1 if not opened */
+    int skipping;	/* flag for discarding the rest of a too long line */
+} LogReader;
+
 struct logfile
 {
     char *name;		/* canonic full name of the logfile */
     char *dirName;	/* canonic directory name of the logfile */
-    char *baseName;	/* base filename of the logfile */
-    FILE *file;		/* stream for reading the logfile */
-    Action *first;	/* first Action for the logfile */
+    char *baseName;	/* base filename of the logfile, pattern for base
+			 * names of a wildcard section */
+    Action *first;	/* first Action for the logfile, shared with the
+			 * wildcard section if attached to one */
+    Logfile *glob;	/* wildcard section this was attached to, NULL if
+			 * none */
+    MatchQueue *queue;	/* lines waiting for matcher threads, NULL if
+			 * matching in the main thread */
     Logfile *next;	/* next Logfile in the list */
+    Logfile *prev;	/* previous Logfile in the list */
+    Logfile *nextDraining;  /* next Logfile with a rotated file to drain */
+    Logfile *nextPending;   /* next Logfile scheduled for scanning */
+    LogReader reader;	/* reader for the current file */
+    LogReader rotated;	/* reader for a rotated file that is drained */
+    Timer *drainTimer;	/* timer for reading the rotated file */
+    long long drainUntil;   /* end of grace period for rotated file (ms) */
+    off_t recovered;	/* bytes read from the rotated file so far */
+    CfgLogWatch watch;	/* how changes are noticed */
+    int priority;	/* weight for scheduling scans */
+    int pending;	/* flag, scheduled for scanning */
+    int isGlob;		/* flag, wildcard section, not a file */
+    int detached;	/* flag, removed from its wildcard section, freed
+			 * after draining */
+    int dirty;		/* flag, position changed since last checkpoint */
+    int reloaded;	/* flag, still configured, only while reloading */
+    Action *previous;	/* chain before reloading, only while reloading */
+    CfgLogWatch previousWatch;	/* watch mode before reloading */
 };
 
 struct logfileItor
@@ -56,38 +136,398 @@ struct logfileItor
 };
 
 static Logfile *firstLog = NULL;    /* first Logfile in the list */
+static Logfile *lastLog = NULL;	    /* last Logfile in the list */
+static HashTable *logsByName = NULL;	/* Logfiles by name */
+static Logfile *firstDraining = NULL;	/* first Logfile draining rotated */
+static off_t totalRecovered = 0;    /* bytes read from all rotated files */
+static Timer *checkpointTimer = NULL;	/* timer for writing checkpoints */
+static Logfile *firstPending = NULL;	/* first Logfile scheduled */
+static Logfile *lastPending = NULL;	/* last Logfile scheduled */
+static Timer *scheduleTimer = NULL;	/* timer for the next turn */
+static unsigned long totalScheduled = 0;    /* scans requested */
+static unsigned long totalCoalesced = 0;    /* merged into pending scans */
+static unsigned long totalTurns = 0;	/* turns of the scheduler */
+static unsigned long totalCutoffs = 0;	/* scans stopped at the quantum */
+static long long longestTurn = 0;	/* longest turn so far (ms) */
+static int reloading = 0;		/* flag, reloading the config */
+static const CfgAct **reloadActs = NULL;   /* entries of the reloaded
+					     * config, NULL if kept */
+static Action **compiledActs = NULL;	/* Actions compiled for reloadActs */
+static size_t numReloadActs = 0;	/* number of reloadActs */
+static size_t numCompiled = 0;		/* reloadActs to compile */
+static int reloadFd = -1;		/* eventfd signaling compiled patterns */
+static pthread_t reloadThread;		/* thread compiling patterns */
+static long long reloadStart = 0;	/* start of reloading (ms) */
+static LogfileList_watchHandler unwatchHandler = NULL;	/* from reload */
+static LogfileList_watchHandler watchHandler = NULL;	/* from reload */
+
+static void logfile_remove(Logfile *self);
+static void cancelReload(void);
+
+/* collect the config file entries of all Actions in config file order,
+ * returns a new array and their number in *num */
+static const CfgAct **
+collectCfgActs(size_t *num)
+{
+    CfgLogItor *li;
+    CfgActItor *ai;
+    const CfgAct **cfgActs;
+    size_t n = 0;
+
+    /* count them first */
+    li = Config_cfgLogItor();
+    while (cfgLogItor_moveNext(li))
+    {
+	ai = cfgLog_cfgActItor(cfgLogItor_current(li));
+	while (cfgActItor_moveNext(ai)) ++n;
+	cfgActItor_free(ai);
+    }
+    cfgLogItor_free(li);
 
-/* create Action objects from configuration of a Logfile section */
+    cfgActs = lladAlloc((n + 1) * sizeof(CfgAct *));
+    *num = 0;
+    li = Config_cfgLogItor();
+    while (cfgLogItor_moveNext(li))
+    {
+	ai = cfgLog_cfgActItor(cfgLogItor_current(li));
+	while (cfgActItor_moveNext(ai))
+	{
+	    cfgActs[(*num)++] = cfgActItor_current(ai);
+	}
+	cfgActItor_free(ai);
+    }
+    cfgLogItor_free(li);
+    return cfgActs;
+}
+
+/* chain the Actions of a Logfile section, taken from Actions compiled in
+ * config file order starting at *compiled, which is advanced past them */
 static Action *
-createActions(const CfgLog *cl)
+createActions(const CfgLog *cl, Action ***compiled)
 {
     Action *first = NULL;
+    Action *last = NULL;
     Action *next;
     CfgActItor *i;
-    const CfgAct *ca;
 
     i = cfgLog_cfgActItor(cl);
     while (cfgActItor_moveNext(i))
     {
-	ca = cfgActItor_current(i);
-	next = action_appendNew(first, ca);
-	if (!first) first = next;
+	/* invalid patterns were already reported */
+	if (!(next = *((*compiled)++))) continue;
+
+	/* append at the tail, so a long section isn't walked again for
+	 * every Action. None of them has matched yet, so there are no
+	 * literals of the chain to drop */
+	last = action_append(last, next);
+	if (!first) first = last;
     }
     cfgActItor_free(i);
 
     return first;
 }
 
+/* initialize a reader for a closed file */
+static void
+reader_init(LogReader *self)
+{
+    self->buf = NULL;
+    self->bufsize = 0;
+    self->buflen = 0;
+    self->pos = 0;
+    self->fd = -1;
+    self->skipping = 0;
+}
+
+/* close file of a reader and free its buffer */
+static void
+reader_close(LogReader *self)
+{
+    if (self->fd >= 0) close(self->fd);
+    free(self->buf);
+    reader_init(self);
+}
+
+/* open the logfile for non-blocking reading and reset read position */
+static int
+logfile_open(Logfile *self)
+{
+    struct stat st;
+    LogReader *r = &(self->reader);
+
+    /* non-blocking I/O, just in case ... we never want to block on read */
+    r->fd = open(self->name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (r->fd < 0) return 0;
+
+    /* remember identity of the opened file for checkpoints */
+    if (fstat(r->fd, &st) == 0)
+    {
+	r->dev = st.st_dev;
+	r->ino = st.st_ino;
+    }
+
+    r->pos = 0;
+    r->buflen = 0;
+    r->skipping = 0;
+    if (!r->buf)
+    {
+	r->bufsize = SCAN_BUFSIZE;
+	r->buf = lladAlloc(r->bufsize);
+    }
+    self->dirty = 1;
+    return 1;
+}
+
+/* hash the bytes just before a given offset, for recognizing the position
+ * after a restart */
+static uint64_t
+hashBefore(int fd, off_t offset)
+{
+    char buf[CHECKPOINT_HASHLEN];
+    off_t start;
+    ssize_t len;
+
+    start = offset > CHECKPOINT_HASHLEN ? offset - CHECKPOINT_HASHLEN : 0;
+    len = pread(fd, buf, (size_t)(offset - start), start);
+    if (len < 0) len = 0;
+    return lladHash(buf, (size_t)len);
+}
+
+/* position opened logfile according to recorded checkpoint.
+ * returns 1 if a checkpoint was found, 0 otherwise */
+static int
+logfile_restore(Logfile *self)
+{
+    struct stat st;
+    dev_t dev;
+    ino_t ino;
+    off_t offset;
+    uint64_t hash;
+    int skipping;
+    LogReader *r = &(self->reader);
+
+    if (!Checkpoint_get(self->name, &dev, &ino, &offset, &hash, &skipping))
+    {
+	return 0;
+    }
+    if (fstat(r->fd, &st) < 0) return 0;
+
+    if (st.st_dev == dev && st.st_ino == ino && st.st_size >= offset
+	    && hashBefore(r->fd, offset) == hash)
+    {
+	/* still the same file -> continue where we stopped, possibly in the
+	 * middle of a too long line that was already handled */
+	r->pos = lseek(r->fd, offset, SEEK_SET);
+	r->skipping = skipping;
+	Daemon_printf("Resuming `%s' at offset %lld",
+		self->name, (long long)r->pos);
+    }
+    else
+    {
+	/* replaced or truncated while we were not running, so everything in
+	 * it is new */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"`%s' changed while not watched, reading from the beginning",
+		self->name);
+	r->pos = 0;
+    }
+    return 1;
+}
+
+/* record current position of the logfile for a checkpoint */
+static void
+logfile_checkpoint(Logfile *self)
+{
+    off_t offset;
+    LogReader *r = &(self->reader);
+
+    if (r->fd < 0 || !self->dirty) return;
+
+    /* an incomplete line at the end of the buffer is read again after a
+     * restart. The rest of a too long line is discarded, so the buffer is
+     * empty and skipping resumes after a restart */
+    offset = r->pos - (off_t)r->buflen;
+    Checkpoint_set(self->name, r->dev, r->ino, offset,
+	    hashBefore(r->fd, offset), r->skipping);
+    self->dirty = 0;
+}
+
+/* record positions of all logfiles and write state file */
+static void
+LogfileList_checkpoint(void)
+{
+    Logfile *curr;
+
+    for (curr = firstLog; curr; curr = curr->next) logfile_checkpoint(curr);
+    Checkpoint_write();
+}
+
+/* timer handler for writing checkpoints */
+static void
+checkpointDue(void *data)
+{
+    (void)data; /* unused */
+
+    checkpointTimer = NULL;
+    LogfileList_checkpoint();
+}
+
+/* handler for a full MatchQueue accepting lines again, continue reading */
+static void
+queueReady(void *data)
+{
+    logfile_schedule(data);
+}
+
+/* create a Logfile object, taking ownership of realName and dirName */
+static Logfile *
+Logfile_create(char *realName, char *dirName, const char *baseName,
+	Action *first)
+{
+    Logfile *self = lladAlloc(sizeof(Logfile));
+    self->name = realName;
+    self->dirName = dirName;
+    self->baseName = lladCloneString(baseName);
+    self->nextDraining = NULL;
+    self->drainTimer = NULL;
+    reader_init(&(self->reader));
+    reader_init(&(self->rotated));
+    self->drainUntil = 0;
+    self->recovered = 0;
+    self->watch = CLW_AUTO;
+    self->priority = 1;
+    self->nextPending = NULL;
+    self->pending = 0;
+    self->isGlob = 0;
+    self->detached = 0;
+    self->next = NULL;
+    self->prev = NULL;
+    self->first = first;
+    self->glob = NULL;
+    self->queue = NULL;
+    self->dirty = 0;
+    self->reloaded = 0;
+    self->previous = NULL;
+    self->previousWatch = CLW_AUTO;
+    return self;
+}
+
+/* open a Logfile found at startup, positioned at the recorded checkpoint or
+ * otherwise at the end */
+static void
+logfile_openInitial(Logfile *self)
+{
+    if (logfile_open(self))
+    {
+	if (!logfile_restore(self))
+	{
+	    self->reader.pos = lseek(self->reader.fd, 0, SEEK_END);
+	}
+    }
+    else
+    {
+	/* it's ok if this isn't possible -- the directory should be watched
+	 * and maybe we can open it later */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Could not open `%s': %s", self->name, strerror(errno));
+    }
+}
+
+/* let matcher threads match the lines of a Logfile if enabled */
+static void
+logfile_createQueue(Logfile *self)
+{
+    if (Pipeline_enabled())
+    {
+	self->queue = MatchQueue_new(self->first, self->name, &queueReady,
+		self);
+    }
+}
+
+/* append a Logfile to the list */
+static void
+append(Logfile *self)
+{
+    self->prev = lastLog;
+    self->next = NULL;
+    if (lastLog) lastLog->next = self;
+    else firstLog = self;
+    lastLog = self;
+    if (!self->detached)
+    {
+	hashTable_put(logsByName, self->name, strlen(self->name), self);
+    }
+}
+
+/* create a Logfile for a file matching a wildcard section.
+ * returns NULL if the file isn't a regular file or already a Logfile */
+static Logfile *
+logfile_createAttached(Logfile *glob, const char *baseName)
+{
+    struct stat st;
+    Logfile *self;
+    char *realName = lladAlloc(strlen(glob->dirName) + strlen(baseName) + 2);
+
+    strcpy(realName, glob->dirName);
+    strcat(realName, "/");
+    strcat(realName, baseName);
+
+    /* first section naming a file wins */
+    if (hashTable_get(logsByName, realName, strlen(realName))
+	    || stat(realName, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+	free(realName);
+	return NULL;
+    }
+
+    self = Logfile_create(realName, lladCloneString(glob->dirName),
+	    baseName, glob->first);
+    self->glob = glob;
+    self->watch = glob->watch;
+    self->priority = glob->priority;
+    return self;
+}
+
+/* attach all files currently matching a wildcard section, read once at
+ * startup. Later, the Watcher attaches new files from directory events */
+static void
+logfile_expand(Logfile *self)
+{
+    DIR *dir;
+    struct dirent *de;
+    Logfile *log;
+
+    if (!(dir = opendir(self->dirName)))
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not read `%s': %s", self->dirName, strerror(errno));
+	return;
+    }
+
+    while ((de = readdir(dir)))
+    {
+	if (fnmatch(self->baseName, de->d_name, FNM_PERIOD)) continue;
+	if (!(log = logfile_createAttached(self, de->d_name))) continue;
+
+	Daemon_printf("Attached `%s' to `%s'", log->name, self->name);
+	logfile_openInitial(log);
+	logfile_createQueue(log);
+	append(log);
+    }
+    closedir(dir);
+}
+
+/* create a Logfile for a section with the given chain of Actions.
+ * returns NULL if the chain was appended to an existing Logfile or the
+ * section is invalid */
 static Logfile *
-logfile_new(const CfgLog *cl)
+logfile_new(const CfgLog *cl, Action *action)
 {
     struct stat st;
-    int fd;
     char *realName;
     Logfile *curr;
     char *tmp, *baseName, *dirName;
     Logfile *self = NULL;
-    Action *action = createActions(cl);
 
     if (!action)
     {
@@ -97,7 +537,8 @@ logfile_new(const CfgLog *cl)
 	return NULL;
     }
 
-    /* calculate paths */
+    /* calculate paths, a wildcard section can only have wildcards in the
+     * base name */
     tmp = lladCloneString(cfgLog_name(cl));
     baseName = basename(tmp);
     dirName = realpath(dirname(tmp), NULL);
@@ -141,61 +582,63 @@ logfile_new(const CfgLog *cl)
     strcat(realName, baseName);
 
     /* check whether this logfile is already in the list */
-    curr = firstLog;
-    while (curr)
+    curr = hashTable_get(logsByName, realName, strlen(realName));
+    if (curr)
     {
-	if (!strcmp(curr->name, realName))
+	/* if it is, append actions there */
+	free(realName);
+	free(dirName);
+	free(tmp);
+	if (curr->first)
 	{
-	    /* if it is, append actions there */
-	    free(realName);
-	    free(dirName);
-	    free(tmp);
-	    if (curr->first)
-	    {
-		action_append(curr->first, action);
-	    }
-	    else
-	    {
-		curr->first = action;
-	    }
-	    return NULL;
+	    action_append(curr->first, action);
+	}
+	else
+	{
+	    curr->first = action;
+	}
+
+	/* an explicit watch mode overrides the default */
+	if (cfgLog_watch(cl) != CLW_AUTO) curr->watch = cfgLog_watch(cl);
+
+	/* the highest priority wins */
+	if (cfgLog_priority(cl) > curr->priority)
+	{
+	    curr->priority = cfgLog_priority(cl);
 	}
-	curr = curr->next;
+	return NULL;
     }
 
     /* otherwise, create new Logfile object */
-    self = lladAlloc(sizeof(Logfile));
-    self->name = realName;
-    self->dirName = dirName;
-    self->baseName = lladCloneString(baseName);
+    self = Logfile_create(realName, dirName, baseName, action);
+    self->watch = cfgLog_watch(cl);
+    self->priority = cfgLog_priority(cl);
     free(tmp);
-    self->file = NULL;
 
-    /* try to open it directly for reading */
-    if ((self->file = fopen(self->name, "r")))
-    {
-	fd = fileno(self->file);
-	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
-	fseeko(self->file, 0L, SEEK_END);
-    }
-    else
+    if (strpbrk(self->baseName, GLOB_CHARS))
     {
-	/* it's ok if this isn't possible -- the directory should be watched
-	 * and maybe we can open it later */
-	Daemon_printf_level(LEVEL_NOTICE,
-		"Could not open `%s': %s", self->name, strerror(errno));
+	/* a wildcard section is never read itself */
+	self->isGlob = 1;
+	return self;
     }
 
-    self->next = NULL;
-    self->first = action;
+    /* try to open it directly for reading, continue at recorded checkpoint
+     * or otherwise at the end */
+    logfile_openInitial(self);
+    logfile_createQueue(self);
     return self;
 }
 
 static void
 logfile_free(Logfile *self)
 {
-    if (self->file) fclose(self->file);
-    action_free(self->first);
+    if (self->drainTimer) EventLoop_cancelTimer(self->drainTimer);
+    reader_close(&(self->rotated));
+    logfile_close(self);
+    if (self->queue) matchQueue_free(self->queue);
+
+    /* Actions of an attached Logfile belong to its wildcard section */
+    if (!self->glob) action_free(self->first);
     free(self->baseName);
     free(self->dirName);
     free(self->name);
@@ -207,53 +650,102 @@ LogfileList_done(void)
 {
     Logfile *curr, *last;
 
-    curr = firstLog;
+    /* patterns still compiled for reloading are not needed any more */
+    if (reloading) cancelReload();
+
+    /* save final positions */
+    if (checkpointTimer) EventLoop_cancelTimer(checkpointTimer);
+    checkpointTimer = NULL;
+    LogfileList_checkpoint();
+    Checkpoint_done();
+
+    /* backwards, so attached Logfiles go before their wildcard section */
+    curr = lastLog;
     while (curr)
     {
 	last = curr;
-	curr = last->next;
+	curr = last->prev;
 	logfile_free(last);
     }
 
+    /* freeing MatchQueues may have scheduled scans */
+    if (scheduleTimer) EventLoop_cancelTimer(scheduleTimer);
+    scheduleTimer = NULL;
+    firstPending = NULL;
+    lastPending = NULL;
+
+    hashTable_free(logsByName);
+    logsByName = NULL;
     firstLog = NULL;
+    lastLog = NULL;
+    firstDraining = NULL;
 }
 
 void
 LogfileList_init(void)
 {
-    Logfile *curr, *next;
+    Logfile *curr, *next, *last;
     CfgLogItor *li;
     const CfgLog *cl;
+    const CfgAct **cfgActs;
+    Action **actions, **compiled;
+    size_t numActs;
+    struct timespec start;
 
     /* if already initialized, first free the previous list */
     if (firstLog) LogfileList_done();
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     /* determine pattern for recognizing own log entries */
     snprintf(ignorepattern, 128, "%s[%d]:", Daemon_name(), getpid());
+    ignorelen = strlen(ignorepattern);
+
+    /* load recorded read positions */
+    Checkpoint_init();
+
+    if (maxLine < 1)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Invalid maximum line length %d, using default.", maxLine);
+	maxLine = DEFAULT_MAX_LINE;
+    }
+
+    logsByName = HashTable_new();
 
-    curr = NULL;
+    /* compile all patterns up front, in parallel, patterns compiled at the
+     * last start are taken from the rule cache */
+    cfgActs = collectCfgActs(&numActs);
+    actions = lladAlloc((numActs + 1) * sizeof(Action *));
+    RuleCache_init();
+    Action_newAll(cfgActs, actions, numActs);
+    Action_writeCache(actions, numActs);
+    RuleCache_done();
 
     /* iterate over Logfile config sections, create objects */
+    compiled = actions;
     li = Config_cfgLogItor();
     while (cfgLogItor_moveNext(li))
     {
 	cl = cfgLogItor_current(li);
-	next = logfile_new(cl);
-	if (next)
-	{
-	    if (curr)
-	    {
-		curr->next = next;
-		curr = next;
-	    }
-	    else
-	    {
-		curr = next;
-		firstLog = next;
-	    }
-	}
+	next = logfile_new(cl, createActions(cl, &compiled));
+	if (next) append(next);
     }
     cfgLogItor_free(li);
+    free(actions);
+    free(cfgActs);
+
+    /* attach files to wildcard sections, files named by a section of their
+     * own are already in the list */
+    last = lastLog;
+    for (curr = firstLog; curr; curr = curr->next)
+    {
+	if (curr->isGlob) logfile_expand(curr);
+	if (curr == last) break;
+    }
+
+    Daemon_printf("Set up %lu logfiles in %ld ms.",
+	    (unsigned long)hashTable_count(logsByName),
+	    lladElapsedUs(&start) / 1000);
 }
 
 LogfileItor *
@@ -302,107 +794,924 @@ logfile_baseName(const Logfile *self)
     return self->baseName;
 }
 
-void
-logfile_scan(Logfile *self, int reopen)
+CfgLogWatch
+logfile_watch(const Logfile *self)
 {
-    char buf[SCAN_BUFSIZE];
-    struct stat st;
-    int fd;
+    return self->watch;
+}
 
-    /* if the file is opened and reopening is requested, close it */
-    if (reopen && self->file)
-    {
-	Daemon_printf_level(LEVEL_NOTICE, "Reopening %s", self->name);
-	fclose(self->file);
-	self->file = NULL;
-    }
+int
+logfile_isGlob(const Logfile *self)
+{
+    return self->isGlob;
+}
 
-    if (!self->file)
-    {
-	/* try opening the file if it's not currently opened */
-	self->file = fopen(self->name, "r");
-	if (!self->file)
-	{
-	    /* warn if it can't be opened and give up */
-	    Daemon_printf_level(LEVEL_WARNING,
-		    "Could not open `%s': %s", self->name, strerror(errno));
-	    return;
-	}
+int
+logfile_isAttached(const Logfile *self)
+{
+    return self->glob != NULL;
+}
 
-	/* set to non-blocking I/O, just in case ... we never want to block
-	 * on read */
-	fd = fileno(self->file);
-	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+Logfile *
+logfile_attach(Logfile *self, const char *baseName)
+{
+    Logfile *log;
 
-	/* put file pointer to the end of the file */
-	fseeko(self->file, 0L, SEEK_END);
-	if (ftello(self->file) <= MAX_SCAN_COMPLETE_FILE)
-	{
-	    /* if the file is small enough (for example it just appeared newly
-	     * because of a logrotate), start reading at the beginning */
-	    rewind(self->file);
-	}
-	else return;
-    }
-    else
+    if (!self->isGlob || fnmatch(self->baseName, baseName, FNM_PERIOD)
+	    || !(log = logfile_createAttached(self, baseName)))
     {
-	/*check file size */
-	fstat(fileno(self->file), &st);
-	if (st.st_size < ftello(self->file))
-	{
-	    /* smaller than previously? -> handle truncation, reopen */
-	    Daemon_printf_level(LEVEL_NOTICE,
-		    "%s: truncation detected", self->name);
-	    fclose(self->file);
-	    self->file = fopen(self->name, "r");
-	    if (!self->file)
-	    {
-		/* warn if it can't be opened and give up */
-		Daemon_printf_level(LEVEL_WARNING,
-			"Could not open `%s': %s", self->name, strerror(errno));
-		return;
-	    }
+	return NULL;
+    }
 
-	    /* non-blocking I/O */
-	    fd = fileno(self->file);
-	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    /* a new file is read from the beginning when it is first scanned */
+    Daemon_printf("Attached `%s' to `%s'", log->name, self->name);
+    logfile_createQueue(log);
+    append(log);
+    return log;
+}
 
-	    /* in case of truncation, always start at the new end */
-	    fseeko(self->file, 0L, SEEK_END);
-	    return;
-	}
-    }
+void
+logfile_detach(Logfile *self)
+{
+    if (!self->glob || self->detached) return;
 
-    /* actually read new lines from file */
-    while (fgets(buf, SCAN_BUFSIZE, self->file))
-    {
-	/* skip own log lines if not configured otherwise */
-	if (!noignore && strstr(buf, ignorepattern)) continue;
+    Daemon_printf("Detached `%s' from `%s'", self->name, self->glob->name);
+    hashTable_remove(logsByName, self->name, strlen(self->name));
+    Checkpoint_remove(self->name);
+
+    /* read lines written right before deletion during the grace period */
+    logfile_rotated(self);
+    self->detached = 1;
+    if (self->rotated.fd < 0) logfile_remove(self);
+}
+
+/* pass a complete line (including the newline) to the Actions */
+static void
+handleLine(Logfile *self, const char *line, size_t len)
+{
+    /* skip own log lines if not configured otherwise */
+    if (!noignore && memmem(line, len, ignorepattern, ignorelen)) return;
 
 #ifdef DEBUG
-	Daemon_printf_level(LEVEL_DEBUG,
-		"[logfile.c] [%s] got line: %s", self->name, buf);
+    Daemon_printf_level(LEVEL_DEBUG,
+	    "[logfile.c] [%s] got line: %.*s", self->name, (int)len, line);
 #endif
-	/* pass each line to all actions for pattern matching */
-	action_matchAndExecChain(self->first, self->name, buf);
-	errno = 0;
-    }
+    /* pass each line to all actions for pattern matching, or to the matcher
+     * threads */
+    if (self->queue) matchQueue_addLine(self->queue, line, len);
+    else action_matchAndExecChain(self->first, self->name, line, len);
+}
 
-    if (errno && errno != EWOULDBLOCK && errno != EAGAIN)
+/* truncate or skip a line longer than the maximum line length */
+static void
+handleLongLine(Logfile *self, const char *line)
+{
+    if (skipLong)
     {
-	/* ignore temporary errors, log other errors */
 	Daemon_printf_level(LEVEL_NOTICE,
-		"Can't read from `%s': %s", self->name, strerror(errno));
+		"%s: skipping line longer than %d bytes",
+		self->name, maxLine);
     }
-}
-
+    else
+    {
+	Daemon_printf_level(LEVEL_NOTICE,
+		"%s: truncating line longer than %d bytes",
+		self->name, maxLine);
+	handleLine(self, line, (size_t)maxLine);
+    }
+}
+
+/* read new data from a file until EOF or at least limit bytes were read if
+ * limit isn't 0, appending to a possibly incomplete line from the last read,
+ * and handle all complete lines.
+ * returns number of bytes read */
+static off_t
+readLines(Logfile *self, LogReader *r, off_t limit)
+{
+    ssize_t chunk = 0;
+    off_t total = 0;
+    char *end, *lineStart, *nl;
+
+    for (;;)
+    {
+	/* leave the rest for the next turn */
+	if (limit && total >= limit) break;
+
+	if (r == &(self->reader) && self->queue
+		&& matchQueue_full(self->queue))
+	{
+	    /* matcher threads are behind, leave the rest in the file until
+	     * the MatchQueue is ready again. Rotated files are always read
+	     * completely, they could go away. */
+	    break;
+	}
+
+	if (r->buflen == r->bufsize)
+	{
+	    /* buffer full of an incomplete line not longer than the maximum
+	     * line length, so grow the buffer. It is kept for later scans.
+	     * One byte more than the maximum is enough to tell a line too
+	     * long before its newline arrives. */
+	    r->bufsize *= 2;
+	    if (r->bufsize > (size_t)maxLine + 1)
+		r->bufsize = (size_t)maxLine + 1;
+	    r->buf = lladRealloc(r->buf, r->bufsize);
+	}
+
+	chunk = read(r->fd, r->buf + r->buflen, r->bufsize - r->buflen);
+	if (chunk <= 0) break;
+
+	r->pos += chunk;
+	total += chunk;
+	lineStart = r->buf;
+	end = r->buf + r->buflen + chunk;
+
+	/* find newlines in the new data only, memchr() is vectorized in any
+	 * decent libc */
+	nl = r->buf + r->buflen;
+	while ((nl = memchr(nl, '\n', (size_t)(end - nl))))
+	{
+	    ++nl;
+	    if (r->skipping)
+	    {
+		/* end of a too long line, discard it */
+		r->skipping = 0;
+	    }
+	    else if ((size_t)(nl - lineStart) - 1 > (size_t)maxLine)
+	    {
+		/* complete, but still too long */
+		handleLongLine(self, lineStart);
+	    }
+	    else
+	    {
+		handleLine(self, lineStart, (size_t)(nl - lineStart));
+	    }
+	    lineStart = nl;
+	}
+
+	r->buflen = (size_t)(end - lineStart);
+	if (!r->skipping && r->buflen > (size_t)maxLine)
+	{
+	    /* incomplete line already exceeds the maximum line length */
+	    handleLongLine(self, lineStart);
+
+	    /* discard everything up to the next newline */
+	    r->skipping = 1;
+	}
+
+	if (r->skipping)
+	{
+	    r->buflen = 0;
+	}
+	else if (r->buflen && lineStart > r->buf)
+	{
+	    /* keep incomplete line at the beginning of the buffer */
+	    memmove(r->buf, lineStart, r->buflen);
+	}
+    }
+
+    if (chunk < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+    {
+	/* ignore temporary errors, log other errors */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Can't read from `%s': %s", self->name, strerror(errno));
+    }
+
+    /* start matching what was read */
+    if (self->queue) matchQueue_flush(self->queue);
+    return total;
+}
+
+/* read a rotated file a last time and close it */
+static void
+logfile_finishDrain(Logfile *self)
+{
+    LogReader *r = &(self->rotated);
+
+    self->recovered += readLines(self, r, 0);
+
+    /* the file won't be completed any more, so pass a last line without
+     * newline as it is */
+    if (r->buflen && !r->skipping) handleLine(self, r->buf, r->buflen);
+
+    if (self->recovered)
+    {
+	Daemon_printf("Recovered %lld bytes from rotated `%s'",
+		(long long)self->recovered, self->name);
+	totalRecovered += self->recovered;
+    }
+    self->recovered = 0;
+    reader_close(r);
+}
+
+/* remove a detached Logfile from the list and free it */
+static void
+logfile_remove(Logfile *self)
+{
+    Logfile *curr, *prevPending = NULL;
+
+    if (self->prev) self->prev->next = self->next;
+    else firstLog = self->next;
+    if (self->next) self->next->prev = self->prev;
+    else lastLog = self->prev;
+
+    /* it could still be waiting for its turn */
+    if (self->pending)
+    {
+	for (curr = firstPending; curr != self; curr = curr->nextPending)
+	{
+	    prevPending = curr;
+	}
+	if (prevPending) prevPending->nextPending = self->nextPending;
+	else firstPending = self->nextPending;
+	if (lastPending == self) lastPending = prevPending;
+
+	/* no turn needed if nothing is left waiting */
+	if (!firstPending && scheduleTimer)
+	{
+	    EventLoop_cancelTimer(scheduleTimer);
+	    scheduleTimer = NULL;
+	}
+    }
+
+    logfile_free(self);
+}
+
+/* stop draining a Logfile, removing it from the list */
+static void
+logfile_stopDrain(Logfile *self)
+{
+    Logfile **curr = &firstDraining;
+
+    while (*curr && *curr != self) curr = &((*curr)->nextDraining);
+    if (*curr) *curr = self->nextDraining;
+    self->nextDraining = NULL;
+    if (self->drainTimer) EventLoop_cancelTimer(self->drainTimer);
+    self->drainTimer = NULL;
+    logfile_finishDrain(self);
+
+    /* nothing left to read from a detached Logfile */
+    if (self->detached) logfile_remove(self);
+}
+
+/* timer handler for reading a rotated file during the grace period */
+static void
+drainDue(void *data)
+{
+    Logfile *self = data;
+    long long wait;
+
+    self->drainTimer = NULL;
+    wait = self->drainUntil - EventLoop_now();
+    if (wait <= 0)
+    {
+	/* grace period is over */
+	logfile_stopDrain(self);
+	return;
+    }
+
+    /* read what was added and check again later */
+    self->recovered += readLines(self, &(self->rotated), 0);
+    if (wait > DRAIN_POLL) wait = DRAIN_POLL;
+    self->drainTimer = EventLoop_addTimer(wait, &drainDue, self);
+}
+
+/* scan a Logfile as described for logfile_scan(), but stop reading the
+ * current file after about limit bytes if limit isn't 0.
+ * returns 1 if stopped at the limit, 0 otherwise */
+static int
+scanFile(Logfile *self, int reopen, off_t limit)
+{
+    struct stat st;
+    off_t total;
+    LogReader *r = &(self->reader);
+
+    /* read remaining lines of a rotated file first, to keep the order */
+    if (self->rotated.fd >= 0)
+    {
+	self->recovered += readLines(self, &(self->rotated), 0);
+    }
+
+    /* a detached Logfile only drains its rotated file */
+    if (self->detached) return 0;
+
+    /* if the file is opened and reopening is requested, keep draining the
+     * old one */
+    if (reopen && r->fd >= 0)
+    {
+	Daemon_printf_level(LEVEL_NOTICE, "Reopening %s", self->name);
+	logfile_rotated(self);
+    }
+
+    if (r->fd < 0)
+    {
+	/* try opening the file if it's not currently opened */
+	if (!logfile_open(self))
+	{
+	    /* warn if it can't be opened and give up */
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Could not open `%s': %s", self->name, strerror(errno));
+	    return 0;
+	}
+
+	/* if the file is small enough (for example it just appeared newly
+	 * because of a logrotate), start reading at the beginning, otherwise
+	 * put read position to the end of the file */
+	if (fstat(r->fd, &st) == 0 && st.st_size > MAX_SCAN_COMPLETE_FILE)
+	{
+	    r->pos = lseek(r->fd, 0, SEEK_END);
+	    return 0;
+	}
+    }
+    else
+    {
+	/*check file size */
+	fstat(r->fd, &st);
+	if (st.st_size < r->pos)
+	{
+	    /* smaller than previously? -> handle truncation, reopen */
+	    Daemon_printf_level(LEVEL_NOTICE,
+		    "%s: truncation detected", self->name);
+	    logfile_close(self);
+	    if (!logfile_open(self))
+	    {
+		/* warn if it can't be opened and give up */
+		Daemon_printf_level(LEVEL_WARNING,
+			"Could not open `%s': %s", self->name, strerror(errno));
+		return 0;
+	    }
+
+	    /* in case of truncation, always start at the new end */
+	    r->pos = lseek(r->fd, 0, SEEK_END);
+	    return 0;
+	}
+    }
+
+    /* actually read new lines from file */
+    total = readLines(self, r, limit);
+    if (total) self->dirty = 1;
+
+    /* schedule writing checkpoints if not already done */
+    if (self->dirty && !checkpointTimer && Checkpoint_interval() >= 0)
+    {
+	checkpointTimer = EventLoop_addTimer(Checkpoint_interval() * 1000LL,
+		&checkpointDue, NULL);
+    }
+
+    return limit && total >= limit;
+}
+
+void
+logfile_scan(Logfile *self, int reopen)
+{
+    scanFile(self, reopen, 0);
+}
+
+static void scheduleDue(void *data);
+
+/* append a Logfile to the scheduled ones */
+static void
+enqueue(Logfile *self)
+{
+    self->pending = 1;
+    if (lastPending) lastPending->nextPending = self;
+    else firstPending = self;
+    lastPending = self;
+
+    /* run the next turn as soon as the EventLoop handled other events */
+    if (!scheduleTimer)
+    {
+	scheduleTimer = EventLoop_addTimer(0, &scheduleDue, NULL);
+    }
+}
+
+/* timer handler for a turn of the scheduler: scan each Logfile that was
+ * pending at the start of the turn once, up to its quantum */
+static void
+scheduleDue(void *data)
+{
+    Logfile *curr;
+    Logfile *last = lastPending;
+    long long start = EventLoop_now();
+    long long duration;
+
+    (void)data; /* unused */
+
+    scheduleTimer = NULL;
+    if (!firstPending) return;
+    ++totalTurns;
+
+    do
+    {
+	curr = firstPending;
+	firstPending = curr->nextPending;
+	if (!firstPending) lastPending = NULL;
+	curr->nextPending = NULL;
+	curr->pending = 0;
+
+	if (scanFile(curr, 0, (off_t)scanQuantum * curr->priority))
+	{
+	    /* more to read, go to the end of the line for the next turn */
+	    ++totalCutoffs;
+	    enqueue(curr);
+	}
+    } while (curr != last && firstPending);
+
+    duration = EventLoop_now() - start;
+    if (duration > longestTurn) longestTurn = duration;
+}
+
+void
+logfile_schedule(Logfile *self)
+{
+    ++totalScheduled;
+    if (self->pending)
+    {
+	/* already waiting for its turn */
+	++totalCoalesced;
+	return;
+    }
+    enqueue(self);
+}
+
+void
+logfile_rotated(Logfile *self)
+{
+    if (self->reader.fd < 0) return;
+
+    /* only one rotated file at a time, finish a previous one now */
+    if (self->rotated.fd >= 0) logfile_stopDrain(self);
+
+    /* move reader to the rotated file and read what is there now */
+    self->rotated = self->reader;
+    reader_init(&(self->reader));
+    self->recovered = readLines(self, &(self->rotated), 0);
+
+    if (drainGrace > 0)
+    {
+	/* keep reading it during the grace period */
+	self->drainUntil = EventLoop_now() + drainGrace * 1000LL;
+	self->nextDraining = firstDraining;
+	firstDraining = self;
+	self->drainTimer = EventLoop_addTimer(
+		drainGrace * 1000LL > DRAIN_POLL ? DRAIN_POLL
+		: drainGrace * 1000LL, &drainDue, self);
+    }
+    else
+    {
+	logfile_finishDrain(self);
+    }
+}
+
+void
+logfile_rescan(Logfile *self)
+{
+    struct stat st;
+    LogReader *r = &(self->reader);
+
+    if (stat(self->name, &st) < 0)
+    {
+	/* gone, handle it like a deletion */
+	if (r->fd >= 0)
+	{
+	    Daemon_printf_level(LEVEL_NOTICE,
+		    "File `%s' disappeared.", self->name);
+	    logfile_rotated(self);
+	}
+	return;
+    }
+
+    /* reopen if it was replaced by a different file, otherwise just read
+     * new lines in turn with other Logfiles */
+    if (r->fd >= 0 && (st.st_dev != r->dev || st.st_ino != r->ino))
+    {
+	logfile_scan(self, 1);
+    }
+    else
+    {
+	logfile_schedule(self);
+    }
+}
+
 void
 logfile_close(Logfile *self)
 {
-    if (self->file)
+    reader_close(&(self->reader));
+}
+
+/* get the canonical name of the logfile of a section, NULL if its directory
+ * doesn't exist */
+static char *
+sectionName(const CfgLog *cl)
+{
+    char *tmp = lladCloneString(cfgLog_name(cl));
+    const char *baseName = basename(tmp);
+    char *dirName = realpath(dirname(tmp), NULL);
+    char *realName = NULL;
+
+    if (dirName)
+    {
+	realName = lladAlloc(strlen(dirName) + strlen(baseName) + 2);
+	strcpy(realName, dirName);
+	strcat(realName, "/");
+	strcat(realName, baseName);
+	free(dirName);
+    }
+    free(tmp);
+    return realName;
+}
+
+/* find the Logfile for a section, NULL if there is none */
+static Logfile *
+findSection(const CfgLog *cl)
+{
+    Logfile *log = NULL;
+    char *name = sectionName(cl);
+
+    if (name)
+    {
+	log = hashTable_get(logsByName, name, strlen(name));
+	free(name);
+    }
+    return log;
+}
+
+/* remove a Logfile that is no longer configured, its position is kept as a
+ * checkpoint in case it is configured again */
+static void
+logfile_drop(Logfile *self)
+{
+    int detached = self->detached;
+
+    Daemon_printf("Stopped reading `%s'", self->name);
+
+    /* lines of a rotated file are still handled by the current Actions */
+    if (self->rotated.fd >= 0)
+    {
+	/* this already removes a detached Logfile */
+	logfile_stopDrain(self);
+	if (detached) return;
+    }
+
+    logfile_checkpoint(self);
+    hashTable_remove(logsByName, self->name, strlen(self->name));
+    logfile_remove(self);
+}
+
+/* compile the patterns of all new or changed Actions of the reloaded
+ * config */
+static void
+compileAll(void)
+{
+    Action_newAll(reloadActs, compiledActs, numReloadActs);
+}
+
+/* main function of the thread compiling patterns */
+static void *
+compileMain(void *data)
+{
+    uint64_t one = 1;
+
+    (void)data; /* unused */
+
+    compileAll();
+
+    /* hand back to the main thread */
+    if (write(reloadFd, &one, sizeof(one)) < 0)
     {
-	fclose(self->file);
-	self->file = NULL;
+	Daemon_perror("Reload write()");
     }
+    return NULL;
+}
+
+/* wait for the thread compiling patterns */
+static void
+joinReload(void)
+{
+    pthread_join(reloadThread, NULL);
+    EventLoop_removeFd(reloadFd);
+    close(reloadFd);
+    reloadFd = -1;
+}
+
+/* forget the reloaded config, freeing compiled Actions not used */
+static void
+finishReload(void)
+{
+    size_t i;
+
+    for (i = 0; i < numReloadActs; ++i) action_free(compiledActs[i]);
+    free(compiledActs);
+    free(reloadActs);
+    compiledActs = NULL;
+    reloadActs = NULL;
+    numReloadActs = 0;
+    numCompiled = 0;
+    reloading = 0;
+}
+
+static void
+cancelReload(void)
+{
+    if (reloadFd >= 0) joinReload();
+    finishReload();
+}
+
+/* replace the watch of a Logfile whose watch mode changed */
+static void
+logfile_rewatch(Logfile *self)
+{
+    if (self->watch == self->previousWatch || self->detached) return;
+    unwatchHandler(self);
+    watchHandler(self);
 }
 
+/* apply the reloaded config to the list of Logfiles, keeping Actions that
+ * didn't change */
+static void
+applyReload(void)
+{
+    Logfile *curr, *prev, *log, *last;
+    Logfile *firstNew = NULL;
+    CfgLogItor *li;
+    CfgActItor *ai;
+    const CfgLog *cl;
+    const CfgAct *ca;
+    Action *act, *chain, *tail;
+    size_t i, n = 0;
+
+    /* like a syntax error, an invalid pattern keeps everything as it is */
+    for (i = 0; i < numReloadActs; ++i)
+    {
+	if (reloadActs[i] && !compiledActs[i])
+	{
+	    Daemon_printf_level(LEVEL_ERR, "Keeping current configuration, "
+		    "action `%s' has an invalid pattern.",
+		    cfgAct_name(reloadActs[i]));
+	    finishReload();
+	    return;
+	}
+    }
+
+    /* no lines are matched while the chains change */
+    Pipeline_flush();
+
+    for (curr = firstLog; curr; curr = curr->next) curr->reloaded = 0;
+
+    li = Config_cfgLogItor();
+    while (cfgLogItor_moveNext(li))
+    {
+	cl = cfgLogItor_current(li);
+	log = findSection(cl);
+	if (log && log->glob)
+	{
+	    /* a file attached to a wildcard section got its own section */
+	    unwatchHandler(log);
+	    logfile_drop(log);
+	    log = NULL;
+	}
+	else if (log && !log->reloaded)
+	{
+	    /* first section of an existing Logfile, rebuild its chain from
+	     * scratch */
+	    log->reloaded = 1;
+	    log->previous = log->first;
+	    log->first = NULL;
+	    log->previousWatch = log->watch;
+	    log->watch = CLW_AUTO;
+	    log->priority = 1;
+	}
+
+	/* collect the Actions of the section, kept or compiled */
+	chain = NULL;
+	tail = NULL;
+	ai = cfgLog_cfgActItor(cl);
+	while (cfgActItor_moveNext(ai))
+	{
+	    ca = cfgActItor_current(ai);
+	    act = compiledActs[n];
+	    compiledActs[n] = NULL;
+	    if (!reloadActs[n])
+	    {
+		/* an identical entry could have taken the equal Action */
+		act = action_take(&(log->previous), ca);
+		if (!act) act = Action_new(ca);
+	    }
+	    ++n;
+
+	    if (!act) continue;
+
+	    /* append at the tail like createActions(). Kept Actions lost
+	     * their literals in action_take(), so there are none to drop */
+	    tail = action_append(tail, act);
+	    if (!chain) chain = tail;
+	}
+	cfgActItor_free(ai);
+
+	if (!log)
+	{
+	    /* a new section */
+	    if (!(log = logfile_new(cl, chain))) continue;
+	    log->reloaded = 1;
+	    log->previousWatch = log->watch;
+	    append(log);
+	    if (!firstNew) firstNew = log;
+	    continue;
+	}
+
+	/* several sections for the same file are merged like at startup */
+	if (chain)
+	{
+	    if (log->first) action_append(log->first, chain);
+	    else log->first = chain;
+	}
+	if (cfgLog_watch(cl) != CLW_AUTO) log->watch = cfgLog_watch(cl);
+	if (cfgLog_priority(cl) > log->priority)
+	{
+	    log->priority = cfgLog_priority(cl);
+	}
+    }
+    cfgLogItor_free(li);
+
+    /* backwards, so attached Logfiles go before their wildcard section */
+    for (curr = lastLog; curr; curr = prev)
+    {
+	prev = curr->prev;
+	if (curr->glob)
+	{
+	    if (!curr->glob->reloaded || !curr->glob->first)
+	    {
+		/* wildcard section is gone */
+		if (!curr->detached) unwatchHandler(curr);
+		logfile_drop(curr);
+		continue;
+	    }
+
+	    /* attached Logfiles share the chain of their section */
+	    curr->first = curr->glob->first;
+	    curr->priority = curr->glob->priority;
+	    curr->previousWatch = curr->watch;
+	    curr->watch = curr->glob->watch;
+	}
+	else if (!curr->reloaded || !curr->first)
+	{
+	    /* section is gone or has no valid Actions left */
+	    if (curr->reloaded)
+	    {
+		curr->first = curr->previous;
+		curr->previous = NULL;
+	    }
+	    unwatchHandler(curr);
+	    logfile_drop(curr);
+	    continue;
+	}
+	else
+	{
+	    /* Actions not taken for the new chain are gone */
+	    action_free(curr->previous);
+	    curr->previous = NULL;
+	}
+
+	if (curr->queue) matchQueue_setChain(curr->queue, curr->first);
+	logfile_rewatch(curr);
+    }
+
+    /* files matching wildcard sections, including new sections and files
+     * that lost a section of their own */
+    last = lastLog;
+    for (curr = firstLog; curr; curr = curr->next)
+    {
+	if (curr->isGlob) logfile_expand(curr);
+	if (curr == last) break;
+    }
+    if (!firstNew) firstNew = last ? last->next : firstLog;
+
+    /* everything new is watched when all chains are complete */
+    for (curr = firstNew; curr; curr = curr->next) watchHandler(curr);
+
+    Daemon_printf("Reloaded configuration in %lld ms, compiled %lu of %lu "
+	    "actions.", EventLoop_now() - reloadStart,
+	    (unsigned long)numCompiled, (unsigned long)numReloadActs);
+    finishReload();
+}
+
+/* handler for the eventfd of the thread compiling patterns */
+static void
+reloadCompiled(void *data, uint32_t events)
+{
+    (void)data; /* unused */
+    (void)events; /* unused */
+
+    joinReload();
+    applyReload();
+}
+
+int
+LogfileList_reload(LogfileList_watchHandler unwatch,
+	LogfileList_watchHandler watch)
+{
+    CfgLogItor *li;
+    CfgActItor *ai;
+    Logfile *log;
+    size_t n = 0;
+    sigset_t all, old;
+
+    if (reloading)
+    {
+	Daemon_print_level(LEVEL_NOTICE,
+		"Still reloading the configuration, try again later.");
+	return 0;
+    }
+
+    /* on errors, everything stays as it is */
+    if (!Config_reload()) return 0;
+
+    Daemon_print("Reloading configuration ...");
+    reloading = 1;
+    reloadStart = EventLoop_now();
+    unwatchHandler = unwatch;
+    watchHandler = watch;
+
+    reloadActs = collectCfgActs(&numReloadActs);
+    compiledActs = lladAlloc((numReloadActs + 1) * sizeof(Action *));
+    memset(compiledActs, 0, (numReloadActs + 1) * sizeof(Action *));
+
+    /* only Actions without an equal one for their file are compiled */
+    li = Config_cfgLogItor();
+    while (cfgLogItor_moveNext(li))
+    {
+	log = findSection(cfgLogItor_current(li));
+	if (log && log->glob) log = NULL;
+
+	ai = cfgLog_cfgActItor(cfgLogItor_current(li));
+	while (cfgActItor_moveNext(ai))
+	{
+	    if (log && action_contains(log->first, reloadActs[n]))
+	    {
+		reloadActs[n] = NULL;
+	    }
+	    else ++numCompiled;
+	    ++n;
+	}
+	cfgActItor_free(ai);
+    }
+    cfgLogItor_free(li);
+
+    if (!numCompiled)
+    {
+	applyReload();
+	return 1;
+    }
+
+    /* compile in a thread, meanwhile lines are matched against the current
+     * Actions */
+    reloadFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reloadFd < 0)
+    {
+	Daemon_perror("eventfd()");
+    }
+    else if (!EventLoop_addFd(reloadFd, EPOLLIN, &reloadCompiled, NULL))
+    {
+	close(reloadFd);
+	reloadFd = -1;
+    }
+    else
+    {
+	/* signals are only handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	errno = pthread_create(&reloadThread, NULL, &compileMain, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!errno) return 1;
+
+	Daemon_perror("pthread_create()");
+	EventLoop_removeFd(reloadFd);
+	close(reloadFd);
+	reloadFd = -1;
+    }
+
+    /* no thread, compile right away */
+    compileAll();
+    applyReload();
+    return 1;
+}
+
+void
+LogfileList_logStats(void)
+{
+    Logfile *curr;
+    off_t recovered = totalRecovered;
+
+    /* include rotated files still being drained */
+    for (curr = firstDraining; curr; curr = curr->nextDraining)
+    {
+	recovered += curr->recovered;
+    }
+
+    Daemon_printf("Recovered %lld bytes from rotated logfiles.",
+	    (long long)recovered);
+    Daemon_printf("Scheduler: %lu scans requested, %lu merged into pending "
+	    "scans, %lu turns, %lu scans stopped at the quantum, longest turn "
+	    "%lld ms.", totalScheduled, totalCoalesced, totalTurns,
+	    totalCutoffs, longestTurn);
+}
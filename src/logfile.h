@@ -7,6 +7,8 @@
 
 #include <popt.h>
 
+#include "config.h"
+
 extern const struct poptOption logfile_opts[];
 
 /** libpopt option table for Logfile
@@ -35,18 +37,57 @@ typedef struct logfileItor LogfileItor;
 
 /** Initialize the list of Logfiles.
  * This automatically creates the Logfile list, including Actions, from Config.
+ * Logfiles with a valid Checkpoint are positioned where reading stopped last
+ * time, so the next scan catches up with everything written in between.
  * @memberof LogfileList
  * @static
  */
 void LogfileList_init(void);
 
 /** Destroy the list of Logfiles.
- * This frees all resources allocated during initialization.
+ * This records the final Checkpoints and frees all resources allocated during
+ * initialization.
  * @memberof LogfileList
  * @static
  */
 void LogfileList_done(void);
 
+/** Handler for starting or stopping to watch a Logfile.
+ * @memberof LogfileList
+ * @param log the Logfile
+ */
+typedef void (*LogfileList_watchHandler)(Logfile *log);
+
+/** Reload the configuration and apply it to the list of Logfiles.
+ * The config file is read again with Config_reload(), nothing changes if it
+ * has errors. Actions equal to one the Logfile already has are kept with
+ * their compiled patterns and running commands. Only patterns of new or
+ * changed Actions are compiled, in a separate thread while the EventLoop
+ * keeps matching lines against the current Actions. Then, from the
+ * EventLoop, all chains are replaced at once after waiting for the matcher
+ * threads with Pipeline_flush().
+ *
+ * Logfiles keep their read positions. Logfiles of removed sections are read
+ * to the end of a rotated file and removed, and unwatch is called for them
+ * before. For Logfiles of new sections, or whose watch mode changed, watch
+ * is called when all chains are replaced.
+ * @memberof LogfileList
+ * @static
+ * @param unwatch called before a Logfile is removed or its watch mode
+ *                changes
+ * @param watch called for a new Logfile or after its watch mode changed
+ * @returns 1 if the new configuration is applied or being applied, 0 if it
+ *          has errors or a reload is still in progress
+ */
+int LogfileList_reload(LogfileList_watchHandler unwatch,
+	LogfileList_watchHandler watch);
+
+/** Log statistics about reading Logfiles.
+ * @memberof LogfileList
+ * @static
+ */
+void LogfileList_logStats(void);
+
 /** Create iterator for iterating over all Logfiles.
  * @memberof LogfileList
  * @static
@@ -97,16 +138,66 @@ const char *logfile_dirName(const Logfile *self);
  */
 const char *logfile_baseName(const Logfile *self);
 
+/** Get how changes of the logfile should be noticed.
+ * @memberof Logfile
+ * @param self the Logfile
+ * @returns the configured watch mode
+ */
+CfgLogWatch logfile_watch(const Logfile *self);
+
+/** Check whether a Logfile is a wildcard section.
+ * A wildcard section has wildcards in the base name of its logfile, as
+ * understood by fnmatch(3). It is never read itself, files matching it are
+ * attached to it with logfile_attach() instead.
+ * @memberof Logfile
+ * @param self the Logfile
+ * @returns 1 if it is a wildcard section, 0 otherwise
+ */
+int logfile_isGlob(const Logfile *self);
+
+/** Check whether a Logfile was attached to a wildcard section.
+ * @memberof Logfile
+ * @param self the Logfile
+ * @returns 1 if it was attached, 0 otherwise
+ */
+int logfile_isAttached(const Logfile *self);
+
+/** Attach a file to a wildcard section.
+ * If the base name matches the wildcard section, a new Logfile using the
+ * Actions of the section is created and added to the list. Files in the
+ * directory of the section that match it at startup are already attached by
+ * LogfileList_init(). The new Logfile is read from the beginning on its
+ * first scan.
+ * @memberof Logfile
+ * @param self the wildcard section
+ * @param baseName base name of the file
+ * @returns the new Logfile, or NULL if the name doesn't match, the file
+ *          isn't a regular file or it already is a Logfile
+ */
+Logfile *logfile_attach(Logfile *self, const char *baseName);
+
+/** Detach a deleted file from its wildcard section.
+ * The file is drained as with logfile_rotated(), then the Logfile is removed
+ * from the list and freed. It must not be used after calling this.
+ * @memberof Logfile
+ * @param self the attached Logfile
+ */
+void logfile_detach(Logfile *self);
+
 /** Scan logfile for new lines.
- * This method scans the logfile for new lines, reading them one by one and
- * feeding them to the list of Actions for pattern matching. If the file is
- * not opened, the method tries to open it and reads it from the beginning if
- * it is smaller than 8k -- otherwise the file pointer is put at the end and
+ * This method scans the logfile for new lines, reading them in large chunks
+ * and feeding them one by one to the list of Actions for pattern matching. An
+ * incomplete line at the end of the file is kept until it is completed by a
+ * later scan. Lines longer than the configured maximum are truncated or
+ * skipped, so Actions never see fragments of a line. If the file is not
+ * opened, the method tries to open it and reads it from the beginning if it
+ * is smaller than 8k -- otherwise the file pointer is put at the end and
  * nothing happens.
  *
- * If reopen is given, the file is first closed and reopened and the above
- * logic applies. Only do this if you know the file has been re-created for
- * example by log rotation.
+ * If reopen is given, the file is first reopened and the above logic
+ * applies, while the previously opened file is drained as with
+ * logfile_rotated(). Only do this if you know the file has been re-created
+ * for example by log rotation.
  *
  * Otherwise, if the file is smaller than at the last invocation, the file
  * pointer is just put to the end of the file and a warning message is logged
@@ -118,6 +209,40 @@ const char *logfile_baseName(const Logfile *self);
  */
 void logfile_scan(Logfile *self, int reopen);
 
+/** Schedule scanning the logfile for new lines.
+ * The logfile is scanned as with logfile_scan() after the EventLoop handled
+ * other pending events. Scheduling it again before that is a no-op, so a
+ * burst of changes results in a single scan. When several logfiles are
+ * scheduled, they are scanned round-robin, reading a quantum of bytes
+ * weighted by their priority per turn, so a busy logfile can't delay the
+ * others for long.
+ * @memberof Logfile
+ * @param self the Logfile
+ */
+void logfile_schedule(Logfile *self);
+
+/** Handle rotation or deletion of the logfile.
+ * The currently opened file is read to the end immediately and kept open for
+ * a configurable grace period, so lines written to it by a logger that still
+ * has the old file opened are not lost. Meanwhile, the new file can already
+ * be opened with logfile_scan(). A previously rotated file still being drained
+ * is closed.
+ * @memberof Logfile
+ * @param self the Logfile
+ */
+void logfile_rotated(Logfile *self);
+
+/** Check the logfile for changes that may have been missed.
+ * This is for when events about the logfile could have been lost. If the
+ * file doesn't exist any more, it is handled as with logfile_rotated(). If
+ * it was replaced by a different file, it is reopened as with logfile_scan()
+ * and the old one is drained. Otherwise it is scheduled for scanning with
+ * logfile_schedule().
+ * @memberof Logfile
+ * @param self the Logfile
+ */
+void logfile_rescan(Logfile *self);
+
 /** Close the logfile.
  * If the file is currently opened, this method closes it. This could be used
  * if deletion of the file was detected.
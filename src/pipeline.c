@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "daemon.h"
+#include "eventloop.h"
+#include "util.h"
+
+/* maximum number of matcher threads */
+#define MAX_MATCHERS 64
+
+/* a batch not being matched is handed over once it has this many bytes */
+#define BATCH_SUBMIT 65536
+
+/* a MatchQueue is full when its waiting batch has this many bytes */
+#define BATCH_MAX (1024 * 1024)
+
+/* lines of a Logfile to be matched together */
+struct batch;
+typedef struct batch Batch;
+
+struct batch
+{
+    Batch *next;	/* next Batch in the work or done list */
+    MatchQueue *queue;	/* MatchQueue the Batch belongs to */
+    char *buf;		/* the lines, one after the other */
+    size_t *ends;	/* offset in buf after each line */
+    size_t bufsize;	/* allocated size of buf */
+    size_t buflen;	/* bytes used in buf */
+    size_t endsSize;	/* allocated size of ends */
+    size_t numLines;	/* number of lines */
+};
+
+struct matchQueue
+{
+    Action *chain;		/* Actions to match the lines against */
+    const char *logname;	/* name of the Logfile */
+    MatchQueue_readyHandler ready;  /* handler when accepting lines again */
+    void *data;			/* data for ready */
+    Batch *filling;		/* Batch receiving new lines */
+    Batch *matching;		/* Batch handed to the matcher threads */
+    ActionMatches *matches;	/* matches found in the matching Batch */
+    int busy;			/* flag, matching Batch not done yet */
+    int paused;			/* flag, was full, ready must be called */
+};
+
+static int numMatchers = 0;	/* number of matcher threads from popt */
+
+const struct poptOption pipeline_opts[] = {
+    {"matchers", '\0', POPT_ARG_INT, &numMatchers, 0,
+	"Match lines in <n> threads, reading logfiles and executing commands "
+	"stays in the main thread. Lines of each logfile are matched in "
+	"batches, one batch per logfile at a time, so commands are still "
+	"executed in log order. Defaults to 0, matching lines in the main "
+	"thread.", "n"},
+    POPT_TABLEEND
+};
+
+static pthread_t *threads = NULL;	/* the matcher threads */
+static int numThreads = 0;		/* number of running threads */
+static int evfd = -1;			/* eventfd signaling done Batches */
+static int busyQueues = 0;		/* MatchQueues with a busy Batch */
+
+/* shared between threads, protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static Batch *firstWork = NULL;		/* first Batch waiting for a thread */
+static Batch *lastWork = NULL;		/* last Batch waiting for a thread */
+static Batch *firstDone = NULL;		/* first matched Batch */
+static int stopping = 0;		/* flag, threads should exit */
+
+/* statistics, only updated in the main thread */
+static unsigned long totalBatches = 0;	/* Batches handed over */
+static unsigned long totalLines = 0;	/* lines handed over */
+static unsigned long totalPaused = 0;	/* times a Logfile was paused */
+
+static Batch *
+Batch_new(MatchQueue *queue)
+{
+    Batch *self = lladAlloc(sizeof(Batch));
+    self->next = NULL;
+    self->queue = queue;
+    self->bufsize = BATCH_SUBMIT;
+    self->buf = lladAlloc(self->bufsize);
+    self->endsSize = 1024;
+    self->ends = lladAlloc(self->endsSize * sizeof(size_t));
+    self->buflen = 0;
+    self->numLines = 0;
+    return self;
+}
+
+static void
+batch_free(Batch *self)
+{
+    free(self->ends);
+    free(self->buf);
+    free(self);
+}
+
+/* match all lines of a Batch, called in a matcher thread */
+static void
+batch_match(Batch *self, ActionMatcher *matcher)
+{
+    size_t i, start = 0;
+
+    for (i = 0; i < self->numLines; ++i)
+    {
+	action_matchChain(self->queue->chain, matcher, self->queue->matches,
+		self->buf + start, self->ends[i] - start);
+	start = self->ends[i];
+    }
+}
+
+/* main function of a matcher thread */
+static void *
+matcherMain(void *data)
+{
+    ActionMatcher *matcher = NULL;
+    Batch *b;
+    uint64_t one = 1;
+
+    (void)data; /* unused */
+
+    for (;;)
+    {
+	/* wait for work */
+	pthread_mutex_lock(&lock);
+	while (!firstWork && !stopping) pthread_cond_wait(&workCond, &lock);
+	if (!firstWork)
+	{
+	    pthread_mutex_unlock(&lock);
+	    break;
+	}
+	b = firstWork;
+	firstWork = b->next;
+	if (!firstWork) lastWork = NULL;
+	pthread_mutex_unlock(&lock);
+
+	/* created with the first Batch, when all Actions exist */
+	if (!matcher) matcher = ActionMatcher_new();
+	batch_match(b, matcher);
+
+	/* hand it back to the main thread */
+	pthread_mutex_lock(&lock);
+	b->next = firstDone;
+	firstDone = b;
+	pthread_cond_signal(&doneCond);
+	pthread_mutex_unlock(&lock);
+
+	/* can only fail if the counter overflows, and then the main thread
+	 * is woken up anyways */
+	if (write(evfd, &one, sizeof(one)) < 0) continue;
+    }
+
+    actionMatcher_free(matcher);
+    return NULL;
+}
+
+/* hand the filling Batch of a MatchQueue to the matcher threads */
+static void
+matchQueue_submit(MatchQueue *self)
+{
+    Batch *b = self->filling;
+
+    /* the Batch matched last becomes the one filled next */
+    self->filling = self->matching;
+    self->matching = b;
+    self->busy = 1;
+    ++busyQueues;
+    ++totalBatches;
+    totalLines += b->numLines;
+
+    b->next = NULL;
+    pthread_mutex_lock(&lock);
+    if (lastWork) lastWork->next = b;
+    else firstWork = b;
+    lastWork = b;
+    pthread_cond_signal(&workCond);
+    pthread_mutex_unlock(&lock);
+}
+
+/* execute the matches of a matched Batch, called in the main thread */
+static void
+batch_done(Batch *self)
+{
+    MatchQueue *q = self->queue;
+
+    actionMatches_exec(q->matches, q->logname);
+    self->buflen = 0;
+    self->numLines = 0;
+    q->busy = 0;
+    --busyQueues;
+
+    /* lines collected meanwhile go next */
+    if (q->filling->numLines) matchQueue_submit(q);
+
+    if (q->paused)
+    {
+	/* has room again */
+	q->paused = 0;
+	q->ready(q->data);
+    }
+}
+
+/* handle all matched Batches, optionally waiting for one */
+static void
+handleDone(int wait)
+{
+    Batch *b, *next;
+
+    pthread_mutex_lock(&lock);
+    while (wait && !firstDone) pthread_cond_wait(&doneCond, &lock);
+    b = firstDone;
+    firstDone = NULL;
+    pthread_mutex_unlock(&lock);
+
+    /* order doesn't matter, each MatchQueue has only one of them */
+    for (; b; b = next)
+    {
+	next = b->next;
+	batch_done(b);
+    }
+}
+
+/* handler for the eventfd */
+static void
+eventfdReady(void *data, uint32_t events)
+{
+    uint64_t count;
+
+    (void)data; /* unused */
+    (void)events; /* unused */
+
+    if (read(evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+	Daemon_perror("Pipeline read()");
+    }
+    handleDone(0);
+}
+
+int
+Pipeline_init(void)
+{
+    sigset_t all, old;
+    int i;
+
+    if (numMatchers <= 0) return 1;
+    if (numMatchers > MAX_MATCHERS)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Too many matcher threads, using %d.", MAX_MATCHERS);
+	numMatchers = MAX_MATCHERS;
+    }
+
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd < 0)
+    {
+	Daemon_perror("eventfd()");
+	return 0;
+    }
+    if (!EventLoop_addFd(evfd, EPOLLIN, &eventfdReady, NULL))
+    {
+	close(evfd);
+	evfd = -1;
+	return 0;
+    }
+
+    /* signals are handled by the EventLoop in the main thread only, the
+     * threads inherit a mask blocking all of them */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    stopping = 0;
+    threads = lladAlloc((size_t)numMatchers * sizeof(pthread_t));
+    for (i = 0; i < numMatchers; ++i)
+    {
+	if ((errno = pthread_create(&(threads[numThreads]), NULL,
+			&matcherMain, NULL)))
+	{
+	    Daemon_perror("pthread_create()");
+	    break;
+	}
+	++numThreads;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!numThreads)
+    {
+	Pipeline_done();
+	return 0;
+    }
+
+    Daemon_printf("Matching lines in %d threads.", numThreads);
+    return 1;
+}
+
+void
+Pipeline_done(void)
+{
+    int i;
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&workCond);
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < numThreads; ++i) pthread_join(threads[i], NULL);
+    free(threads);
+    threads = NULL;
+    numThreads = 0;
+
+    if (evfd >= 0)
+    {
+	EventLoop_removeFd(evfd);
+	close(evfd);
+	evfd = -1;
+    }
+}
+
+int
+Pipeline_enabled(void)
+{
+    return numThreads > 0;
+}
+
+void
+Pipeline_flush(void)
+{
+    /* executing matches may hand over further Batches */
+    while (busyQueues) handleDone(1);
+}
+
+void
+Pipeline_logStats(void)
+{
+    if (!numThreads) return;
+    Daemon_printf("Pipeline: %d matcher threads, %lu batches with %lu lines "
+	    "matched, %lu times paused reading.", numThreads, totalBatches,
+	    totalLines, totalPaused);
+}
+
+MatchQueue *
+MatchQueue_new(Action *chain, const char *logname,
+	MatchQueue_readyHandler ready, void *data)
+{
+    MatchQueue *self = lladAlloc(sizeof(MatchQueue));
+    self->chain = chain;
+    self->logname = logname;
+    self->ready = ready;
+    self->data = data;
+    self->filling = Batch_new(self);
+    self->matching = Batch_new(self);
+    self->matches = ActionMatches_new();
+    self->busy = 0;
+    self->paused = 0;
+    return self;
+}
+
+void
+matchQueue_addLine(MatchQueue *self, const char *line, size_t len)
+{
+    Batch *b = self->filling;
+
+    if (b->buflen + len > b->bufsize)
+    {
+	while (b->buflen + len > b->bufsize) b->bufsize *= 2;
+	b->buf = lladRealloc(b->buf, b->bufsize);
+    }
+    if (b->numLines == b->endsSize)
+    {
+	b->endsSize *= 2;
+	b->ends = lladRealloc(b->ends, b->endsSize * sizeof(size_t));
+    }
+
+    memcpy(b->buf + b->buflen, line, len);
+    b->buflen += len;
+    b->ends[b->numLines++] = b->buflen;
+
+    /* don't let a big Batch wait for the end of reading */
+    if (!self->busy && b->buflen >= BATCH_SUBMIT) matchQueue_submit(self);
+}
+
+void
+matchQueue_flush(MatchQueue *self)
+{
+    if (!self->busy && self->filling->numLines) matchQueue_submit(self);
+}
+
+void
+matchQueue_setChain(MatchQueue *self, Action *chain)
+{
+    self->chain = chain;
+}
+
+int
+matchQueue_full(MatchQueue *self)
+{
+    if (!self->busy || self->filling->buflen < BATCH_MAX) return 0;
+
+    if (!self->paused)
+    {
+	self->paused = 1;
+	++totalPaused;
+    }
+    return 1;
+}
+
+void
+matchQueue_free(MatchQueue *self)
+{
+    if (self->busy || self->filling->numLines)
+    {
+	matchQueue_flush(self);
+	Pipeline_flush();
+    }
+    actionMatches_free(self->matches);
+    batch_free(self->matching);
+    batch_free(self->filling);
+    free(self);
+}
@@ -0,0 +1,143 @@
+#ifndef LLAD_PIPELINE_H
+#define LLAD_PIPELINE_H
+
+/** class Pipeline
+ * @file
+ */
+
+#include <stddef.h>
+#include <popt.h>
+
+#include "action.h"
+
+extern const struct poptOption pipeline_opts[];
+
+/** libpopt option table for Pipeline.
+ */
+#define PIPELINE_OPTS {NULL, '\0', POPT_ARG_INCLUDE_TABLE, (struct poptOption *)pipeline_opts, 0, "Pipeline options:", NULL},
+
+/** Static class for matching lines in a pool of threads.
+ * By default, lines are matched in the main thread as soon as they are read.
+ * If matcher threads are configured, lines read from a Logfile are collected
+ * in batches instead, and the batches are matched by whichever thread is
+ * free. The matches are handed back to the main thread through an eventfd
+ * watched by the EventLoop, and their commands are executed there.
+ *
+ * Each Logfile has its own MatchQueue with at most one batch being matched
+ * at a time, while the next batch is filled. So matches of a Logfile are
+ * always executed in log order, while different Logfiles are matched in
+ * parallel, and a slow pattern only delays its own Logfile. When a Logfile
+ * is read faster than its lines are matched, reading it pauses until its
+ * batch is done.
+ * @class Pipeline "pipeline.h"
+ */
+
+struct matchQueue;
+
+/** Class holding the batches of lines of a single Logfile.
+ * @class MatchQueue "pipeline.h"
+ */
+typedef struct matchQueue MatchQueue;
+
+/** Handler called when a full MatchQueue accepts lines again.
+ * @memberof MatchQueue
+ * @param data the data given when creating the MatchQueue
+ */
+typedef void (*MatchQueue_readyHandler)(void *data);
+
+/** Initialize the Pipeline.
+ * This starts the configured number of matcher threads, if any.
+ * @memberof Pipeline
+ * @static
+ * @returns 1 on success, 0 on error
+ */
+int Pipeline_init(void);
+
+/** Stop all matcher threads.
+ * Call Pipeline_flush() first, so no lines are lost.
+ * @memberof Pipeline
+ * @static
+ */
+void Pipeline_done(void);
+
+/** Check whether lines are matched by the Pipeline.
+ * @memberof Pipeline
+ * @static
+ * @returns 1 if matcher threads are running, 0 otherwise
+ */
+int Pipeline_enabled(void);
+
+/** Wait for all lines passed to the Pipeline to be matched.
+ * The matches are executed while waiting. The ready handlers of MatchQueues
+ * accepting lines again are called during this, so they must not add lines
+ * right away.
+ * @memberof Pipeline
+ * @static
+ */
+void Pipeline_flush(void);
+
+/** Log statistics about the Pipeline.
+ * @memberof Pipeline
+ * @static
+ */
+void Pipeline_logStats(void);
+
+/** Create a MatchQueue for a Logfile.
+ * This works as a constructor.
+ * @memberof MatchQueue
+ * @static
+ * @param chain the chain of Actions to match lines against
+ * @param logname the name of the Logfile, used for logging
+ * @param ready called when the MatchQueue accepts lines again after
+ *              matchQueue_full() returned 1, may be called from
+ *              Pipeline_flush()
+ * @param data passed to ready
+ * @returns the new MatchQueue
+ */
+MatchQueue *MatchQueue_new(Action *chain, const char *logname,
+	MatchQueue_readyHandler ready, void *data);
+
+/** Add a line to a MatchQueue.
+ * The line is copied to the batch currently filled.
+ * @memberof MatchQueue
+ * @param self the MatchQueue
+ * @param line the line, doesn't need to be NUL-terminated
+ * @param len the length of the line
+ */
+void matchQueue_addLine(MatchQueue *self, const char *line, size_t len);
+
+/** Hand the lines added so far to the matcher threads.
+ * If a batch of this MatchQueue is still being matched, the lines are handed
+ * over as soon as it is done.
+ * @memberof MatchQueue
+ * @param self the MatchQueue
+ */
+void matchQueue_flush(MatchQueue *self);
+
+/** Replace the chain of Actions lines are matched against.
+ * This is only safe while no batch is being matched, right after
+ * Pipeline_flush().
+ * @memberof MatchQueue
+ * @param self the MatchQueue
+ * @param chain the new chain of Actions
+ */
+void matchQueue_setChain(MatchQueue *self, Action *chain);
+
+/** Check whether a MatchQueue holds too many lines waiting.
+ * If it does, no more lines should be added until the ready handler is
+ * called.
+ * @memberof MatchQueue
+ * @param self the MatchQueue
+ * @returns 1 if the MatchQueue is full, 0 otherwise
+ */
+int matchQueue_full(MatchQueue *self);
+
+/** Destructor for MatchQueue.
+ * Lines still waiting are matched first, by waiting for the whole Pipeline
+ * with Pipeline_flush().
+ * @memberof MatchQueue
+ * @param self the MatchQueue
+ */
+void matchQueue_free(MatchQueue *self);
+
+#endif
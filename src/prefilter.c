@@ -0,0 +1,488 @@
+#include "prefilter.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#include "util.h"
+
+/* number of possible byte values */
+#define NUM_BYTES 256
+
+struct prefilter
+{
+    char **literals;		/* added literals */
+    size_t *lengths;		/* lengths of the literals */
+    int numLiterals;		/* number of literals */
+    int numStates;		/* number of states of the automaton */
+    int numClasses;		/* number of byte classes */
+    int *delta;			/* transitions, numClasses per state */
+    int *lit;			/* literal ending in a state, -1 if none */
+    int *dict;			/* next state on the failure chain with a
+				 * literal ending in it, -1 if none */
+    unsigned char cls[NUM_BYTES];   /* byte class of each byte value */
+};
+
+/* state for extracting literals from a pattern */
+typedef struct literalScan
+{
+    char *run;		/* current run of literal characters */
+    char *best;		/* longest run found so far */
+    size_t runlen;	/* length of current run */
+    size_t bestlen;	/* length of longest run */
+} LiteralScan;
+
+/* end the current run of literal characters, keeping it if it is the
+ * longest so far */
+static void
+endRun(LiteralScan *self)
+{
+    if (self->runlen > self->bestlen)
+    {
+	memcpy(self->best, self->run, self->runlen);
+	self->bestlen = self->runlen;
+    }
+    self->runlen = 0;
+}
+
+/* skip up to and including a given character */
+static const char *
+skipTo(const char *p, char c)
+{
+    while (*p && *p != c) ++p;
+    return *p ? p + 1 : p;
+}
+
+/* character for an escape sequence standing for a literal character, -1 if
+ * it is something else. c is the character after the backslash */
+static int
+escapedChar(char c)
+{
+    if (!c) return -1;
+
+    /* a backslash takes away the special meaning of any non-alphanumeric
+     * character */
+    if (!isalnum((unsigned char)c)) return (unsigned char)c;
+
+    switch (c)
+    {
+	case 'a': return '\a';
+	case 'e': return 0x1b;
+	case 'f': return '\f';
+	case 'n': return '\n';
+	case 'r': return '\r';
+	case 't': return '\t';
+	default: return -1;
+    }
+}
+
+/* skip an escape sequence that isn't a literal character, including its
+ * arguments. p points to the character after the backslash */
+static const char *
+skipEscape(const char *p)
+{
+    char c = *p;
+
+    if (!c) return p;
+    ++p;
+
+    switch (c)
+    {
+	case 'x':
+	case 'o':
+	case 'p':
+	case 'P':
+	case 'N':
+	    /* argument in braces, or hex digits or a single property */
+	    if (*p == '{') return skipTo(p, '}');
+	    if (c == 'x')
+	    {
+		if (isxdigit((unsigned char)*p)) ++p;
+		if (isxdigit((unsigned char)*p)) ++p;
+	    }
+	    else if ((c == 'p' || c == 'P') && *p) ++p;
+	    return p;
+
+	case 'g':
+	case 'k':
+	    /* back references by name or number */
+	    if (*p == '{') return skipTo(p, '}');
+	    if (*p == '<') return skipTo(p, '>');
+	    if (*p == '\'') return skipTo(p + 1, '\'');
+	    if (*p == '-' || *p == '+') ++p;
+	    while (isdigit((unsigned char)*p)) ++p;
+	    return p;
+
+	case 'c':
+	    /* control character */
+	    return *p ? p + 1 : p;
+
+	default:
+	    /* octal escapes and back references */
+	    if (isdigit((unsigned char)c))
+	    {
+		while (isdigit((unsigned char)*p)) ++p;
+	    }
+	    return p;
+    }
+}
+
+/* skip a character class, p points to the opening bracket */
+static const char *
+skipClass(const char *p)
+{
+    ++p;
+    if (*p == '^') ++p;
+
+    /* a closing bracket right at the start is part of the class */
+    if (*p == ']') ++p;
+
+    while (*p && *p != ']')
+    {
+	if (*p == '\\' && p[1]) p += 2;
+	else if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+	{
+	    /* POSIX class like [:alpha:] */
+	    p = skipTo(p + 2, ']');
+	}
+	else ++p;
+    }
+    return *p ? p + 1 : p;
+}
+
+/* parse a quantifier in braces like {2} or {1,3}, p points to the opening
+ * brace. Forms like {,3} and spaces inside are accepted as well, newer PCRE
+ * versions treat them as quantifiers. Returns position after it, or NULL if
+ * this isn't a quantifier */
+static const char *
+quantifier(const char *p, int *min)
+{
+    int digits = 0;
+    int inMin = 1;
+
+    *min = 0;
+    for (++p; isdigit((unsigned char)*p) || *p == ',' || *p == ' '; ++p)
+    {
+	if (*p == ',') inMin = 0;
+	else if (*p != ' ')
+	{
+	    ++digits;
+	    if (inMin && *min < 10) *min = *min * 10 + (*p - '0');
+	}
+    }
+    return *p == '}' && digits ? p + 1 : NULL;
+}
+
+/* check whether a group sets options for the rest of the pattern, like
+ * (?i), p points to the opening parenthesis */
+static int
+setsOptions(const char *p)
+{
+    if (p[1] != '?') return 0;
+    for (p += 2; *p && strchr("imnsxXJU-^", *p); ++p);
+    return *p == ')';
+}
+
+char *
+Prefilter_requiredLiteral(const char *pattern, size_t *len)
+{
+    LiteralScan ls;
+    const char *p = pattern;
+    const char *q;
+    int depth = 0;
+    int c, min;
+
+    ls.run = lladAlloc(strlen(pattern) + 1);
+    ls.best = lladAlloc(strlen(pattern) + 1);
+    ls.runlen = 0;
+    ls.bestlen = 0;
+
+    while (*p)
+    {
+	/* \Q...\E quotes literal characters anywhere */
+	if (p[0] == '\\' && p[1] == 'Q')
+	{
+	    for (p += 2; *p && !(p[0] == '\\' && p[1] == 'E'); ++p)
+	    {
+		if (!depth) ls.run[ls.runlen++] = *p;
+	    }
+	    if (*p) p += 2;
+	    continue;
+	}
+
+	if (depth)
+	{
+	    /* inside a group, which could be optional or contain
+	     * alternatives, only track nesting */
+	    if (*p == '\\') p = skipEscape(p + 1);
+	    else if (*p == '[') p = skipClass(p);
+	    else
+	    {
+		if (*p == '(') ++depth;
+		else if (*p == ')') --depth;
+		++p;
+	    }
+	    continue;
+	}
+
+	switch (*p)
+	{
+	    case '\\':
+		if ((c = escapedChar(p[1])) >= 0)
+		{
+		    ls.run[ls.runlen++] = (char)c;
+		    p += 2;
+		}
+		else
+		{
+		    endRun(&ls);
+		    p = skipEscape(p + 1);
+		}
+		break;
+
+	    case '?':
+	    case '*':
+		/* the last character is optional */
+		if (ls.runlen) --ls.runlen;
+		endRun(&ls);
+		++p;
+		break;
+
+	    case '+':
+		/* the last character is repeated */
+		endRun(&ls);
+		++p;
+		break;
+
+	    case '{':
+		if ((q = quantifier(p, &min)))
+		{
+		    if (!min && ls.runlen) --ls.runlen;
+		    p = q;
+		}
+		else ++p;
+		endRun(&ls);
+		break;
+
+	    case '|':
+		/* alternatives on the top level, nothing is required */
+		free(ls.run);
+		free(ls.best);
+		return NULL;
+
+	    case '(':
+		if (setsOptions(p))
+		{
+		    /* option settings could make matching caseless */
+		    free(ls.run);
+		    free(ls.best);
+		    return NULL;
+		}
+		endRun(&ls);
+		depth = 1;
+		++p;
+		break;
+
+	    case '[':
+		endRun(&ls);
+		p = skipClass(p);
+		break;
+
+	    case '.':
+	    case '^':
+	    case '$':
+	    case ')':
+		endRun(&ls);
+		++p;
+		break;
+
+	    default:
+		ls.run[ls.runlen++] = *p++;
+	}
+    }
+    endRun(&ls);
+
+    free(ls.run);
+    if (!ls.bestlen)
+    {
+	free(ls.best);
+	return NULL;
+    }
+    *len = ls.bestlen;
+    return ls.best;
+}
+
+Prefilter *
+Prefilter_new(void)
+{
+    Prefilter *self = lladAlloc(sizeof(Prefilter));
+    memset(self, 0, sizeof(Prefilter));
+    return self;
+}
+
+int
+prefilter_add(Prefilter *self, const char *literal, size_t len)
+{
+    int i;
+
+    for (i = 0; i < self->numLiterals; ++i)
+    {
+	if (self->lengths[i] == len && !memcmp(self->literals[i], literal, len))
+	{
+	    return i;
+	}
+    }
+
+    self->literals = lladRealloc(self->literals,
+	    (size_t)(self->numLiterals + 1) * sizeof(char *));
+    self->lengths = lladRealloc(self->lengths,
+	    (size_t)(self->numLiterals + 1) * sizeof(size_t));
+    self->literals[self->numLiterals] = lladAlloc(len);
+    memcpy(self->literals[self->numLiterals], literal, len);
+    self->lengths[self->numLiterals] = len;
+    return self->numLiterals++;
+}
+
+void
+prefilter_compile(Prefilter *self)
+{
+    int i, c, s, t, next, head, tail;
+    size_t j, maxStates;
+    int *fail, *queue;
+    const unsigned char *l;
+
+    /* bytes occuring in literals get their own class, all others share
+     * class 0 */
+    memset(self->cls, 0, NUM_BYTES);
+    self->numClasses = 1;
+    maxStates = 1;
+    for (i = 0; i < self->numLiterals; ++i)
+    {
+	l = (const unsigned char *)self->literals[i];
+	for (j = 0; j < self->lengths[i]; ++j)
+	{
+	    if (!self->cls[l[j]]) self->cls[l[j]] = (unsigned char)
+		self->numClasses++;
+	}
+	maxStates += self->lengths[i];
+    }
+
+    self->delta = lladAlloc(maxStates * (size_t)self->numClasses
+	    * sizeof(int));
+    self->lit = lladAlloc(maxStates * sizeof(int));
+    self->dict = lladAlloc(maxStates * sizeof(int));
+    for (j = 0; j < maxStates * (size_t)self->numClasses; ++j)
+    {
+	self->delta[j] = -1;
+    }
+    for (j = 0; j < maxStates; ++j) self->lit[j] = self->dict[j] = -1;
+
+    /* build a trie of all literals */
+    self->numStates = 1;
+    for (i = 0; i < self->numLiterals; ++i)
+    {
+	l = (const unsigned char *)self->literals[i];
+	s = 0;
+	for (j = 0; j < self->lengths[i]; ++j)
+	{
+	    c = self->cls[l[j]];
+	    if (self->delta[s * self->numClasses + c] < 0)
+	    {
+		self->delta[s * self->numClasses + c] = self->numStates++;
+	    }
+	    s = self->delta[s * self->numClasses + c];
+	}
+	self->lit[s] = i;
+    }
+
+    /* add failure transitions in breadth first order, so the transitions of
+     * the failure state are always complete already */
+    fail = lladAlloc((size_t)self->numStates * sizeof(int));
+    queue = lladAlloc((size_t)self->numStates * sizeof(int));
+    fail[0] = 0;
+    head = tail = 0;
+    queue[tail++] = 0;
+    while (head < tail)
+    {
+	s = queue[head++];
+	for (c = 0; c < self->numClasses; ++c)
+	{
+	    next = self->delta[s * self->numClasses + c];
+	    if (next < 0)
+	    {
+		/* no literal continues here, continue like the failure
+		 * state */
+		self->delta[s * self->numClasses + c] = s ?
+		    self->delta[fail[s] * self->numClasses + c] : 0;
+		continue;
+	    }
+
+	    t = s ? self->delta[fail[s] * self->numClasses + c] : 0;
+	    fail[next] = t;
+	    self->dict[next] = self->lit[t] >= 0 ? t : self->dict[t];
+	    queue[tail++] = next;
+	}
+    }
+    free(queue);
+    free(fail);
+
+    /* literals aren't needed any more */
+    for (i = 0; i < self->numLiterals; ++i) free(self->literals[i]);
+    free(self->literals);
+    self->literals = NULL;
+}
+
+int
+prefilter_count(const Prefilter *self)
+{
+    return self->numLiterals;
+}
+
+int
+prefilter_scan(const Prefilter *self, const char *line, size_t len,
+	unsigned char *found)
+{
+    const unsigned char *p = (const unsigned char *)line;
+    const unsigned char *end = p + len;
+    int s = 0;
+    int t, numFound = 0;
+
+    memset(found, 0, (size_t)self->numLiterals);
+
+    while (p < end)
+    {
+	s = self->delta[s * self->numClasses + self->cls[*p++]];
+
+	/* report all literals ending here */
+	for (t = self->lit[s] >= 0 ? s : self->dict[s]; t >= 0;
+		t = self->dict[t])
+	{
+	    if (!found[self->lit[t]])
+	    {
+		found[self->lit[t]] = 1;
+
+		/* nothing more to find */
+		if (++numFound == self->numLiterals) return numFound;
+	    }
+	}
+    }
+
+    return numFound;
+}
+
+void
+prefilter_free(Prefilter *self)
+{
+    int i;
+
+    if (!self) return;
+    if (self->literals)
+    {
+	for (i = 0; i < self->numLiterals; ++i) free(self->literals[i]);
+	free(self->literals);
+    }
+    free(self->lengths);
+    free(self->delta);
+    free(self->lit);
+    free(self->dict);
+    free(self);
+}
@@ -0,0 +1,87 @@
+#ifndef LLAD_PREFILTER_H
+#define LLAD_PREFILTER_H
+
+/** class Prefilter
+ * @file
+ */
+
+#include <stddef.h>
+
+struct prefilter;
+
+/** Class for finding which of a set of literal strings occur in a line.
+ * This is used to skip matching regular expressions that can't match
+ * anyways, because a literal string required by them doesn't occur in a
+ * line. All literals are searched in a single pass over the line using an
+ * Aho-Corasick automaton. Its transition table is built on byte classes
+ * (all bytes not occuring in any literal share one class), so it stays
+ * small even for many literals.
+ * @class Prefilter "prefilter.h"
+ */
+typedef struct prefilter Prefilter;
+
+/** Extract the longest literal string required by a regular expression.
+ * This analyzes the pattern source conservatively: only literal characters
+ * on the top level of the pattern are considered, and nothing is found if
+ * the pattern contains top-level alternatives or sets options like caseless
+ * matching.
+ * @memberof Prefilter
+ * @static
+ * @param pattern a regular expression in perl compatible syntax
+ * @param len receives the length of the literal
+ * @returns the newly allocated literal, not NUL-terminated, or NULL if none
+ *          was found
+ */
+char *Prefilter_requiredLiteral(const char *pattern, size_t *len);
+
+/** Create an empty Prefilter.
+ * This works as a constructor.
+ * @memberof Prefilter
+ * @static
+ * @returns the new Prefilter
+ */
+Prefilter *Prefilter_new(void);
+
+/** Add a literal string to a Prefilter.
+ * This is only possible before prefilter_compile() is called. Adding the same
+ * literal twice gives the same id.
+ * @memberof Prefilter
+ * @param self the Prefilter
+ * @param literal the literal, doesn't need to be NUL-terminated
+ * @param len the length of the literal, must be at least 1
+ * @returns the id of the literal, the ids are numbered from 0
+ */
+int prefilter_add(Prefilter *self, const char *literal, size_t len);
+
+/** Build the automaton for searching the added literals.
+ * @memberof Prefilter
+ * @param self the Prefilter
+ */
+void prefilter_compile(Prefilter *self);
+
+/** Get the number of different literals in a Prefilter.
+ * @memberof Prefilter
+ * @param self the Prefilter
+ * @returns the number of literals
+ */
+int prefilter_count(const Prefilter *self);
+
+/** Search a line for all literals.
+ * @memberof Prefilter
+ * @param self the compiled Prefilter
+ * @param line the line to search, doesn't need to be NUL-terminated
+ * @param len the length of the line
+ * @param found array with one flag per literal id, set to 1 for each literal
+ *              found in the line and to 0 for all others
+ * @returns the number of different literals found
+ */
+int prefilter_scan(const Prefilter *self, const char *line, size_t len,
+	unsigned char *found);
+
+/** Destructor for Prefilter.
+ * @memberof Prefilter
+ * @param self the Prefilter
+ */
+void prefilter_free(Prefilter *self);
+
+#endif
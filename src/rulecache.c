@@ -0,0 +1,351 @@
+#define _POSIX_C_SOURCE 200809L
+#include "rulecache.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "daemon.h"
+#include "hash.h"
+#include "util.h"
+
+/* default rule cache file location */
+#define RULECACHE_DEFAULT RUNSTATEDIR "/%s.rules"
+
+/* start of the rule cache file, identifying the format version */
+#define RULECACHE_MAGIC "llad-rules 1\n"
+
+static char *rulecache = NULL;	/* rule cache file location from popt */
+
+const struct poptOption rulecache_opts[] = {
+    {"rulecache", '\0', POPT_ARG_STRING, &rulecache, 0,
+	"Keep compiled patterns in the file specified in <path>, so they "
+	"don't have to be compiled again on the next start, defaults to "
+	RUNSTATEDIR "/<name>.rules -- pass empty string to disable.", "path"},
+    POPT_TABLEEND
+};
+
+/* header of the rule cache file. It is followed by the pattern strings,
+ * each terminated by a NUL byte and padded to a multiple of 8 bytes, and
+ * then by the compiled patterns as serialized by PCRE2, in the same order.
+ * Everything is in the byte order of the machine. */
+struct header
+{
+    char magic[16];	    /* RULECACHE_MAGIC, padded with NUL bytes */
+    uint64_t checksum;	    /* lladHash of everything after the header */
+    uint64_t patternsLen;   /* bytes of the pattern strings with padding */
+    uint64_t blobLen;	    /* bytes of the serialized patterns */
+    uint64_t count;	    /* number of patterns */
+};
+
+static const char *cacheFile = NULL;	/* real rule cache file location */
+static char cfnbuf[PATH_MAX];		/* buffer for default location */
+static pcre2_code **decoded = NULL;	/* compiled patterns loaded */
+static size_t numDecoded = 0;		/* number of decoded */
+static HashTable *byPattern = NULL;	/* entries of decoded by pattern */
+static char *used = NULL;		/* flags, entry of decoded was used */
+static size_t numUsed = 0;		/* number of entries used */
+static unsigned long misses = 0;	/* patterns not found */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* decode a mapped rule cache file, returns 1 on success, 0 if it is
+ * invalid */
+static int
+load(const char *map, size_t size)
+{
+    const struct header *hdr = (const struct header *)map;
+    const char *body = map + sizeof(struct header);
+    const char *pattern, *end;
+    const uint8_t *blob;
+    pcre2_code **slot;
+    size_t i, len;
+    int32_t n;
+
+    if (size < sizeof(struct header)
+	    || strcmp(hdr->magic, RULECACHE_MAGIC)
+	    || hdr->patternsLen % 8 || hdr->count > INT32_MAX
+	    || hdr->patternsLen > size - sizeof(struct header)
+	    || hdr->blobLen != size - sizeof(struct header) - hdr->patternsLen
+	    || hdr->checksum != lladHash(body, size - sizeof(struct header)))
+    {
+	return 0;
+    }
+    blob = (const uint8_t *)body + hdr->patternsLen;
+    n = pcre2_serialize_get_number_of_codes(blob);
+    if (!hdr->count || n != (int32_t)hdr->count)
+    {
+	return 0;
+    }
+
+    /* PCRE2 checks the bytecode was created by the same version and
+     * build */
+    decoded = lladAlloc(hdr->count * sizeof(pcre2_code *));
+    n = pcre2_serialize_decode(decoded, (int32_t)hdr->count, blob, NULL);
+    if (n != (int32_t)hdr->count)
+    {
+	free(decoded);
+	decoded = NULL;
+	return 0;
+    }
+    numDecoded = hdr->count;
+    used = lladAlloc(numDecoded);
+    memset(used, 0, numDecoded);
+    numUsed = 0;
+
+    byPattern = HashTable_new();
+    pattern = body;
+    end = body + hdr->patternsLen;
+    for (i = 0; i < numDecoded; ++i)
+    {
+	len = pattern < end ? strnlen(pattern, (size_t)(end - pattern)) : 0;
+	if (pattern + len >= end) break;
+
+	slot = &(decoded[i]);
+	if ((slot = hashTable_put(byPattern, pattern, len, slot)))
+	{
+	    /* duplicates aren't written, but keep the first one anyways */
+	    hashTable_put(byPattern, pattern, len, slot);
+	}
+	pattern += len + 1;
+    }
+    if (i < numDecoded)
+    {
+	RuleCache_done();
+	return 0;
+    }
+    return 1;
+}
+
+void
+RuleCache_init(void)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (decoded) RuleCache_done();
+    misses = 0;
+
+    /* prefer option over default location, empty string disables */
+    if (!rulecache)
+    {
+	snprintf(cfnbuf, PATH_MAX, RULECACHE_DEFAULT, Daemon_name());
+	cacheFile = cfnbuf;
+    }
+    else if (strlen(rulecache) > 0)
+    {
+	cacheFile = rulecache;
+    }
+    else
+    {
+	cacheFile = NULL;
+	return;
+    }
+
+    if ((fd = open(cacheFile, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+	/* no rule cache file is fine, e.g. on first start */
+	if (errno != ENOENT)
+	{
+	    Daemon_printf_level(LEVEL_WARNING,
+		    "Could not read `%s': %s", cacheFile, strerror(errno));
+	}
+	return;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+	close(fd);
+	return;
+    }
+
+    /* everything is copied while decoding, so the mapping isn't needed
+     * afterwards */
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not map `%s': %s", cacheFile, strerror(errno));
+	return;
+    }
+
+    if (load(map, (size_t)st.st_size))
+    {
+	Daemon_printf("Loaded %lu compiled patterns from `%s'.",
+		(unsigned long)numDecoded, cacheFile);
+    }
+    else
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Ignoring `%s' with unknown format or from another version of "
+		"PCRE2.", cacheFile);
+    }
+    munmap(map, (size_t)st.st_size);
+}
+
+void
+RuleCache_done(void)
+{
+    size_t i;
+
+    for (i = 0; i < numDecoded; ++i) pcre2_code_free(decoded[i]);
+    free(decoded);
+    decoded = NULL;
+    numDecoded = 0;
+    free(used);
+    used = NULL;
+    numUsed = 0;
+    hashTable_free(byPattern);
+    byPattern = NULL;
+}
+
+pcre2_code *
+RuleCache_take(const char *pattern)
+{
+    pcre2_code **slot = NULL;
+    pcre2_code *re = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (byPattern)
+    {
+	slot = hashTable_get(byPattern, pattern, strlen(pattern));
+    }
+    if (slot)
+    {
+	/* the entry stays for other Actions with the same pattern */
+	if (!used[slot - decoded])
+	{
+	    used[slot - decoded] = 1;
+	    ++numUsed;
+	}
+    }
+    else ++misses;
+    pthread_mutex_unlock(&lock);
+
+    /* the bytecode is only read, so copying doesn't need the lock */
+    if (slot) re = pcre2_code_copy(*slot);
+    return re;
+}
+
+void
+RuleCache_write(const char *const *patterns, const pcre2_code **codes,
+	size_t num)
+{
+    HashTable *seen;
+    const pcre2_code **unique;
+    const char **names;
+    struct header hdr;
+    char *body;
+    uint8_t *blob;
+    PCRE2_SIZE blobLen;
+    size_t i, len, n = 0, patternsLen = 0;
+    char tmpName[PATH_MAX];
+    FILE *cf;
+
+    /* nothing changed if every pattern was found and every entry used */
+    if (!cacheFile) return;
+    if (!misses && (!byPattern || numUsed == hashTable_count(byPattern)))
+    {
+	return;
+    }
+
+    /* each pattern only once */
+    seen = HashTable_new();
+    unique = lladAlloc((num + 1) * sizeof(pcre2_code *));
+    names = lladAlloc((num + 1) * sizeof(char *));
+    for (i = 0; i < num; ++i)
+    {
+	if (!codes[i]) continue;
+	len = strlen(patterns[i]);
+	if (hashTable_put(seen, patterns[i], len, (void *)patterns[i]))
+	{
+	    continue;
+	}
+	names[n] = patterns[i];
+	unique[n++] = codes[i];
+	patternsLen += len + 1;
+    }
+    hashTable_free(seen);
+    patternsLen = (patternsLen + 7) & ~(size_t)7;
+
+    if (!n || n > INT32_MAX
+	    || pcre2_serialize_encode(unique, (int32_t)n, &blob, &blobLen,
+		NULL) < 0)
+    {
+	free(names);
+	free(unique);
+	return;
+    }
+
+    /* pattern strings in the same order, followed by the serialized
+     * patterns */
+    body = lladAlloc(patternsLen + blobLen);
+    memset(body, 0, patternsLen);
+    for (i = 0, len = 0; i < n; ++i)
+    {
+	strcpy(body + len, names[i]);
+	len += strlen(names[i]) + 1;
+    }
+    memcpy(body + patternsLen, blob, blobLen);
+    pcre2_serialize_free(blob);
+    free(names);
+    free(unique);
+
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.magic, RULECACHE_MAGIC);
+    hdr.patternsLen = patternsLen;
+    hdr.blobLen = blobLen;
+    hdr.count = n;
+    hdr.checksum = lladHash(body, patternsLen + blobLen);
+
+    /* write to temporary file first, so a crash can't leave a truncated
+     * rule cache file */
+    snprintf(tmpName, PATH_MAX, "%s.tmp", cacheFile);
+    if (!(cf = fopen(tmpName, "w")))
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not write `%s': %s", tmpName, strerror(errno));
+	free(body);
+	return;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, cf) != 1
+	    || fwrite(body, patternsLen + blobLen, 1, cf) != 1
+	    || fflush(cf) != 0 || fsync(fileno(cf)) < 0)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not write `%s': %s", tmpName, strerror(errno));
+	fclose(cf);
+	unlink(tmpName);
+	free(body);
+	return;
+    }
+    fclose(cf);
+    free(body);
+
+    if (rename(tmpName, cacheFile) < 0)
+    {
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not rename `%s': %s", tmpName, strerror(errno));
+	unlink(tmpName);
+	return;
+    }
+
+    Daemon_printf("Wrote %lu compiled patterns to `%s'.", (unsigned long)n,
+	    cacheFile);
+    misses = 0;
+}
+
+void
+RuleCache_atexit(void)
+{
+    free(rulecache);
+}
@@ -0,0 +1,75 @@
+#ifndef LLAD_RULECACHE_H
+#define LLAD_RULECACHE_H
+
+/** class RuleCache
+ * @file
+ */
+
+/** Static class for keeping compiled patterns across restarts.
+ * The rule cache file holds the bytecode of all patterns compiled at the
+ * last start, serialized by PCRE2, together with their pattern strings. On
+ * startup, it is mapped into memory at once and decoded, so patterns that
+ * didn't change don't need to be compiled again. JIT code can't be
+ * serialized, it is created again from the decoded bytecode. The file is
+ * checked against a checksum, and PCRE2 refuses bytecode of another version
+ * or build, so a stale or broken cache file is just ignored.
+ * @class RuleCache "rulecache.h"
+ */
+
+#include <stddef.h>
+#include <popt.h>
+#ifndef PCRE2_CODE_UNIT_WIDTH
+#define PCRE2_CODE_UNIT_WIDTH 8
+#endif
+#include <pcre2.h>
+
+extern const struct poptOption rulecache_opts[];
+
+/** libpopt option table for RuleCache.
+ */
+#define RULECACHE_OPTS {NULL, '\0', POPT_ARG_INCLUDE_TABLE, (struct poptOption *)rulecache_opts, 0, "Rule cache options:", NULL},
+
+/** Initialize RuleCache and load the rule cache file if it exists.
+ * @memberof RuleCache
+ * @static
+ */
+void RuleCache_init(void);
+
+/** Free all compiled patterns loaded and not taken.
+ * @memberof RuleCache
+ * @static
+ */
+void RuleCache_done(void);
+
+/** Take the compiled pattern for a pattern string from the cache.
+ * The caller owns a copy of the compiled pattern, which is not JIT compiled
+ * yet, so Actions with the same pattern all get one. Only patterns not in
+ * the cache count as missing. This may be called from several threads at
+ * the same time.
+ * @memberof RuleCache
+ * @static
+ * @param pattern the pattern string
+ * @returns the compiled pattern, NULL if it is not in the cache
+ */
+pcre2_code *RuleCache_take(const char *pattern);
+
+/** Write compiled patterns to the rule cache file.
+ * The file is only written if it doesn't match the patterns given, that is
+ * if any pattern had to be compiled or any entry of the file was not used.
+ * @memberof RuleCache
+ * @static
+ * @param patterns the pattern strings
+ * @param codes the compiled patterns, entries that are NULL are skipped
+ * @param num the number of patterns
+ */
+void RuleCache_write(const char *const *patterns, const pcre2_code **codes,
+	size_t num);
+
+/** Final cleanup.
+ * Call at exit to free memory allocated by libpopt.
+ * @memberof RuleCache
+ * @static
+ */
+void RuleCache_atexit(void);
+
+#endif
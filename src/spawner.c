@@ -0,0 +1,578 @@
+#define _GNU_SOURCE
+#include "spawner.h"
+
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#include "daemon.h"
+#include "eventloop.h"
+#include "util.h"
+
+/* maximum size of a message to the helper process, longer command lines are
+ * launched directly */
+#define SPAWNER_MAXMSG 131072
+
+/* message types */
+#define MSG_SPAWN 1	/* request to launch a command */
+#define MSG_KILL 2	/* request to signal a command */
+#define MSG_STARTED 3	/* reply, command launched or failed */
+#define MSG_EXITED 4	/* reply, command exited */
+
+static int useHelper = 0;	/* flag for using a helper process */
+
+const struct poptOption spawner_opts[] = {
+    {"spawner", '\0', POPT_ARG_NONE, &useHelper, 0,
+	"Launch commands from a small helper process started before the "
+	"patterns are compiled, so launching doesn't get slower with a big "
+	"configuration.", NULL},
+    POPT_TABLEEND
+};
+
+/* header of a request to the helper, followed by the NUL-separated command
+ * line for MSG_SPAWN */
+typedef struct spawnerRequest
+{
+    uint32_t type;	/* message type */
+    uint32_t id;	/* id of the request */
+    int32_t signum;	/* signal to send for MSG_KILL */
+} SpawnerRequest;
+
+/* reply from the helper, the output pipe is attached to successful
+ * MSG_STARTED replies */
+typedef struct spawnerReply
+{
+    uint32_t type;	/* message type */
+    uint32_t id;	/* id of the request */
+    int32_t pid;	/* process id of the command */
+    int32_t value;	/* errno for MSG_STARTED, status for MSG_EXITED */
+} SpawnerReply;
+
+/* a request of the daemon waiting for replies */
+struct spawnerPending;
+typedef struct spawnerPending SpawnerPending;
+
+struct spawnerPending
+{
+    Spawner_startHandler started;   /* handler for MSG_STARTED */
+    Spawner_exitHandler exited;	    /* handler for MSG_EXITED */
+    void *data;			    /* data for the handlers */
+    SpawnerPending *next;	    /* next pending request */
+    unsigned id;		    /* id of the request */
+};
+
+/* a command launched by the helper */
+struct spawnerChild;
+typedef struct spawnerChild SpawnerChild;
+
+struct spawnerChild
+{
+    SpawnerChild *next;	/* next running command */
+    pid_t pid;		/* process id of the command */
+    unsigned id;	/* id of the request */
+};
+
+static int sock = -1;			/* socket to the other process */
+static pid_t helperPid = -1;		/* process id of the helper */
+static unsigned lastId = 0;		/* last request id used */
+static SpawnerPending *firstPending = NULL; /* requests waiting for replies */
+static SpawnerChild *firstChild = NULL;	/* commands launched by the helper */
+static char *msgbuf = NULL;		/* buffer for messages */
+
+int
+Spawner_launch(char *const *argv, pid_t *pid, int *infd, int *outfd)
+{
+    int fds[2];
+    int infds[2];
+    int rc;
+    sigset_t sigset;
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+
+    if (pipe2(fds, O_CLOEXEC) < 0) return errno;
+    if (infd && pipe2(infds, O_CLOEXEC) < 0)
+    {
+	rc = errno;
+	close(fds[0]);
+	close(fds[1]);
+	return rc;
+    }
+
+    /* arrange stdio file descriptors of the child: /dev/null or the input
+     * pipe on stdin and the output pipe on stdout and stderr. dup2() clears
+     * close-on-exec on the copies. */
+    posix_spawn_file_actions_init(&fa);
+    if (infd)
+    {
+	posix_spawn_file_actions_adddup2(&fa, infds[0], STDIN_FILENO);
+    }
+    else
+    {
+	posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null",
+		O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDERR_FILENO);
+
+    /* signals handled by the EventLoop are blocked, so reset the signal
+     * mask. Only block SIGINT, because this propagates when running
+     * interactively, so children wouldn't get a chance to terminate
+     * normally when the user hits Ctrl-C */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    posix_spawnattr_setsigmask(&attr, &sigset);
+
+    /* and give the child default handling of the signals we handle */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGHUP);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGCHLD);
+    sigaddset(&sigset, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigset);
+    posix_spawnattr_setflags(&attr,
+	    POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    /* posix_spawn() uses vfork semantics, so the cost doesn't depend on the
+     * size of the process. Failing to execute is reported here. */
+    rc = posix_spawn(pid, argv[0], &fa, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    if (infd) close(infds[0]);
+
+    if (rc != 0)
+    {
+	close(fds[0]);
+	if (infd) close(infds[1]);
+	return rc;
+    }
+
+    *outfd = fds[0];
+    if (infd) *infd = infds[1];
+    return 0;
+}
+
+/* send a reply from the helper, optionally passing a file descriptor */
+static void
+helper_reply(uint32_t type, unsigned id, pid_t pid, int value, int fd)
+{
+    SpawnerReply reply;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union
+    {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+    } ctrl;
+
+    reply.type = type;
+    reply.id = id;
+    reply.pid = pid;
+    reply.value = value;
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof(reply);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+	/* pass file descriptor with SCM_RIGHTS */
+	memset(&ctrl, 0, sizeof(ctrl));
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 && errno == EINTR);
+}
+
+/* handle a request in the helper */
+static void
+helper_request(void *data, uint32_t events)
+{
+    ssize_t len;
+    SpawnerRequest req;
+    SpawnerChild *child;
+    char **argv;
+    char *ptr, *end;
+    size_t argc, i;
+    pid_t pid;
+    int outfd, rc;
+
+    (void)data; /* unused */
+    (void)events; /* unused */
+
+    len = recv(sock, msgbuf, SPAWNER_MAXMSG, 0);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (len < (ssize_t)sizeof(req))
+    {
+	/* daemon is gone */
+	EventLoop_stop();
+	return;
+    }
+    memcpy(&req, msgbuf, sizeof(req));
+
+    if (req.type == MSG_KILL)
+    {
+	/* only signal commands not yet reaped */
+	for (child = firstChild; child; child = child->next)
+	{
+	    if (child->id == req.id)
+	    {
+		kill(child->pid, req.signum);
+		break;
+	    }
+	}
+	return;
+    }
+    if (req.type != MSG_SPAWN) return;
+
+    /* split command line, it's terminated by a NUL byte */
+    ptr = msgbuf + sizeof(req);
+    end = msgbuf + len;
+    argc = 0;
+    for (i = 0; ptr + i < end; ++i) if (!ptr[i]) ++argc;
+    argv = lladAlloc((argc + 1) * sizeof(char *));
+    for (i = 0; i < argc; ++i)
+    {
+	argv[i] = ptr;
+	ptr += strlen(ptr) + 1;
+    }
+    argv[argc] = NULL;
+
+    rc = argc ? Spawner_launch(argv, &pid, NULL, &outfd) : EINVAL;
+    free(argv);
+
+    if (rc)
+    {
+	helper_reply(MSG_STARTED, req.id, -1, rc, -1);
+	return;
+    }
+
+    /* remember command for reporting its exit */
+    child = lladAlloc(sizeof(SpawnerChild));
+    child->pid = pid;
+    child->id = req.id;
+    child->next = firstChild;
+    firstChild = child;
+
+    helper_reply(MSG_STARTED, req.id, pid, 0, outfd);
+    close(outfd);
+}
+
+/* reap exited commands in the helper and report them */
+static void
+helper_childSignal(void *data, int signum)
+{
+    SpawnerChild **curr, *child;
+    pid_t pid;
+    int status;
+
+    (void)data; /* unused */
+    (void)signum; /* unused */
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+	for (curr = &firstChild; *curr; curr = &((*curr)->next))
+	{
+	    if ((*curr)->pid == pid)
+	    {
+		child = *curr;
+		*curr = child->next;
+		helper_reply(MSG_EXITED, child->id, pid, status, -1);
+		free(child);
+		break;
+	    }
+	}
+    }
+}
+
+/* main routine of the helper process */
+static void
+helper_main(void)
+{
+    struct sigaction handler;
+
+    /* start with an own EventLoop, not sharing anything with the daemon */
+    EventLoop_done();
+    if (!EventLoop_init()) _exit(EXIT_FAILURE);
+
+    EventLoop_addFd(sock, EPOLLIN, &helper_request, NULL);
+    EventLoop_addSignal(SIGCHLD, &helper_childSignal, NULL);
+
+    /* the daemon handles these, don't get stopped by them */
+    memset(&handler, 0, sizeof(handler));
+    handler.sa_handler = SIG_IGN;
+    sigemptyset(&(handler.sa_mask));
+    sigaction(SIGTERM, &handler, NULL);
+    sigaction(SIGINT, &handler, NULL);
+    sigaction(SIGHUP, &handler, NULL);
+    sigaction(SIGUSR1, &handler, NULL);
+
+    EventLoop_run();
+
+    /* _exit(), so nothing registered by the daemon with atexit() runs */
+    _exit(EXIT_SUCCESS);
+}
+
+/* remove a pending request from the list */
+static void
+removePending(SpawnerPending *pending)
+{
+    SpawnerPending **curr = &firstPending;
+
+    while (*curr && *curr != pending) curr = &((*curr)->next);
+    if (*curr) *curr = pending->next;
+    free(pending);
+}
+
+/* helper process is gone, report all pending requests */
+static void
+helperLost(void)
+{
+    SpawnerPending *pending;
+
+    Daemon_print_level(LEVEL_ERR,
+	    "Spawner helper exited, launching commands directly.");
+
+    EventLoop_removeFd(sock);
+    close(sock);
+    sock = -1;
+    waitpid(helperPid, NULL, WNOHANG);
+    helperPid = -1;
+
+    while ((pending = firstPending))
+    {
+	firstPending = pending->next;
+	if (pending->started)
+	{
+	    pending->started(pending->data, -1, -1, EPIPE);
+	}
+	else
+	{
+	    pending->exited(pending->data, -1);
+	}
+	free(pending);
+    }
+}
+
+/* handle replies from the helper in the daemon */
+static void
+replyReceived(void *data, uint32_t events)
+{
+    SpawnerReply reply;
+    SpawnerPending *pending;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t len;
+    int fd;
+    union
+    {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+    } ctrl;
+
+    (void)data; /* unused */
+    (void)events; /* unused */
+
+    for (;;)
+    {
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &reply;
+	iov.iov_len = sizeof(reply);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if (len < (ssize_t)sizeof(reply))
+	{
+	    helperLost();
+	    return;
+	}
+
+	/* get passed file descriptor, if any */
+	fd = -1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+		&& cmsg->cmsg_type == SCM_RIGHTS)
+	{
+	    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	for (pending = firstPending; pending; pending = pending->next)
+	{
+	    if (pending->id == reply.id) break;
+	}
+	if (!pending)
+	{
+	    if (fd >= 0) close(fd);
+	    continue;
+	}
+
+	if (reply.type == MSG_STARTED && pending->started)
+	{
+	    pending->started(pending->data, reply.pid, fd, reply.value);
+
+	    /* wait for exit only if it was started */
+	    if (reply.value) removePending(pending);
+	    else pending->started = NULL;
+	}
+	else if (reply.type == MSG_EXITED)
+	{
+	    pending->exited(pending->data, reply.value);
+	    removePending(pending);
+	}
+	else if (fd >= 0)
+	{
+	    close(fd);
+	}
+    }
+}
+
+int
+Spawner_init(void)
+{
+    int fds[2];
+
+    if (!useHelper) return 1;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+	Daemon_perror("socketpair()");
+	return 0;
+    }
+
+    msgbuf = lladAlloc(SPAWNER_MAXMSG);
+
+    helperPid = fork();
+    if (helperPid < 0)
+    {
+	Daemon_perror("fork()");
+	close(fds[0]);
+	close(fds[1]);
+	free(msgbuf);
+	msgbuf = NULL;
+	return 0;
+    }
+
+    if (!helperPid)
+    {
+	close(fds[0]);
+	sock = fds[1];
+	helper_main();
+    }
+
+    close(fds[1]);
+    sock = fds[0];
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    EventLoop_addFd(sock, EPOLLIN, &replyReceived, NULL);
+    Daemon_printf("Started spawner helper (%d).", helperPid);
+    return 1;
+}
+
+void
+Spawner_done(void)
+{
+    SpawnerPending *pending;
+
+    if (sock >= 0)
+    {
+	/* closing the socket stops the helper */
+	EventLoop_removeFd(sock);
+	close(sock);
+	sock = -1;
+	waitpid(helperPid, NULL, 0);
+	helperPid = -1;
+    }
+
+    while ((pending = firstPending))
+    {
+	firstPending = pending->next;
+	free(pending);
+    }
+
+    free(msgbuf);
+    msgbuf = NULL;
+}
+
+int
+Spawner_helperRunning(void)
+{
+    return sock >= 0;
+}
+
+unsigned
+Spawner_request(char *const *argv, Spawner_startHandler started,
+	Spawner_exitHandler exited, void *data)
+{
+    SpawnerRequest req;
+    SpawnerPending *pending;
+    size_t len, arglen;
+    char *const *arg;
+
+    if (sock < 0) return 0;
+
+    /* serialize command line after the header */
+    if (!++lastId) ++lastId;
+    req.type = MSG_SPAWN;
+    req.id = lastId;
+    req.signum = 0;
+    memcpy(msgbuf, &req, sizeof(req));
+    len = sizeof(req);
+    for (arg = argv; *arg; ++arg)
+    {
+	arglen = strlen(*arg) + 1;
+	if (len + arglen > SPAWNER_MAXMSG) return 0;
+	memcpy(msgbuf + len, *arg, arglen);
+	len += arglen;
+    }
+
+    if (send(sock, msgbuf, len, MSG_NOSIGNAL) < 0)
+    {
+	/* helper busy or gone, let the caller launch directly */
+	return 0;
+    }
+
+    pending = lladAlloc(sizeof(SpawnerPending));
+    pending->started = started;
+    pending->exited = exited;
+    pending->data = data;
+    pending->id = lastId;
+    pending->next = firstPending;
+    firstPending = pending;
+
+    return lastId;
+}
+
+void
+Spawner_kill(unsigned id, int signum)
+{
+    SpawnerRequest req;
+
+    if (sock < 0) return;
+
+    req.type = MSG_KILL;
+    req.id = id;
+    req.signum = signum;
+    send(sock, &req, sizeof(req), MSG_NOSIGNAL);
+}
@@ -0,0 +1,104 @@
+#ifndef LLAD_SPAWNER_H
+#define LLAD_SPAWNER_H
+
+/** class Spawner
+ * @file
+ */
+
+/** Static class for launching commands.
+ * Commands are launched using posix_spawn(), with /dev/null on stdin and a
+ * pipe on stdout and stderr. Optionally, this is done by a small helper
+ * process forked at startup, before any patterns are compiled. The daemon
+ * sends it command lines over a socket and receives the output pipes and
+ * exit status of the commands asynchronously, so the cost of launching a
+ * command doesn't depend on the size of the daemon.
+ * @class Spawner "spawner.h"
+ */
+
+#include <sys/types.h>
+#include <popt.h>
+
+extern const struct poptOption spawner_opts[];
+
+/** libpopt option table for Spawner.
+ */
+#define SPAWNER_OPTS {NULL, '\0', POPT_ARG_INCLUDE_TABLE, (struct poptOption *)spawner_opts, 0, "Spawner options:", NULL},
+
+/** Handler for the result of launching a command through the helper.
+ * @memberof Spawner
+ * @param data the data given with the request
+ * @param pid the process id of the command
+ * @param outfd the reading end of the output pipe, -1 on error
+ * @param err 0 on success, otherwise the errno value of the failure
+ */
+typedef void (*Spawner_startHandler)(void *data, pid_t pid, int outfd,
+	int err);
+
+/** Handler for the exit of a command launched through the helper.
+ * @memberof Spawner
+ * @param data the data given with the request
+ * @param status the status as returned by waitpid(), -1 if it is unknown
+ *               because the helper process is gone
+ */
+typedef void (*Spawner_exitHandler)(void *data, int status);
+
+/** Initialize Spawner and start the helper process if configured.
+ * This must be called after the EventLoop is initialized, but before
+ * anything else is registered with it.
+ * @memberof Spawner
+ * @static
+ * @returns 1 on success, 0 on error
+ */
+int Spawner_init(void);
+
+/** Stop the helper process.
+ * Commands still running are not affected, but their exit status isn't
+ * reported any more.
+ * @memberof Spawner
+ * @static
+ */
+void Spawner_done(void);
+
+/** Launch a command directly from the calling process.
+ * @memberof Spawner
+ * @static
+ * @param argv the command line, NULL-terminated, argv[0] is the path
+ * @param pid receives the process id of the command
+ * @param infd if not NULL, receives the writing end of a pipe connected to
+ *             the command's stdin, otherwise stdin is /dev/null
+ * @param outfd receives the reading end of the output pipe
+ * @returns 0 on success, otherwise the errno value of the failure
+ */
+int Spawner_launch(char *const *argv, pid_t *pid, int *infd, int *outfd);
+
+/** Check whether the helper process is available.
+ * @memberof Spawner
+ * @static
+ * @returns 1 if commands can be launched through the helper, 0 otherwise
+ */
+int Spawner_helperRunning(void);
+
+/** Ask the helper process to launch a command.
+ * The handlers are called from the EventLoop. exited is only called if the
+ * command was started successfully.
+ * @memberof Spawner
+ * @static
+ * @param argv the command line, NULL-terminated, argv[0] is the path
+ * @param started called with the result of launching the command
+ * @param exited called when the command exited
+ * @param data passed to the handlers
+ * @returns an id for the request, 0 if it couldn't be sent
+ */
+unsigned Spawner_request(char *const *argv, Spawner_startHandler started,
+	Spawner_exitHandler exited, void *data);
+
+/** Send a signal to a command launched through the helper process.
+ * Nothing happens if it already exited.
+ * @memberof Spawner
+ * @static
+ * @param id the id of the request that launched the command
+ * @param signum the signal to send
+ */
+void Spawner_kill(unsigned id, int signum);
+
+#endif
@@ -1,7 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
 #include "util.h"
 
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "daemon.h"
 
@@ -19,6 +21,20 @@ lladAlloc(size_t size)
     return alloc;
 }
 
+void *
+lladRealloc(void *ptr, size_t size)
+{
+    void *alloc = realloc(ptr, size);
+    if (!alloc)
+    {
+	/* same as lladAlloc(), fail quickly */
+	Daemon_printf_level(LEVEL_CRIT,
+		"Could not allocate memory: %s", strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    return alloc;
+}
+
 char *
 lladCloneString(const char *s)
 {
@@ -26,3 +42,39 @@ lladCloneString(const char *s)
     strcpy(dst, s);
     return dst;
 }
+
+uint64_t
+lladHash(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (size--)
+    {
+	hash ^= *p++;
+	hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int
+lladWorkers(size_t jobs, int max)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* sysconf() returns -1 if the number is unknown */
+    if (cpus < 1) cpus = 1;
+    if (cpus > max) cpus = max;
+    if (jobs && (size_t)cpus > jobs) cpus = (long)jobs;
+    return (int)cpus;
+}
+
+long
+lladElapsedUs(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000000L
+	+ (now.tv_nsec - start->tv_nsec) / 1000L;
+}
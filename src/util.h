@@ -6,6 +6,8 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 
 /** Allocate memory.
  * Wrapper around malloc that immediately fails on out of memory conditions.
@@ -14,6 +16,14 @@
  */
 void *lladAlloc(size_t size);
 
+/** Reallocate memory.
+ * Wrapper around realloc that immediately fails on out of memory conditions.
+ * @param ptr the memory block to reallocate, may be NULL
+ * @param size the new size of the memory block
+ * @returns a pointer to the reallocated memory
+ */
+void *lladRealloc(void *ptr, size_t size);
+
 /** Clone a string.
  * This works like strcpy, except it uses lladAlloc() for allocating memory.
  * @param s the string to clone
@@ -21,4 +31,28 @@ void *lladAlloc(size_t size);
  */
 char *lladCloneString(const char *s);
 
+/** Calculate a hash value.
+ * This uses the 64bit FNV-1a hash function, it's fast and good enough for
+ * detecting changed data, but NOT suitable for any cryptographic purposes.
+ * @param data the data to hash
+ * @param size the size of the data
+ * @returns the hash value
+ */
+uint64_t lladHash(const void *data, size_t size);
+
+/** Get the number of threads for working on jobs in parallel.
+ * This is one per online CPU, but at least one, and neither more than a
+ * given maximum nor more than there are jobs.
+ * @param jobs the number of jobs
+ * @param max the maximum number of threads
+ * @returns the number of threads, including the calling thread
+ */
+int lladWorkers(size_t jobs, int max);
+
+/** Calculate the time elapsed since a given time.
+ * @param start the start time, taken from CLOCK_MONOTONIC
+ * @returns the microseconds elapsed since start
+ */
+long lladElapsedUs(const struct timespec *start);
+
 #endif
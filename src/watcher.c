@@ -4,16 +4,41 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <dirent.h>
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
 
+#include "action.h"
 #include "logfile.h"
 #include "daemon.h"
+#include "eventloop.h"
+#include "hash.h"
+#include "pipeline.h"
 #include "util.h"
 
-/* buffer size for reading events from inotify */
-#define EVENT_BUFSIZE 4096
+/* default buffer size for reading events from inotify */
+#define DEFAULT_EVENT_BUFSIZE 65536
+
+/* minimum buffer size, enough for one event with the longest name */
+#define MIN_EVENT_BUFSIZE (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+/* file with the kernel limit for queued inotify events */
+#define MAX_QUEUED_EVENTS "/proc/sys/fs/inotify/max_queued_events"
+
+/* default shortest and longest interval for polling files (ms) */
+#define DEFAULT_POLL_MIN 250
+#define DEFAULT_POLL_MAX 5000
+
+/* shortest interval accepted for polling files (ms) */
+#define POLL_LIMIT 10
+
+/* size of a key for finding a file by directory and base name */
+#define NAMEKEY_SIZE (sizeof(int) + NAME_MAX)
 
 /* information about a watched directory */
 struct watcherDir;
@@ -23,69 +48,182 @@ typedef struct watcherDir WatcherDir;
 struct watcherFile;
 typedef struct watcherFile WatcherFile;
 
-/* information about Logfiles expected in a watched directory */
-struct watcherDirEntry;
-typedef struct watcherDirEntry WatcherDirEntry;
+/* a wildcard section in a watched directory */
+struct watcherGlob;
+typedef struct watcherGlob WatcherGlob;
 
 struct watcherFile
 {
     Logfile *logfile;	/* the Logfile */
     WatcherFile *next;	/* next entry for watched file */
+    WatcherFile *prev;	/* previous entry for watched file */
+    WatcherDir *dir;	/* watched directory, NULL if not watched */
     int inwd;		/* inotify watch descriptor */
 };
 
-struct watcherDirEntry
+struct watcherGlob
 {
-    Logfile *logfile;	    /* the Logfile */
-    WatcherDirEntry *next;  /* next Logfile entry for this directory */
+    Logfile *logfile;	/* the wildcard section */
+    WatcherGlob *next;	/* next wildcard section in the same directory */
 };
 
 struct watcherDir
 {
-    WatcherDirEntry entry;  /* first Logfile entry for this directory */
-    WatcherDir *next;	    /* next entry for watched directory */
-    int inwd;		    /* inotify watch descriptor */
+    WatcherDir *next;	/* next entry for watched directory */
+    WatcherGlob *globs;	/* wildcard sections in this directory */
+    int inwd;		/* inotify watch descriptor */
+};
+
+/* information about a polled file */
+struct watcherPoll;
+typedef struct watcherPoll WatcherPoll;
+
+struct watcherPoll
+{
+    Logfile *logfile;	    /* the Logfile */
+    WatcherPoll *next;	    /* next entry for polled file */
+    Timer *timer;	    /* timer for the next check */
+    long long interval;	    /* current interval between checks (ms) */
+    struct timespec mtime;  /* modification time at the last check */
+    off_t size;		    /* size at the last check */
+    dev_t dev;		    /* device at the last check */
+    ino_t ino;		    /* inode at the last check */
+    int exists;		    /* flag, file existed at the last check */
+};
+
+/* filesystem types where inotify doesn't see changes made elsewhere */
+static const unsigned long remoteFsTypes[] = {
+    0x6969UL,		/* NFS */
+    0x65735546UL,	/* FUSE */
+    0x517bUL,		/* SMB */
+    0xff534d42UL,	/* CIFS */
+    0xfe534d42UL,	/* SMB2 */
+    0x00c36400UL,	/* Ceph */
+    0x01021997UL,	/* 9P */
+    0x6b414653UL,	/* AFS */
+    0x0bd00bd0UL,	/* Lustre */
+    0x01161970UL,	/* GFS2 */
+    0x7461636fUL,	/* OCFS2 */
+    0
 };
 
 static int Watcher_init(void);	/* initialize Watcher */
 static void Watcher_done(void);	/* destroy Watcher */
 
+/* handlers for the EventLoop */
+static void eventsReceived(void *data, uint32_t events);
+static void signalReceived(void *data, int signum);
+
+static int eventBufsize = DEFAULT_EVENT_BUFSIZE;    /* from popt */
+static int pollMin = DEFAULT_POLL_MIN;	/* shortest poll interval (ms) */
+static int pollMax = DEFAULT_POLL_MAX;	/* longest poll interval (ms) */
+
+const struct poptOption watcher_opts[] = {
+    {"event-buffer", '\0', POPT_ARG_INT, &eventBufsize, 0,
+	"Read inotify events in chunks of up to <bytes>, defaults to 65536. "
+	"Larger chunks take less system calls during bursts of events.",
+	"bytes"},
+    {"poll-min", '\0', POPT_ARG_INT, &pollMin, 0,
+	"Check polled logfiles every <ms> milliseconds while they are "
+	"written to, defaults to 250.", "ms"},
+    {"poll-max", '\0', POPT_ARG_INT, &pollMax, 0,
+	"Check polled logfiles at least every <ms> milliseconds, the "
+	"interval doubles up to this while they are unchanged, defaults "
+	"to 5000.", "ms"},
+    POPT_TABLEEND
+};
+
 static int infd = -1;			/* inotify file descriptor */
-static sig_atomic_t running = 0;	/* flag indicating running watcher */
-static int lastSigNum = 0;		/* number of the signal last received */
 static WatcherDir *firstDir = NULL;	/* first watched directory entry */
 static WatcherFile *firstFile = NULL;	/* first watched file entry */
-static char evbuf[EVENT_BUFSIZE]	/* inotify events buffer */
-    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+static WatcherFile *lastFile = NULL;	/* last watched file entry */
+static WatcherPoll *firstPoll = NULL;	/* first polled file entry */
+static HashTable *filesByWd = NULL;	/* WatcherFiles by watch descriptor */
+static HashTable *filesByName = NULL;	/* WatcherFiles by watch descriptor
+					 * of the directory and base name */
+static HashTable *dirsByName = NULL;	/* WatcherDirs by directory name */
+static HashTable *dirsByWd = NULL;	/* WatcherDirs by watch descriptor */
+static HashTable *filesByLog = NULL;	/* WatcherFiles by Logfile */
+static HashTable *pollsByLog = NULL;	/* WatcherPolls by Logfile */
+static char *evbuf = NULL;		/* inotify events buffer */
+static size_t evbufsize = 0;		/* size of evbuf */
+static unsigned long totalEvents = 0;	/* inotify events handled */
+static unsigned long totalOverflows = 0;    /* inotify queue overflows */
+static unsigned long totalPolls = 0;	/* checks of polled files */
+
+/* build the key for finding a file by the watch descriptor of its directory
+ * and its base name, key must have room for NAMEKEY_SIZE bytes.
+ * returns the length of the key */
+static size_t
+nameKey(char *key, int dirwd, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > NAME_MAX) len = NAME_MAX;
+    memcpy(key, &dirwd, sizeof(dirwd));
+    memcpy(key + sizeof(dirwd), name, len);
+    return sizeof(dirwd) + len;
+}
+
+/* index a watched file by its watch descriptor. If several Logfiles are the
+ * same file, they get the same watch descriptor and only the first one is
+ * found, like before */
+static void
+indexFile(WatcherFile *wf)
+{
+    if (wf->inwd > 0 && !hashTable_get(filesByWd, &(wf->inwd),
+		sizeof(wf->inwd)))
+    {
+	hashTable_put(filesByWd, &(wf->inwd), sizeof(wf->inwd), wf);
+    }
+}
+
+/* remove a watched file from the index by watch descriptor */
+static void
+unindexFile(WatcherFile *wf)
+{
+    if (wf->inwd > 0 && hashTable_get(filesByWd, &(wf->inwd),
+		sizeof(wf->inwd)) == wf)
+    {
+	hashTable_remove(filesByWd, &(wf->inwd), sizeof(wf->inwd));
+    }
+}
 
 static void
-registerFile(Logfile *log)
+registerFile(Logfile *log, WatcherDir *dir)
 {
-    WatcherFile *current = firstFile;
+    char key[NAMEKEY_SIZE];
 
     /* create new file watch entry */
     WatcherFile *next = lladAlloc(sizeof(WatcherFile));
     next->next = NULL;
     next->logfile = log;
+    next->dir = dir;
 
     /* add inotify watch for that file */
     next->inwd = inotify_add_watch(infd, logfile_name(log), IN_MODIFY);
 
     /* append it to the list */
-    if (current)
+    next->prev = lastFile;
+    if (lastFile) lastFile->next = next;
+    else firstFile = next;
+    lastFile = next;
+
+    /* index it for events of the file and of its directory */
+    indexFile(next);
+    hashTable_put(filesByLog, &log, sizeof(log), next);
+    if (dir)
     {
-	while (current->next) current = current->next;
-	current->next = next;
-    }
-    else
-    {
-	firstFile = next;
+	hashTable_put(filesByName, key,
+		nameKey(key, dir->inwd, logfile_baseName(log)), next);
     }
 
     if (next->inwd > 0)
     {
-	/* watching now */
+	/* watching now, catch up with lines written since the last
+	 * checkpoint */
 	Daemon_printf("Watching file `%s'", logfile_name(log));
+	logfile_scan(log, 0);
     }
     else
     {
@@ -96,160 +234,268 @@ registerFile(Logfile *log)
     }
 }
 
-static void
+static WatcherDir *
 registerDir(Logfile *log)
 {
-    WatcherDir *current = firstDir;
-    WatcherDirEntry *currentEntry, *nextEntry;
+    WatcherDir *current;
     WatcherDir *nextDir;
+    const char *dirName = logfile_dirName(log);
 
     /* check whether this directory is already watched */
-    while (current)
-    {
-	if (!strcmp(logfile_dirName(current->entry.logfile),
-		    logfile_dirName(log)))
-	{
-	    /* if yes, just append new entry for this logfile to the
-	     * WatcherDir */
-	    nextEntry = lladAlloc(sizeof(WatcherDirEntry));
-	    nextEntry->next = NULL;
-	    nextEntry->logfile = log;
-	    if (current->entry.next)
-	    {
-		currentEntry = current->entry.next;
-		while (currentEntry->next) currentEntry = currentEntry->next;
-		currentEntry->next = nextEntry;
-	    }
-	    else current->entry.next = nextEntry;
-	    return;
-	}
-	current = current->next;
-    }
-
-    current = firstDir;
+    current = hashTable_get(dirsByName, dirName, strlen(dirName));
+    if (current) return current;
 
     /* otherwise create new directory watch entry */
     nextDir = lladAlloc(sizeof(WatcherDir));
     nextDir->next = NULL;
-    nextDir->entry.next = NULL;
-    nextDir->entry.logfile = log;
+    nextDir->globs = NULL;
 
     /* add inotify watch for the directory */
-    nextDir->inwd = inotify_add_watch(infd, logfile_dirName(log),
+    nextDir->inwd = inotify_add_watch(infd, dirName,
 	    IN_CREATE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
 	    | IN_EXCL_UNLINK | IN_ONLYDIR);
 
     if (nextDir->inwd > 0)
     {
 	/* watching now */
-	Daemon_printf("Watching directory `%s'", logfile_dirName(log));
+	Daemon_printf("Watching directory `%s'", dirName);
     }
     else
     {
 	/* "impossible case" ... Logfile guarantees an accessible directory */
 	Daemon_printf_level(LEVEL_ALERT,
 		"Cannot watch directory `%s'. This should never happen!",
-		logfile_dirName(log));
+		dirName);
 	free(nextDir);
-	return;
+	return NULL;
     }
 
-    /* append it to the list */
-    if (current)
+    /* prepend it to the list, the order doesn't matter */
+    nextDir->next = firstDir;
+    firstDir = nextDir;
+    hashTable_put(dirsByName, dirName, strlen(dirName), nextDir);
+    hashTable_put(dirsByWd, &(nextDir->inwd), sizeof(nextDir->inwd),
+	    nextDir);
+    return nextDir;
+}
+
+static void
+registerGlob(Logfile *log)
+{
+    WatcherGlob *wg;
+    WatcherDir *dir = registerDir(log);
+
+    if (!dir) return;
+
+    /* new files in the directory are checked against it */
+    wg = lladAlloc(sizeof(WatcherGlob));
+    wg->logfile = log;
+    wg->next = dir->globs;
+    dir->globs = wg;
+    Daemon_printf("Watching for files matching `%s'", logfile_name(log));
+}
+
+/* check whether a Logfile must be polled */
+static int
+usePolling(Logfile *log)
+{
+    struct statfs sfs;
+    int i;
+
+    if (logfile_watch(log) == CLW_POLL) return 1;
+    if (logfile_watch(log) == CLW_INOTIFY) return 0;
+
+    /* automatic: poll if changes from other hosts could be missed */
+    if (statfs(logfile_dirName(log), &sfs) < 0) return 0;
+    for (i = 0; remoteFsTypes[i]; ++i)
     {
-	while (current->next) current = current->next;
-	current->next = nextDir;
+	if ((unsigned long)sfs.f_type == remoteFsTypes[i])
+	{
+	    Daemon_printf("`%s' is on a network or FUSE filesystem.",
+		    logfile_name(log));
+	    return 1;
+	}
     }
-    else
+    return 0;
+}
+
+/* stat a polled file, returns 1 if it changed since the last check */
+static int
+pollCheck(WatcherPoll *wp)
+{
+    struct stat st;
+    int changed;
+
+    if (stat(logfile_name(wp->logfile), &st) < 0)
     {
-	firstDir = nextDir;
+	changed = wp->exists;
+	wp->exists = 0;
+	return changed;
     }
+
+    changed = !wp->exists || st.st_size != wp->size || st.st_dev != wp->dev
+	|| st.st_ino != wp->ino || st.st_mtim.tv_sec != wp->mtime.tv_sec
+	|| st.st_mtim.tv_nsec != wp->mtime.tv_nsec;
+    wp->exists = 1;
+    wp->size = st.st_size;
+    wp->dev = st.st_dev;
+    wp->ino = st.st_ino;
+    wp->mtime = st.st_mtim;
+    return changed;
+}
+
+/* stop polling a file */
+static void
+removePoll(WatcherPoll *wp)
+{
+    WatcherPoll **curr = &firstPoll;
+
+    while (*curr != wp) curr = &((*curr)->next);
+    *curr = wp->next;
+    if (wp->timer) EventLoop_cancelTimer(wp->timer);
+    hashTable_remove(pollsByLog, &(wp->logfile), sizeof(wp->logfile));
+    free(wp);
+}
+
+/* stop polling a file deleted from a wildcard section's directory */
+static void
+detachPoll(WatcherPoll *wp)
+{
+    Logfile *log = wp->logfile;
+
+    removePoll(wp);
+    logfile_detach(log);
 }
 
+/* timer handler for checking a polled file */
 static void
-sighdl(int signum)
+pollDue(void *data)
 {
-    /* record number of signal received */
-    lastSigNum = signum;
+    WatcherPoll *wp = data;
 
-    /* on TERM and INT, set flag to "not running" */
-    if (signum == SIGTERM || signum == SIGINT)
+    wp->timer = NULL;
+    ++totalPolls;
+    if (pollCheck(wp))
     {
-	running = 0;
+	if (!wp->exists && logfile_isAttached(wp->logfile))
+	{
+	    /* deleted file of a wildcard section */
+	    detachPoll(wp);
+	    return;
+	}
+
+	/* changed: read it and check again soon */
+	logfile_rescan(wp->logfile);
+	wp->interval = pollMin;
     }
+    else
+    {
+	/* quiet: back off */
+	wp->interval *= 2;
+	if (wp->interval > pollMax) wp->interval = pollMax;
+    }
+    wp->timer = EventLoop_addTimer(wp->interval, &pollDue, wp);
 }
 
 static void
-initSignals(void)
-{
-    /* handle TERM, INT, HUP and USR1,
-     * block all standard signals while handling */
-    struct sigaction handler;
-    memset(&handler, 0, sizeof(handler));
-    handler.sa_handler = &sighdl;
-    sigemptyset(&(handler.sa_mask));
-    sigaddset(&(handler.sa_mask), SIGTERM);
-    sigaddset(&(handler.sa_mask), SIGINT);
-    sigaddset(&(handler.sa_mask), SIGHUP);
-    sigaddset(&(handler.sa_mask), SIGUSR1);
-    sigaddset(&(handler.sa_mask), SIGQUIT);
-    sigaddset(&(handler.sa_mask), SIGSTOP);
-    sigaction(SIGTERM, &handler, NULL);
-    sigaction(SIGINT, &handler, NULL);
-    sigaction(SIGHUP, &handler, NULL);
-    sigaction(SIGUSR1, &handler, NULL);
+registerPoll(Logfile *log)
+{
+    /* create new poll entry and prepend it, the order doesn't matter */
+    WatcherPoll *wp = lladAlloc(sizeof(WatcherPoll));
+    wp->logfile = log;
+    wp->next = firstPoll;
+    wp->interval = pollMin;
+    wp->exists = 0;
+    firstPoll = wp;
+    hashTable_put(pollsByLog, &log, sizeof(log), wp);
+
+    if (pollCheck(wp))
+    {
+	/* exists, catch up with lines written since the last checkpoint */
+	Daemon_printf("Polling file `%s'", logfile_name(log));
+	logfile_scan(log, 0);
+    }
+    else
+    {
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Polling non-existent file `%s'", logfile_name(log));
+    }
+
+    wp->timer = EventLoop_addTimer(wp->interval, &pollDue, wp);
 }
 
+/* start watching a Logfile, also a handler for reloading the config */
 static void
-doneSignals(void)
+watchLogfile(Logfile *log)
 {
-    /* set TERM, INT, HUP and USR1 back to being ignored */
-    struct sigaction handler;
-    memset(&handler, 0, sizeof(handler));
-    handler.sa_handler = SIG_IGN;
-    sigemptyset(&(handler.sa_mask));
-    sigaction(SIGTERM, &handler, NULL);
-    sigaction(SIGINT, &handler, NULL);
-    sigaction(SIGHUP, &handler, NULL);
-    sigaction(SIGUSR1, &handler, NULL);
+    if (logfile_isGlob(log)) registerGlob(log);
+    else if (usePolling(log)) registerPoll(log);
+    else registerFile(log, registerDir(log));
 }
 
 static int
 Watcher_init(void)
 {
     LogfileItor *i;
-    Logfile *log;
+    struct timespec start;
 
     /* initialize inotify */
-    infd = inotify_init();
+    infd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     if (infd < 0)
     {
-	Daemon_perror("inotify_init()");
+	Daemon_perror("inotify_init1()");
 	return 0;
     }
 
+    /* buffer from lladAlloc() is suitably aligned for the events */
+    evbufsize = eventBufsize < (int)MIN_EVENT_BUFSIZE ? MIN_EVENT_BUFSIZE
+	: (size_t)eventBufsize;
+    evbuf = lladAlloc(evbufsize);
+
+    filesByWd = HashTable_new();
+    filesByName = HashTable_new();
+    dirsByName = HashTable_new();
+    dirsByWd = HashTable_new();
+    filesByLog = HashTable_new();
+    pollsByLog = HashTable_new();
+
+    if (pollMin < POLL_LIMIT) pollMin = POLL_LIMIT;
+    if (pollMax < pollMin) pollMax = pollMin;
+
     /* iterate over Logfiles, add watchers for the files and directories */
+    clock_gettime(CLOCK_MONOTONIC, &start);
     i = LogfileList_itor();
     while (logfileItor_moveNext(i))
     {
-	log = logfileItor_current(i);
-	registerDir(log);
-	registerFile(log);
+	watchLogfile(logfileItor_current(i));
     }
     logfileItor_free(i);
 
-    if (!firstFile && !firstDir)
+    if (!firstFile && !firstDir && !firstPoll)
     {
 	/* nothing to watch means nothing to do at all -> misconfiguration */
 	Daemon_print_level(LEVEL_ERR,
 		"Nothing to watch, check configuration.");
-	close(infd);
+	Watcher_done();
 	return 0;
     }
-
-    /* handle signals and set flag to "running" */
-    initSignals();
-    running = 1;
+    Daemon_printf("Watching %lu files in %lu directories, polling %lu "
+	    "files, set up in %ld ms.",
+	    (unsigned long)hashTable_count(filesByLog),
+	    (unsigned long)hashTable_count(dirsByName),
+	    (unsigned long)hashTable_count(pollsByLog),
+	    lladElapsedUs(&start) / 1000);
+
+    /* handle inotify events and signals in the EventLoop */
+    if (!EventLoop_addFd(infd, EPOLLIN, &eventsReceived, NULL))
+    {
+	Watcher_done();
+	return 0;
+    }
+    EventLoop_addSignal(SIGTERM, &signalReceived, NULL);
+    EventLoop_addSignal(SIGINT, &signalReceived, NULL);
+    EventLoop_addSignal(SIGHUP, &signalReceived, NULL);
+    EventLoop_addSignal(SIGUSR1, &signalReceived, NULL);
     return 1;
 }
 
@@ -258,10 +504,15 @@ Watcher_done(void)
 {
     WatcherFile *fcurr, *flast;
     WatcherDir *dcurr, *dlast;
-    WatcherDirEntry *ecurr, *elast;
+    WatcherGlob *gcurr, *glast;
+    WatcherPoll *pcurr, *plast;
+
+    /* set TERM, INT, HUP and USR1 back to being ignored */
+    EventLoop_removeSignal(SIGTERM);
+    EventLoop_removeSignal(SIGINT);
+    EventLoop_removeSignal(SIGHUP);
+    EventLoop_removeSignal(SIGUSR1);
 
-    running = 0;
-    doneSignals();
     fcurr = firstFile;
     while (fcurr)
     {
@@ -275,15 +526,46 @@ Watcher_done(void)
     {
 	dlast = dcurr;
 	dcurr = dlast->next;
-	ecurr = dlast->entry.next;
-	while (ecurr)
+	gcurr = dlast->globs;
+	while (gcurr)
 	{
-	    elast = ecurr;
-	    ecurr = elast->next;
-	    free(elast);
+	    glast = gcurr;
+	    gcurr = glast->next;
+	    free(glast);
 	}
 	free(dlast);
     }
+
+    pcurr = firstPoll;
+    while (pcurr)
+    {
+	plast = pcurr;
+	pcurr = plast->next;
+	if (plast->timer) EventLoop_cancelTimer(plast->timer);
+	free(plast);
+    }
+    firstFile = NULL;
+    lastFile = NULL;
+    firstDir = NULL;
+    firstPoll = NULL;
+
+    hashTable_free(filesByWd);
+    hashTable_free(filesByName);
+    hashTable_free(dirsByName);
+    hashTable_free(dirsByWd);
+    hashTable_free(filesByLog);
+    hashTable_free(pollsByLog);
+    dirsByWd = NULL;
+    filesByLog = NULL;
+    pollsByLog = NULL;
+    filesByWd = NULL;
+    filesByName = NULL;
+    dirsByName = NULL;
+
+    free(evbuf);
+    evbuf = NULL;
+
+    EventLoop_removeFd(infd);
     close(infd);
     infd = -1;
 }
@@ -292,217 +574,380 @@ Watcher_done(void)
 static WatcherFile *
 findFile(int wd)
 {
-    WatcherFile *curr;
+    return hashTable_get(filesByWd, &wd, sizeof(wd));
+}
+
+/* find file watcher entry by inotify watch descriptor of the directory and
+ * base name */
+static WatcherFile *
+findFileByName(int dirwd, const char *name)
+{
+    char key[NAMEKEY_SIZE];
+    return hashTable_get(filesByName, key, nameKey(key, dirwd, name));
+}
 
-    curr = firstFile;
-    while (curr)
+/* handle modified file: schedule scanning it for new lines */
+static void
+fileModified(int inwd)
+{
+    WatcherFile *wf = findFile(inwd);
+    if (wf) logfile_schedule(wf->logfile);
+}
+
+/* stop watching a file */
+static void
+removeFile(WatcherFile *wf)
+{
+    char key[NAMEKEY_SIZE];
+
+    unindexFile(wf);
+    hashTable_remove(filesByLog, &(wf->logfile), sizeof(wf->logfile));
+    if (wf->inwd > 0) inotify_rm_watch(infd, wf->inwd);
+    if (wf->dir)
     {
-	if (curr->inwd == wd) break;
-	curr = curr->next;
+	hashTable_remove(filesByName, key, nameKey(key, wf->dir->inwd,
+		    logfile_baseName(wf->logfile)));
     }
-    return curr;
+
+    if (wf->prev) wf->prev->next = wf->next;
+    else firstFile = wf->next;
+    if (wf->next) wf->next->prev = wf->prev;
+    else lastFile = wf->prev;
+    free(wf);
 }
 
-/* find directory watcher entry by inotify watch descriptor */
-static WatcherDir *
-findDir(int wd)
+/* stop watching a file deleted from a wildcard section's directory */
+static void
+detachFile(WatcherFile *wf)
+{
+    Logfile *log = wf->logfile;
+
+    removeFile(wf);
+    logfile_detach(log);
+}
+
+/* stop watching a Logfile, handler for reloading the config */
+static void
+unwatchLogfile(Logfile *log)
 {
-    WatcherDir *curr;
+    WatcherFile *wf;
+    WatcherPoll *wp;
+    WatcherDir *dir;
+    WatcherGlob **wg, *found;
+    const char *dirName = logfile_dirName(log);
 
-    curr = firstDir;
-    while (curr)
+    if ((wf = hashTable_get(filesByLog, &log, sizeof(log))))
+    {
+	removeFile(wf);
+    }
+    else if ((wp = hashTable_get(pollsByLog, &log, sizeof(log))))
+    {
+	removePoll(wp);
+    }
+    else if (logfile_isGlob(log)
+	    && (dir = hashTable_get(dirsByName, dirName, strlen(dirName))))
     {
-	if (curr->inwd == wd) break;
-	curr = curr->next;
+	/* new files are not checked against a wildcard section any more,
+	 * the directory stays watched */
+	for (wg = &(dir->globs); *wg; wg = &((*wg)->next))
+	{
+	    if ((*wg)->logfile != log) continue;
+	    found = *wg;
+	    *wg = found->next;
+	    free(found);
+	    break;
+	}
     }
-    return curr;
 }
 
-/* handle modified file: scan it for new lines */
+/* attach a new file to a matching wildcard section and watch it */
 static void
-fileModified(int inwd)
+attachFile(int dirwd, const char *name)
 {
-    WatcherFile *wf = findFile(inwd);
-    if (wf) logfile_scan(wf->logfile, 0);
+    WatcherGlob *wg;
+    Logfile *log;
+    WatcherDir *dir = hashTable_get(dirsByWd, &dirwd, sizeof(dirwd));
+
+    if (!dir) return;
+
+    /* only the first matching wildcard section gets it */
+    for (wg = dir->globs; wg; wg = wg->next)
+    {
+	if ((log = logfile_attach(wg->logfile, name)))
+	{
+	    if (usePolling(log)) registerPoll(log);
+	    else registerFile(log, dir);
+	    return;
+	}
+    }
 }
 
-/* handle deleted file */
+/* attach files of a directory not seen yet to its wildcard sections */
 static void
-fileDeleted(int inwd, const char *name)
+attachAll(WatcherDir *dir)
 {
-    WatcherDirEntry *entry;
-    WatcherFile *wf;
-    WatcherDir *wd = findDir(inwd);
-    if (wd)
+    DIR *d;
+    struct dirent *de;
+    const char *dirName = logfile_dirName(dir->globs->logfile);
+
+    if (!(d = opendir(dirName)))
     {
-	/* search entries of watched directory for filename */
-	entry = &(wd->entry);
-	while (entry)
+	Daemon_printf_level(LEVEL_WARNING,
+		"Could not read `%s': %s", dirName, strerror(errno));
+	return;
+    }
+
+    while ((de = readdir(d)))
+    {
+	if (!findFileByName(dir->inwd, de->d_name))
 	{
-	    if (!strcmp(logfile_baseName(entry->logfile), name))
-	    {
-		/* found, search list of watched files for logfile */
-		wf = firstFile;
-		while (wf)
-		{
-		    if (wf->logfile == entry->logfile) break;
-		    wf = wf->next;
-		}
-		if (wf)
-		{
-		    /* found, remove inotify watch for this file */
-		    inotify_rm_watch(infd, wf->inwd);
-		    Daemon_printf_level(LEVEL_NOTICE,
-			    "File `%s' disappeared, waiting to watch it again.",
-			    logfile_name(wf->logfile));
-		    wf->inwd = -1;
-
-		    /* and close it */
-		    logfile_close(wf->logfile);
-		}
-		break;
-	    }
-	    entry = entry->next;
+	    attachFile(dir->inwd, de->d_name);
 	}
     }
+    closedir(d);
+}
+
+/* handle deleted file */
+static void
+fileDeleted(int inwd, const char *name)
+{
+    WatcherFile *wf = findFileByName(inwd, name);
+    if (wf && logfile_isAttached(wf->logfile))
+    {
+	/* gone for good, a new file with this name is attached again */
+	detachFile(wf);
+    }
+    else if (wf)
+    {
+	/* found, remove inotify watch for this file */
+	unindexFile(wf);
+	inotify_rm_watch(infd, wf->inwd);
+	Daemon_printf_level(LEVEL_NOTICE,
+		"File `%s' disappeared, waiting to watch it again.",
+		logfile_name(wf->logfile));
+	wf->inwd = -1;
+
+	/* and read it until the end of the grace period */
+	logfile_rotated(wf->logfile);
+    }
 }
 
 /* handle new file in watched directory */
 static void
 fileCreated(int inwd, const char *name)
 {
-    WatcherDirEntry *entry;
-    WatcherFile *wf;
-    WatcherDir *wd = findDir(inwd);
-    if (wd)
+    WatcherFile *wf = findFileByName(inwd, name);
+    if (!wf)
+    {
+	/* maybe a new file for a wildcard section */
+	attachFile(inwd, name);
+    }
+    else if (wf->inwd < 0)
     {
-	/* search entries of watched directory for filename */
-	entry = &(wd->entry);
-	while (entry)
+	/* found if not currently watched, then add watch */
+	wf->inwd = inotify_add_watch(infd, logfile_name(wf->logfile),
+		IN_MODIFY);
+	if (wf->inwd > 0)
 	{
-	    if (!strcmp(logfile_baseName(entry->logfile), name))
-	    {
-		/* found, search list of watched files for logfile */
-		wf = firstFile;
-		while (wf)
-		{
-		    if (wf->logfile == entry->logfile) break;
-		    wf = wf->next;
-		}
-		if (wf && wf->inwd < 0)
-		{
-		    /* found if not currently watched, then add watch */
-		    wf->inwd = inotify_add_watch(infd,
-			    logfile_name(wf->logfile), IN_MODIFY);
-		    if (wf->inwd > 0)
-		    {
-			/* on success, directly scan the newly created file */
-			Daemon_printf("Watching file `%s'",
-				logfile_name(wf->logfile));
-			logfile_scan(wf->logfile, 1);
-		    }
-		    else
-		    {
-			/* otherwise wait for changes making it accessible
-			 * to us */
-			Daemon_printf_level(LEVEL_NOTICE,
-				"Waiting to watch non-accessible newly "
-				"created file `%s'",
-				logfile_name(wf->logfile));
-		    }
-		}
-		break;
-	    }
-	    entry = entry->next;
+	    /* on success, directly scan the newly created file */
+	    indexFile(wf);
+	    Daemon_printf("Watching file `%s'", logfile_name(wf->logfile));
+	    logfile_scan(wf->logfile, 1);
+	}
+	else
+	{
+	    /* otherwise wait for changes making it accessible to us */
+	    Daemon_printf_level(LEVEL_NOTICE,
+		    "Waiting to watch non-accessible newly created file `%s'",
+		    logfile_name(wf->logfile));
 	}
     }
 }
 
-/* main event loop of watcher */
+/* read the kernel limit for queued inotify events, -1 if unknown */
+static long
+maxQueuedEvents(void)
+{
+    FILE *f;
+    long max = -1;
+
+    f = fopen(MAX_QUEUED_EVENTS, "r");
+    if (!f) return -1;
+    if (fscanf(f, "%ld", &max) != 1) max = -1;
+    fclose(f);
+    return max;
+}
+
+/* make sure a file is watched if it exists, by its current inode */
+static void
+rewatchFile(WatcherFile *wf)
+{
+    /* gives the same watch descriptor again if the inode is watched */
+    int inwd = inotify_add_watch(infd, logfile_name(wf->logfile),
+	    IN_MODIFY);
+
+    if (inwd == wf->inwd) return;
+
+    /* missed a deletion or re-creation, watch the new inode instead */
+    unindexFile(wf);
+    if (wf->inwd > 0) inotify_rm_watch(infd, wf->inwd);
+    wf->inwd = inwd;
+    indexFile(wf);
+    if (inwd > 0)
+    {
+	Daemon_printf("Watching file `%s'", logfile_name(wf->logfile));
+    }
+}
+
+/* recover from lost events by checking all files */
 static void
-watchloop(void)
+rescanAll(void)
+{
+    WatcherFile *wf, *next;
+    WatcherDir *dir;
+    long max = maxQueuedEvents();
+
+    ++totalOverflows;
+    Daemon_printf_level(LEVEL_WARNING, "inotify event queue overflowed, "
+	    "rescanning all logfiles. Consider raising "
+	    "fs.inotify.max_queued_events (currently %ld).", max);
+
+    for (wf = firstFile; wf; wf = next)
+    {
+	next = wf->next;
+	if (logfile_isAttached(wf->logfile)
+		&& access(logfile_name(wf->logfile), F_OK) < 0)
+	{
+	    /* missed deletion of a file of a wildcard section */
+	    detachFile(wf);
+	    continue;
+	}
+	rewatchFile(wf);
+	logfile_rescan(wf->logfile);
+    }
+
+    /* and missed creation of files matching wildcard sections */
+    for (dir = firstDir; dir; dir = dir->next)
+    {
+	if (dir->globs) attachAll(dir);
+    }
+}
+
+/* handle events from inotify */
+static void
+eventsReceived(void *data, uint32_t events)
 {
     int chunk, pos;
+    int overflow = 0;
     const struct inotify_event *ev;
-    const char *sig;
 
-    /* only loop as long as the flag is set to "running" */
-    while (running)
+    (void)data; /* unused */
+    (void)events; /* unused */
+
+    /* read all events available */
+    /* evbufsize is at most MAX int value, it comes from an int */
+    while ((chunk = (int) read(infd, evbuf, evbufsize)) > 0)
     {
-	/* read events */
-	/* EVENT_BUFSIZE should be smaller than MAX int value */
-	while ((chunk = (int) read(infd, &evbuf, EVENT_BUFSIZE)) > 0)
+	/* iterate over events read */
+	pos = 0;
+	while (pos < chunk)
 	{
-	    /* iterate over events read */
-	    pos = 0;
-	    while (pos < chunk)
+	    ev = (void *)(&evbuf[pos]);
+	    ++totalEvents;
+	    if (ev->mask & IN_Q_OVERFLOW)
 	    {
-		ev = (void *)(&evbuf[pos]);
-		if (ev->len)
-		{
-		    /* ev->len means an event from a directory, containing a
-		     * file name in ev->name */
-		    if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
-		    {
-			/* moved away or deleted is the same for us, handle
-			 * disappeared file */
-			fileDeleted(ev->wd, ev->name);
-		    }
-		    else if (ev->mask & (IN_MOVED_TO | IN_ATTRIB | IN_CREATE))
-		    {
-			/* moved here and created is the same for us, also
-			 * do the same on attribute changes because it COULD
-			 * have become readable */
-			fileCreated(ev->wd, ev->name);
-		    }
-		}
-		else if (ev->mask & IN_MODIFY)
-		{
-		    /* event from file itself, scan it when modified */
-		    fileModified(ev->wd);
-		}
-		pos += (int) sizeof(struct inotify_event) + (int) ev->len;
+		/* events were lost, rescan after handling the rest */
+		overflow = 1;
 	    }
-	}
-	if (errno != EAGAIN && errno != EINTR)
-	{
-	    /* if not interrupted by a signal or temporary error, log the
-	     * error */
-	    Daemon_perror("inotify read()");
-	    break;
-	}
-	else
-	{
-	    /* otherwise check signal */
-	    if (lastSigNum)
+	    else if (ev->len)
 	    {
-		sig = strsignal(lastSigNum);
-		lastSigNum = 0;
-		if (running)
+		/* ev->len means an event from a directory, containing a
+		 * file name in ev->name */
+		if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
 		{
-		    /* still running -> log ignored signal */
-		    Daemon_printf("Ignoring signal %s", sig);
+		    /* moved away or deleted is the same for us, handle
+		     * disappeared file */
+		    fileDeleted(ev->wd, ev->name);
 		}
-		else
+		else if (ev->mask & (IN_MOVED_TO | IN_ATTRIB | IN_CREATE))
 		{
-		    /* not running any more -> log signal that stopped us */
-		    Daemon_printf_level(LEVEL_NOTICE,
-			    "Received signal %s: stopping daemon.", sig);
+		    /* moved here and created is the same for us, also
+		     * do the same on attribute changes because it COULD
+		     * have become readable */
+		    fileCreated(ev->wd, ev->name);
 		}
 	    }
+	    else if (ev->mask & IN_MODIFY)
+	    {
+		/* event from file itself, scan it when modified */
+		fileModified(ev->wd);
+	    }
+	    pos += (int) sizeof(struct inotify_event) + (int) ev->len;
 	}
     }
+
+    if (chunk < 0 && errno != EAGAIN && errno != EINTR)
+    {
+	/* if not a temporary error, log the error and stop */
+	Daemon_perror("inotify read()");
+	EventLoop_stop();
+	return;
+    }
+
+    /* only after checking errno, rescanning changes it */
+    if (overflow) rescanAll();
+}
+
+/* handle signals received */
+static void
+signalReceived(void *data, int signum)
+{
+    const char *sig = strsignal(signum);
+
+    (void)data; /* unused */
+
+    if (signum == SIGUSR1)
+    {
+	/* log statistics on request */
+	Daemon_print("Statistics:");
+	LogfileList_logStats();
+	Action_logStats();
+	Pipeline_logStats();
+	Daemon_printf("Watcher: %lu inotify events, %lu queue overflows "
+		"(fs.inotify.max_queued_events is %ld), %lu polls.",
+		totalEvents, totalOverflows, maxQueuedEvents(), totalPolls);
+    }
+    else if (signum == SIGTERM || signum == SIGINT)
+    {
+	/* on TERM and INT, stop watching */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Received signal %s: stopping daemon.", sig);
+	EventLoop_stop();
+    }
+    else if (signum == SIGHUP)
+    {
+	/* on HUP, apply changes of the config file */
+	Daemon_printf_level(LEVEL_NOTICE,
+		"Received signal %s: reloading configuration.", sig);
+	LogfileList_reload(&unwatchLogfile, &watchLogfile);
+    }
+    else
+    {
+	/* log ignored signal */
+	Daemon_printf("Ignoring signal %s", sig);
+    }
 }
 
 int
 Watcher_watchlogs(void)
 {
+    int rc;
+
     /* don't try to watch if initialization fails */
     if (!Watcher_init()) return 0;
 
     /* watch and clean up when done */
-    watchloop();
+    rc = EventLoop_run();
     Watcher_done();
-    return 1;
+    return rc;
 }
-
@@ -5,19 +5,35 @@
  * @file
  */
 
+#include <popt.h>
+
+extern const struct poptOption watcher_opts[];
+
+/** libpopt option table for Watcher.
+ */
+#define WATCHER_OPTS {NULL, '\0', POPT_ARG_INCLUDE_TABLE, (struct poptOption *)watcher_opts, 0, "Watcher options:", NULL},
+
 /** Static class for watching a set of Logfiles.
  * This implementation uses the Linux inotify API for watching the files. At
- * least Linux 2.6.36 is needed.
+ * least Linux 2.6.36 is needed. If the inotify event queue overflows, all
+ * Logfiles are rescanned, so changes during a burst are not missed.
+ *
+ * Logfiles on network or FUSE filesystems, where inotify doesn't report
+ * changes made by other hosts, are polled instead, checking their size and
+ * inode on timers of the EventLoop. The interval is short while a Logfile is
+ * written to and backs off while it is unchanged.
  * @class Watcher "watcher.h"
  */
 
 /** Watch logfiles in a loop.
- * This method expects the LogfileList to be initialized. Everything else is
- * handled inside. It installs some signal handling and returns upon receipt
- * of a SIGTERM or SIGINT.
+ * This method expects the LogfileList and the EventLoop to be initialized.
+ * Everything else is handled inside. It registers inotify and some signals
+ * with the EventLoop and runs it, returning upon receipt of a SIGTERM or
+ * SIGINT. On SIGHUP, the config file is reloaded with LogfileList_reload().
  * @memberof Watcher
  * @static
- * @return 1 on success and normal termination, 0 if initialization failed
+ * @return 1 on success and normal termination, 0 if initialization or the
+ *         EventLoop failed
  */
 int Watcher_watchlogs(void);
 